@@ -7,12 +7,33 @@ import websockets.asyncio
 import websockets.asyncio.client
 import websockets.exceptions
 from datetime import datetime, timezone
+from types import SimpleNamespace
 
 # Import the status_pb2.py file generated by `protoc`.
 # This file must be in the same directory as logger.py.
 import status_pb2
 
 
+def split_frame(frame):
+    """Yields the StatusMessages packed into one WebSocket frame, each prefixed with its length as a varint."""
+    pos = 0
+    while pos < len(frame):
+        length = shift = 0
+        while True:
+            if pos >= len(frame) or shift > 28:
+                raise ValueError("malformed length prefix in WebSocket frame")
+            byte = frame[pos]
+            pos += 1
+            length |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        if pos + length > len(frame):
+            raise ValueError("truncated message in WebSocket frame")
+        yield frame[pos:pos + length]
+        pos += length
+
+
 class OdroidPowerLogger:
     """
     A class to connect to the Odroid Smart Power monitoring server and log power data.
@@ -21,14 +42,19 @@ class OdroidPowerLogger:
     3. Receives and decodes binary data in Protobuf format, then prints it.
     """
 
-    def __init__(self, host, username, password, output_file=None):
+    def __init__(self, host, username, password, output_file=None, backfill=0, samples_file=None):
         self.host = host
         self.username = username
         self.password = password
         self.base_url = f"http://{self.host}"
         self.ws_url = f"ws://{self.host}/ws"
         self.output_file = output_file
+        self.backfill = backfill
+        self.samples_file = samples_file
         self.token = None
+        self.last_sequence = None
+        self.last_dropped_frames = None
+        self.next_batch_sequence = None
 
     def login(self):
         """Logs into the server to retrieve an authentication token."""
@@ -51,6 +77,132 @@ class OdroidPowerLogger:
             print(f"Error during login: {e}")
             return False
 
+    def fetch_history(self, count):
+        """Fetches up to `count` of the most recent samples stored on the device."""
+        history_url = f"{self.base_url}/api/history"
+        headers = {"Authorization": f"Bearer {self.token}"}
+        try:
+            response = requests.get(history_url, params={"count": count}, headers=headers, timeout=10)
+            response.raise_for_status()
+        except requests.exceptions.RequestException as e:
+            print(f"Error fetching history: {e}")
+            return []
+
+        history = status_pb2.SensorHistory()
+        history.ParseFromString(response.content)
+        print(f"Backfilled {len(history.samples)} samples from device history.")
+        return history.samples
+
+    @staticmethod
+    def from_fixed_channel(channel):
+        """Converts a SensorChannelFixed message from micro-units into volts, amps, watts, Ah and Wh."""
+        return SimpleNamespace(
+            voltage=channel.voltage_uv / 1e6, current=channel.current_ua / 1e6, power=channel.power_uw / 1e6,
+            current_min=channel.current_min_ua / 1e6, current_max=channel.current_max_ua / 1e6,
+            current_rms=channel.current_rms_ua / 1e6, power_max=channel.power_max_uw / 1e6,
+            charge=channel.charge_uah / 1e6, energy=channel.energy_uwh / 1e6)
+
+    def check_gap(self, sensor_data):
+        """Returns how many conversions are missing between the previous message and this one."""
+        if sensor_data.sequence == 0:
+            return 0  # history samples and older firmware carry no sequence number
+
+        missed = 0
+        if self.last_sequence is not None:
+            expected = (self.last_sequence + sensor_data.sample_count) & 0xFFFFFFFF
+            missed = (sensor_data.sequence - expected) & 0xFFFFFFFF
+            if missed > 0x7FFFFFFF:
+                print(f"  !! sequence went backwards ({self.last_sequence} -> {sensor_data.sequence}), device rebooted?")
+                missed = 0
+            elif missed:
+                frames = ""
+                if self.last_dropped_frames is not None and sensor_data.dropped_frames > self.last_dropped_frames:
+                    frames = f", {sensor_data.dropped_frames - self.last_dropped_frames} websocket frames dropped"
+                print(f"  !! gap: {missed} conversions missing before sequence {sensor_data.sequence}{frames}")
+        self.last_sequence = sensor_data.sequence
+        self.last_dropped_frames = sensor_data.dropped_frames
+        return missed
+
+    def handle_sensor_data(self, sensor_data, csv_writer):
+        """Prints one SensorData message and appends it to the CSV file if enabled."""
+        missed = self.check_gap(sensor_data)
+        vin = self.from_fixed_channel(sensor_data.vin_fixed)
+        main = self.from_fixed_channel(sensor_data.main_fixed)
+        usb = self.from_fixed_channel(sensor_data.usb_fixed)
+
+        ts_dt = datetime.fromtimestamp(sensor_data.timestamp_ms / 1000, tz=timezone.utc)
+        ts_str_print = ts_dt.strftime('%Y-%m-%d %H:%M:%S UTC')
+
+        print(f"--- {ts_str_print} (Uptime: {sensor_data.uptime_ms / 1000}s, "
+              f"{sensor_data.sample_count} samples, seq {sensor_data.sequence}, "
+              f"dropped {sensor_data.dropped_samples} samples / {sensor_data.dropped_frames} frames) ---")
+
+        # Print data for each channel, with the window peaks hidden by the mean
+        for name, channel in [('VIN', vin), ('MAIN', main), ('USB', usb)]:
+            print(
+                f"  {name:<4}: {channel.voltage:5.2f} V | {channel.current:5.3f} A | {channel.power:5.2f} W"
+                f" | pk {channel.current_max:5.3f} A / {channel.power_max:5.2f} W"
+                f" | {channel.charge:8.4f} Ah / {channel.energy:8.4f} Wh")
+
+        # Write to CSV if enabled
+        if csv_writer:
+            ts_iso_csv = ts_dt.isoformat(timespec='milliseconds').replace('+00:00', 'Z')
+            row = [
+                ts_iso_csv, sensor_data.uptime_ms,
+                f"{vin.voltage:.3f}", f"{vin.current:.3f}", f"{vin.power:.3f}",
+                f"{main.voltage:.3f}", f"{main.current:.3f}", f"{main.power:.3f}",
+                f"{usb.voltage:.3f}", f"{usb.current:.3f}", f"{usb.power:.3f}",
+                sensor_data.sample_count
+            ]
+            for channel in (vin, main, usb):
+                row += [f"{channel.current_min:.3f}", f"{channel.current_max:.3f}",
+                        f"{channel.current_rms:.3f}", f"{channel.power_max:.3f}"]
+            row += [sensor_data.sequence, sensor_data.acquired_us, missed]
+            for channel in (vin, main, usb):
+                row += [f"{channel.charge:.6f}", f"{channel.energy:.6f}"]
+            csv_writer.writerow(row)
+
+    @staticmethod
+    def expand_sensor_batch(batch):
+        """Undoes the delta coding of a SensorBatch message, yielding one sample per conversion in V, A and W."""
+        channels = {'vin': batch.vin, 'main': batch.main, 'usb': batch.usb}
+        running = {name: [ch.voltage_mv, ch.current_ma] for name, ch in channels.items()}
+        offset_us = 0
+        for i in range(batch.count):
+            if i > 0:
+                offset_us += batch.time_delta_us[i - 1]
+                for name, ch in channels.items():
+                    running[name][0] += ch.voltage_delta_mv[i - 1]
+                    running[name][1] += ch.current_delta_ma[i - 1]
+            yield SimpleNamespace(
+                timestamp_ms=batch.timestamp_ms + offset_us // 1000,
+                acquired_us=batch.base_us + offset_us,
+                sequence=(batch.base_sequence + i) & 0xFFFFFFFF,
+                **{name: SimpleNamespace(voltage=mv / 1e3, current=ma / 1e3, power=mv * ma / 1e6)
+                   for name, (mv, ma) in running.items()})
+
+    def handle_sensor_batch(self, batch, samples_writer):
+        """Checks a SensorBatch for lost conversions and appends its samples to the samples CSV file if enabled."""
+        missed = 0
+        if self.next_batch_sequence is not None:
+            missed = (batch.base_sequence - self.next_batch_sequence) & 0xFFFFFFFF
+            if missed > 0x7FFFFFFF:
+                missed = 0
+            elif missed:
+                print(f"  !! capture gap: {missed} conversions missing before sequence {batch.base_sequence}")
+        self.next_batch_sequence = (batch.base_sequence + batch.count) & 0xFFFFFFFF
+
+        if not samples_writer:
+            return
+        for sample in self.expand_sensor_batch(batch):
+            ts_dt = datetime.fromtimestamp(sample.timestamp_ms / 1000, tz=timezone.utc)
+            row = [ts_dt.isoformat(timespec='milliseconds').replace('+00:00', 'Z'),
+                   sample.acquired_us, sample.sequence, missed]
+            for channel in (sample.vin, sample.main, sample.usb):
+                row += [f"{channel.voltage:.3f}", f"{channel.current:.3f}", f"{channel.power:.3f}"]
+            samples_writer.writerow(row)
+            missed = 0
+
     async def listen_power_data(self):
         """Connects to the WebSocket to receive and log power data."""
         if not self.token:
@@ -62,6 +214,8 @@ class OdroidPowerLogger:
 
         csv_file = None
         csv_writer = None
+        samples_file = None
+        samples_writer = None
 
         try:
             # --- CSV File Handling ---
@@ -76,7 +230,14 @@ class OdroidPowerLogger:
                         'timestamp', 'uptime_ms',
                         'vin_voltage', 'vin_current', 'vin_power',
                         'main_voltage', 'main_current', 'main_power',
-                        'usb_voltage', 'usb_current', 'usb_power'
+                        'usb_voltage', 'usb_current', 'usb_power',
+                        'samples',
+                        'vin_current_min', 'vin_current_max', 'vin_current_rms', 'vin_power_max',
+                        'main_current_min', 'main_current_max', 'main_current_rms', 'main_power_max',
+                        'usb_current_min', 'usb_current_max', 'usb_current_rms', 'usb_power_max',
+                        'sequence', 'acquired_us', 'missed_samples',
+                        'vin_charge_ah', 'vin_energy_wh', 'main_charge_ah', 'main_energy_wh',
+                        'usb_charge_ah', 'usb_energy_wh'
                     ]
                     csv_writer.writerow(header)
                     print(f"Logging data to {self.output_file}")
@@ -85,42 +246,46 @@ class OdroidPowerLogger:
                     # If file can't be opened, disable CSV writing
                     csv_file = None
                     csv_writer = None
+            if self.samples_file:
+                try:
+                    samples_file = open(self.samples_file, 'w', newline='', encoding='utf-8')
+                    samples_writer = csv.writer(samples_file)
+                    samples_writer.writerow([
+                        'timestamp', 'acquired_us', 'sequence', 'missed_samples',
+                        'vin_voltage', 'vin_current', 'vin_power',
+                        'main_voltage', 'main_current', 'main_power',
+                        'usb_voltage', 'usb_current', 'usb_power'
+                    ])
+                    print(f"Logging capture mode conversions to {self.samples_file}")
+                except IOError as e:
+                    print(f"Error opening samples CSV file: {e}")
+                    samples_file = None
+                    samples_writer = None
             # --- End CSV File Handling ---
 
+            if self.backfill:
+                for sensor_data in self.fetch_history(self.backfill):
+                    self.handle_sensor_data(sensor_data, csv_writer)
+
             async with websockets.connect(uri) as websocket:
                 print(f"Connected to WebSocket: {uri}")
                 while True:
-                    # Receive binary message from the server
-                    message_bytes = await websocket.recv()
-
-                    # Decode the Protobuf message
-                    status_message = status_pb2.StatusMessage()
-                    status_message.ParseFromString(message_bytes)
-
-                    # Process only if the payload type is 'sensor_data'
-                    if status_message.WhichOneof('payload') == 'sensor_data':
-                        sensor_data = status_message.sensor_data
-                        ts_dt = datetime.fromtimestamp(sensor_data.timestamp_ms / 1000, tz=timezone.utc)
-                        ts_str_print = ts_dt.strftime('%Y-%m-%d %H:%M:%S UTC')
-
-                        print(f"--- {ts_str_print} (Uptime: {sensor_data.uptime_ms / 1000}s) ---")
-
-                        # Print data for each channel
-                        for name, channel in [('VIN', sensor_data.vin), ('MAIN', sensor_data.main),
-                                              ('USB', sensor_data.usb)]:
-                            print(
-                                f"  {name:<4}: {channel.voltage:5.2f} V | {channel.current:5.3f} A | {channel.power:5.2f} W")
-
-                        # Write to CSV if enabled
-                        if csv_writer:
-                            ts_iso_csv = ts_dt.isoformat(timespec='milliseconds').replace('+00:00', 'Z')
-                            row = [
-                                ts_iso_csv, sensor_data.uptime_ms,
-                                f"{sensor_data.vin.voltage:.3f}", f"{sensor_data.vin.current:.3f}", f"{sensor_data.vin.power:.3f}",
-                                f"{sensor_data.main.voltage:.3f}", f"{sensor_data.main.current:.3f}", f"{sensor_data.main.power:.3f}",
-                                f"{sensor_data.usb.voltage:.3f}", f"{sensor_data.usb.current:.3f}", f"{sensor_data.usb.power:.3f}"
-                            ]
-                            csv_writer.writerow(row)
+                    # Receive a binary frame from the server, it may carry several messages
+                    frame = await websocket.recv()
+                    if isinstance(frame, str):
+                        continue
+
+                    for message_bytes in split_frame(frame):
+                        # Decode the Protobuf message
+                        status_message = status_pb2.StatusMessage()
+                        status_message.ParseFromString(message_bytes)
+
+                        # Process only the sensor payloads, batches are sent while capture mode is on
+                        payload = status_message.WhichOneof('payload')
+                        if payload == 'sensor_data':
+                            self.handle_sensor_data(status_message.sensor_data, csv_writer)
+                        elif payload == 'sensor_batch':
+                            self.handle_sensor_batch(status_message.sensor_batch, samples_writer)
 
         except websockets.exceptions.ConnectionClosed as e:
             print(f"WebSocket connection closed: {e}")
@@ -130,6 +295,9 @@ class OdroidPowerLogger:
             if csv_file:
                 csv_file.close()
                 print(f"\nCSV file '{self.output_file}' saved.")
+            if samples_file:
+                samples_file.close()
+                print(f"CSV file '{self.samples_file}' saved.")
 
     async def run(self):
         """Runs the logger."""
@@ -143,9 +311,14 @@ async def main():
     parser.add_argument("-u", "--username", required=True, help="Login username")
     parser.add_argument("-p", "--password", required=True, help="Login password")
     parser.add_argument("-o", "--output", help="Path to the output CSV file.")
+    parser.add_argument("-b", "--backfill", type=int, default=0,
+                        help="Number of samples to fetch from the device history before live logging starts.")
+    parser.add_argument("-s", "--samples",
+                        help="Path to a CSV file for the individual conversions streamed in high-rate capture mode.")
     args = parser.parse_args()
 
-    logger = OdroidPowerLogger(host=args.host, username=args.username, password=args.password, output_file=args.output)
+    logger = OdroidPowerLogger(host=args.host, username=args.username, password=args.password, output_file=args.output,
+                               backfill=args.backfill, samples_file=args.samples)
     await logger.run()
 
 
@@ -0,0 +1,82 @@
+import argparse
+import csv
+import struct
+import time
+
+import requests
+
+# Layout of GET /api/scope/data, see main/service/scope.h
+HEADER_FORMAT = "<IHHIIBBBBiQ"
+ENTRY_FORMAT = "<i3H3h"
+SCOPE_MAGIC = 0x43534d50  # "PMSC"
+
+
+def login(base_url, username, password):
+    """Logs into the server and returns the authentication headers."""
+    response = requests.post(f"{base_url}/login", json={"username": username, "password": password}, timeout=5)
+    response.raise_for_status()
+    return {"Authorization": f"Bearer {response.json()['token']}"}
+
+
+def parse_capture(blob):
+    """Splits a capture blob into its header fields and a list of (offset_us, voltages_mv, currents_ma)."""
+    header_size = struct.calcsize(HEADER_FORMAT)
+    magic, version, entry_size, count, trigger_index, source, edge, channel, _, level, trigger_us = \
+        struct.unpack_from(HEADER_FORMAT, blob)
+    if magic != SCOPE_MAGIC:
+        raise ValueError("Not a PowerMate scope capture")
+
+    entries = []
+    for i in range(count):
+        offset_us, *values = struct.unpack_from(ENTRY_FORMAT, blob, header_size + i * entry_size)
+        entries.append((offset_us, values[:3], values[3:]))
+    return {"trigger_index": trigger_index, "trigger_uptime_us": trigger_us}, entries
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Arm a PowerMate transient capture and save it as CSV.")
+    parser.add_argument("host", help="Hostname or IP address of the PowerMate device")
+    parser.add_argument("-u", "--username", required=True, help="Login username")
+    parser.add_argument("-p", "--password", required=True, help="Login password")
+    parser.add_argument("-o", "--output", required=True, help="Path to the output CSV file.")
+    parser.add_argument("--source", choices=["current", "voltage", "switch"], default="switch",
+                        help="Trigger source (default: switch)")
+    parser.add_argument("--channel", choices=["vin", "main", "usb"], default="main", help="Trigger channel")
+    parser.add_argument("--edge", choices=["rising", "falling", "both"], default="rising", help="Trigger edge")
+    parser.add_argument("--level", type=int, default=0, help="Trigger level in mA (current) or mV (voltage)")
+    parser.add_argument("--pre", type=int, default=128, help="Samples kept before the trigger")
+    parser.add_argument("--post", type=int, default=384, help="Samples kept after the trigger")
+    args = parser.parse_args()
+
+    base_url = f"http://{args.host}"
+    headers = login(base_url, args.username, args.password)
+
+    arm = {"arm": True, "source": args.source, "channel": args.channel, "edge": args.edge,
+           "level": args.level, "pre": args.pre, "post": args.post}
+    requests.post(f"{base_url}/api/scope", json=arm, headers=headers, timeout=5).raise_for_status()
+    print("Armed, waiting for trigger... (Ctrl+C to cancel)")
+
+    try:
+        while requests.get(f"{base_url}/api/scope", headers=headers, timeout=5).json()["state"] != "done":
+            time.sleep(0.5)
+    except KeyboardInterrupt:
+        requests.post(f"{base_url}/api/scope", json={"arm": False}, headers=headers, timeout=5)
+        print("Capture cancelled.")
+        return
+
+    response = requests.get(f"{base_url}/api/scope/data", headers=headers, timeout=10)
+    response.raise_for_status()
+    info, entries = parse_capture(response.content)
+
+    with open(args.output, 'w', newline='', encoding='utf-8') as f:
+        writer = csv.writer(f)
+        writer.writerow(['offset_us', 'usb_voltage', 'main_voltage', 'vin_voltage',
+                         'usb_current', 'main_current', 'vin_current'])
+        for offset_us, voltages, currents in entries:
+            writer.writerow([offset_us] + [f"{v / 1000:.3f}" for v in voltages] + [f"{c / 1000:.3f}" for c in currents])
+
+    print(f"Saved {len(entries)} samples ({info['trigger_index']} before the trigger) to '{args.output}'.")
+
+
+if __name__ == "__main__":
+    main()
@@ -45,6 +45,31 @@ enum nconfig_type
     PAGE_USERNAME, ///< Webpage username
     PAGE_PASSWORD, ///< Webpage password
     SENSOR_PERIOD_MS, ///< Sensor period
+    SENSOR_ADAPTIVE, ///< Adaptive sensor publish rate enabled ("1") or not ("0")
+    SENSOR_ADAPTIVE_THRESHOLD, ///< Per-channel current change (mA) that switches adaptive mode to the fast rate
+    VIN_WARNING_LIMIT, ///< The warning current level for the VIN.
+    MAIN_WARNING_LIMIT, ///< The warning current level for the MAIN out.
+    USB_WARNING_LIMIT, ///< The warning current level for the USB out.
+    VIN_CALIBRATION, ///< VIN current calibration, "<gain ppm>,<offset uA>"
+    MAIN_CALIBRATION, ///< MAIN current calibration, "<gain ppm>,<offset uA>"
+    USB_CALIBRATION, ///< USB current calibration, "<gain ppm>,<offset uA>"
+    SENSOR_AVERAGING, ///< INA3221 samples averaged per conversion (1 ~ 1024)
+    SENSOR_BUS_CT, ///< INA3221 bus voltage conversion time in us (140 ~ 8244)
+    SENSOR_SHUNT_CT, ///< INA3221 shunt voltage conversion time in us (140 ~ 8244)
+    VIN_ENERGY, ///< VIN charge/energy checkpoint, "<uC>,<uJ>"
+    MAIN_ENERGY, ///< MAIN charge/energy checkpoint, "<uC>,<uJ>"
+    USB_ENERGY, ///< USB charge/energy checkpoint, "<uC>,<uJ>"
+    ENERGY_SINCE, ///< Wall clock time (ms) of the last energy counter reset
+    VIN_TRIP_LIMIT, ///< Software fast-trip current for the VIN, 0 disables it.
+    MAIN_TRIP_LIMIT, ///< Software fast-trip current for the MAIN out, 0 disables it.
+    USB_TRIP_LIMIT, ///< Software fast-trip current for the USB out, 0 disables it.
+    TRIP_SAMPLES, ///< Consecutive conversions above a fast-trip limit that open the load switch
+    WATCHDOG_CONFIG, ///< SBC watchdog, "<enabled>,<silence s>,<flat s>,<flat band mA>,<grace s>,<backoff s>,<backoff max s>"
+    WATCHDOG_PATTERN, ///< Console output that makes the SBC watchdog power cycle, empty disables it
+    SEQUENCE_1, ///< User power sequence slot 1, JSON as accepted by /api/sequence
+    SEQUENCE_2, ///< User power sequence slot 2
+    SEQUENCE_3, ///< User power sequence slot 3
+    SEQUENCE_4, ///< User power sequence slot 4
     NCONFIG_TYPE_MAX,   ///< Sentinel for the maximum number of configuration types.
 };
 
@@ -31,6 +31,31 @@ const static char* keys[NCONFIG_TYPE_MAX] = {
     [PAGE_USERNAME] = "username",
     [PAGE_PASSWORD] = "password",
     [SENSOR_PERIOD_MS] = "sensor_period",
+    [SENSOR_ADAPTIVE] = "sensor_adapt",
+    [SENSOR_ADAPTIVE_THRESHOLD] = "adapt_thresh",
+    [VIN_WARNING_LIMIT] = "vin_wlimit",
+    [MAIN_WARNING_LIMIT] = "main_wlimit",
+    [USB_WARNING_LIMIT] = "usb_wlimit",
+    [VIN_CALIBRATION] = "vin_cal",
+    [MAIN_CALIBRATION] = "main_cal",
+    [USB_CALIBRATION] = "usb_cal",
+    [SENSOR_AVERAGING] = "sensor_avg",
+    [SENSOR_BUS_CT] = "sensor_bus_ct",
+    [SENSOR_SHUNT_CT] = "sensor_sht_ct",
+    [VIN_ENERGY] = "vin_energy",
+    [MAIN_ENERGY] = "main_energy",
+    [USB_ENERGY] = "usb_energy",
+    [ENERGY_SINCE] = "energy_since",
+    [VIN_TRIP_LIMIT] = "vin_tlimit",
+    [MAIN_TRIP_LIMIT] = "main_tlimit",
+    [USB_TRIP_LIMIT] = "usb_tlimit",
+    [TRIP_SAMPLES] = "trip_samples",
+    [WATCHDOG_CONFIG] = "wdog_config",
+    [WATCHDOG_PATTERN] = "wdog_pattern",
+    [SEQUENCE_1] = "sequence_1",
+    [SEQUENCE_2] = "sequence_2",
+    [SEQUENCE_3] = "sequence_3",
+    [SEQUENCE_4] = "sequence_4",
 };
 
 struct default_value
@@ -56,6 +81,22 @@ struct default_value const default_values[] = {
     {PAGE_USERNAME, "admin"},
     {PAGE_PASSWORD, "password"},
     {SENSOR_PERIOD_MS, "1000"},
+    {SENSOR_ADAPTIVE, "0"},
+    {SENSOR_ADAPTIVE_THRESHOLD, "50"},
+    {VIN_WARNING_LIMIT, "0.0"},
+    {MAIN_WARNING_LIMIT, "0.0"},
+    {USB_WARNING_LIMIT, "0.0"},
+    {VIN_CALIBRATION, "1000000,0"},
+    {MAIN_CALIBRATION, "1000000,0"},
+    {USB_CALIBRATION, "1000000,0"},
+    {SENSOR_AVERAGING, "16"},
+    {SENSOR_BUS_CT, "140"},
+    {SENSOR_SHUNT_CT, "1100"},
+    {VIN_TRIP_LIMIT, "0.0"},
+    {MAIN_TRIP_LIMIT, "0.0"},
+    {USB_TRIP_LIMIT, "0.0"},
+    {TRIP_SAMPLES, "3"},
+    {WATCHDOG_CONFIG, "0,300,0,10,120,60,3600"},
 };
 
 esp_err_t init_nconfig()
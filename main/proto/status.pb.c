@@ -9,6 +9,9 @@
 PB_BIND(SensorChannelData, SensorChannelData, AUTO)
 
 
+PB_BIND(SensorChannelFixed, SensorChannelFixed, AUTO)
+
+
 PB_BIND(SensorData, SensorData, AUTO)
 
 
@@ -24,6 +27,27 @@ PB_BIND(UartData, UartData, AUTO)
 PB_BIND(LoadSwStatus, LoadSwStatus, AUTO)
 
 
+PB_BIND(SensorHistory, SensorHistory, AUTO)
+
+
+PB_BIND(StatsSummary, StatsSummary, AUTO)
+
+
+PB_BIND(ChannelStats, ChannelStats, AUTO)
+
+
+PB_BIND(StatsWindow, StatsWindow, AUTO)
+
+
+PB_BIND(SensorStats, SensorStats, AUTO)
+
+
+PB_BIND(SensorChannelBatch, SensorChannelBatch, AUTO)
+
+
+PB_BIND(SensorBatch, SensorBatch, AUTO)
+
+
 PB_BIND(StatusMessage, StatusMessage, AUTO)
 
 
@@ -10,14 +10,41 @@
 #endif
 
 /* Struct definitions */
-/* Represents data for a single sensor channel */
+/* Represents data for a single sensor channel.
+ voltage/current/power are the mean over the publish window, the remaining fields
+ describe the spread of the individual conversions inside that window. */
 typedef struct _SensorChannelData {
     float voltage;
     float current;
     float power;
+    float voltage_min;
+    float voltage_max;
+    float current_min;
+    float current_max;
+    float current_rms;
+    float power_max;
 } SensorChannelData;
 
-/* Contains data for all sensor channels and system info */
+/* Fixed-point variant of SensorChannelData, in micro-volts/amps/watts.
+ The firmware aggregates in integers and only fills these; consumers convert to floats.
+ charge/energy are integrated over every conversion since the last reset of the device's counters. */
+typedef struct _SensorChannelFixed {
+    int32_t voltage_uv;
+    int32_t current_ua;
+    int32_t power_uw;
+    int32_t voltage_min_uv;
+    int32_t voltage_max_uv;
+    int32_t current_min_ua;
+    int32_t current_max_ua;
+    int32_t current_rms_ua;
+    int32_t power_max_uw;
+    int64_t charge_uah;
+    int64_t energy_uwh;
+} SensorChannelFixed;
+
+/* Contains data for all sensor channels and system info.
+ usb/main/vin repeat the *_fixed channels as floats in SI units for older consumers, only in firmware
+ built with CONFIG_SENSOR_LEGACY_FLOAT_CHANNELS; read the *_fixed channels, which also carry charge and energy. */
 typedef struct _SensorData {
     bool has_usb;
     SensorChannelData usb;
@@ -27,6 +54,17 @@ typedef struct _SensorData {
     SensorChannelData vin;
     uint64_t timestamp_ms;
     uint64_t uptime_ms;
+    uint32_t sample_count; /* conversions aggregated into this message */
+    bool has_usb_fixed;
+    SensorChannelFixed usb_fixed;
+    bool has_main_fixed;
+    SensorChannelFixed main_fixed;
+    bool has_vin_fixed;
+    SensorChannelFixed vin_fixed;
+    uint32_t sequence; /* conversion number of the last sample, skips conversions never read */
+    uint64_t acquired_us; /* uptime of the last conversion, taken when it was read */
+    uint32_t dropped_frames; /* status frames the device dropped or replaced by a newer one since boot */
+    uint32_t dropped_samples; /* conversions skipped, overrun or failed to read since boot */
 } SensorData;
 
 /* Contains WiFi connection status */
@@ -55,6 +93,80 @@ typedef struct _LoadSwStatus {
     bool usb;
 } LoadSwStatus;
 
+/* Recent samples kept on the device, returned by GET /api/history */
+typedef struct _SensorHistory {
+    pb_callback_t samples;
+} SensorHistory;
+
+/* One quantity of a channel over a statistics window, in micro-amps or micro-watts.
+ Percentiles are read from a log-spaced histogram and are accurate to about 6%. */
+typedef struct _StatsSummary {
+    int32_t min;
+    int32_t max;
+    int32_t mean;
+    int32_t ewma; /* exponentially weighted mean at the end of the window */
+    int32_t p50;
+    int32_t p95;
+    int32_t p99;
+} StatsSummary;
+
+typedef struct _ChannelStats {
+    bool has_current;
+    StatsSummary current;
+    bool has_power;
+    StatsSummary power;
+    /* Conversion counts of the window, in mA (current) and mW (power).
+ Bin i < 8 holds value i; above that each power of two is split into 8 bins and
+ bin i starts at (8 + i % 8) << (i / 8 - 1). Negative values count in bin 0. */
+    pb_callback_t current_histogram;
+    pb_callback_t power_histogram;
+} ChannelStats;
+
+typedef struct _StatsWindow {
+    uint32_t length_s;
+    bool complete; /* all buckets in use: covers 3/4 to all of length_s, rolling forward by 1/4 */
+    uint32_t elapsed_ms; /* time covered, from the start of the oldest bucket */
+    uint32_t sample_count; /* conversions folded in */
+    bool has_usb;
+    ChannelStats usb;
+    bool has_main;
+    ChannelStats main;
+    bool has_vin;
+    ChannelStats vin;
+} StatsWindow;
+
+/* Streaming per-channel statistics over rolling windows, returned by GET /api/stats */
+typedef struct _SensorStats {
+    uint64_t uptime_ms;
+    uint32_t ewma_tau_ms;
+    pb_callback_t windows;
+} SensorStats;
+
+/* One channel of a SensorBatch. The first conversion is given in full, every following one as the
+ difference to its predecessor, so a steady rail costs one byte per value. */
+typedef struct _SensorChannelBatch {
+    int32_t voltage_mv;
+    int32_t current_ma;
+    pb_callback_t voltage_delta_mv; /* count - 1 entries */
+    pb_callback_t current_delta_ma;
+} SensorChannelBatch;
+
+/* Consecutive conversions, streamed while high-rate capture mode is on. The conversions of a batch
+ have the sequence numbers base_sequence .. base_sequence + count - 1, a gap starts a new batch. */
+typedef struct _SensorBatch {
+    uint64_t base_us; /* uptime of the first conversion, taken when it was read */
+    uint64_t timestamp_ms; /* wall clock time of the first conversion */
+    uint32_t base_sequence;
+    uint32_t count;
+    pb_callback_t time_delta_us; /* count - 1 entries, acquisition time minus that of the previous conversion */
+    bool has_usb;
+    SensorChannelBatch usb;
+    bool has_main;
+    SensorChannelBatch main;
+    bool has_vin;
+    SensorChannelBatch vin;
+} SensorBatch;
+
 /* Top-level message for all websocket communication */
 typedef struct _StatusMessage {
     pb_size_t which_payload;
@@ -64,6 +176,7 @@ typedef struct _StatusMessage {
         LoadSwStatus sw_status;
         UartData uart_data;
         EventData event_data;
+        SensorBatch sensor_batch;
     } payload;
 } StatusMessage;
 
@@ -73,30 +186,71 @@ extern "C" {
 #endif
 
 /* Initializer values for message structs */
-#define SensorChannelData_init_default           {0, 0, 0}
-#define SensorData_init_default                  {false, SensorChannelData_init_default, false, SensorChannelData_init_default, false, SensorChannelData_init_default, 0, 0}
+#define SensorChannelData_init_default           {0, 0, 0, 0, 0, 0, 0, 0, 0}
+#define SensorChannelFixed_init_default          {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+#define SensorData_init_default                  {false, SensorChannelData_init_default, false, SensorChannelData_init_default, false, SensorChannelData_init_default, 0, 0, 0, false, SensorChannelFixed_init_default, false, SensorChannelFixed_init_default, false, SensorChannelFixed_init_default, 0, 0, 0, 0}
 #define WifiStatus_init_default                  {0, {{NULL}, NULL}, 0, {{NULL}, NULL}}
 #define EventData_init_default                   {0, 0, 0, {{NULL}, NULL}}
 #define UartData_init_default                    {{{NULL}, NULL}}
 #define LoadSwStatus_init_default                {0, 0}
+#define SensorHistory_init_default               {{{NULL}, NULL}}
+#define StatsSummary_init_default                {0, 0, 0, 0, 0, 0, 0}
+#define ChannelStats_init_default                {false, StatsSummary_init_default, false, StatsSummary_init_default, {{NULL}, NULL}, {{NULL}, NULL}}
+#define StatsWindow_init_default                 {0, 0, 0, 0, false, ChannelStats_init_default, false, ChannelStats_init_default, false, ChannelStats_init_default}
+#define SensorStats_init_default                 {0, 0, {{NULL}, NULL}}
+#define SensorChannelBatch_init_default          {0, 0, {{NULL}, NULL}, {{NULL}, NULL}}
+#define SensorBatch_init_default                 {0, 0, 0, 0, {{NULL}, NULL}, false, SensorChannelBatch_init_default, false, SensorChannelBatch_init_default, false, SensorChannelBatch_init_default}
 #define StatusMessage_init_default               {0, {SensorData_init_default}}
-#define SensorChannelData_init_zero              {0, 0, 0}
-#define SensorData_init_zero                     {false, SensorChannelData_init_zero, false, SensorChannelData_init_zero, false, SensorChannelData_init_zero, 0, 0}
+#define SensorChannelData_init_zero              {0, 0, 0, 0, 0, 0, 0, 0, 0}
+#define SensorChannelFixed_init_zero             {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+#define SensorData_init_zero                     {false, SensorChannelData_init_zero, false, SensorChannelData_init_zero, false, SensorChannelData_init_zero, 0, 0, 0, false, SensorChannelFixed_init_zero, false, SensorChannelFixed_init_zero, false, SensorChannelFixed_init_zero, 0, 0, 0, 0}
 #define WifiStatus_init_zero                     {0, {{NULL}, NULL}, 0, {{NULL}, NULL}}
 #define EventData_init_zero                      {0, 0, 0, {{NULL}, NULL}}
 #define UartData_init_zero                       {{{NULL}, NULL}}
 #define LoadSwStatus_init_zero                   {0, 0}
+#define SensorHistory_init_zero                  {{{NULL}, NULL}}
+#define StatsSummary_init_zero                   {0, 0, 0, 0, 0, 0, 0}
+#define ChannelStats_init_zero                   {false, StatsSummary_init_zero, false, StatsSummary_init_zero, {{NULL}, NULL}, {{NULL}, NULL}}
+#define StatsWindow_init_zero                    {0, 0, 0, 0, false, ChannelStats_init_zero, false, ChannelStats_init_zero, false, ChannelStats_init_zero}
+#define SensorStats_init_zero                    {0, 0, {{NULL}, NULL}}
+#define SensorChannelBatch_init_zero             {0, 0, {{NULL}, NULL}, {{NULL}, NULL}}
+#define SensorBatch_init_zero                    {0, 0, 0, 0, {{NULL}, NULL}, false, SensorChannelBatch_init_zero, false, SensorChannelBatch_init_zero, false, SensorChannelBatch_init_zero}
 #define StatusMessage_init_zero                  {0, {SensorData_init_zero}}
 
 /* Field tags (for use in manual encoding/decoding) */
 #define SensorChannelData_voltage_tag            1
 #define SensorChannelData_current_tag            2
 #define SensorChannelData_power_tag              3
+#define SensorChannelData_voltage_min_tag        4
+#define SensorChannelData_voltage_max_tag        5
+#define SensorChannelData_current_min_tag        6
+#define SensorChannelData_current_max_tag        7
+#define SensorChannelData_current_rms_tag        8
+#define SensorChannelData_power_max_tag          9
+#define SensorChannelFixed_voltage_uv_tag        1
+#define SensorChannelFixed_current_ua_tag        2
+#define SensorChannelFixed_power_uw_tag          3
+#define SensorChannelFixed_voltage_min_uv_tag    4
+#define SensorChannelFixed_voltage_max_uv_tag    5
+#define SensorChannelFixed_current_min_ua_tag    6
+#define SensorChannelFixed_current_max_ua_tag    7
+#define SensorChannelFixed_current_rms_ua_tag    8
+#define SensorChannelFixed_power_max_uw_tag      9
+#define SensorChannelFixed_charge_uah_tag        10
+#define SensorChannelFixed_energy_uwh_tag        11
 #define SensorData_usb_tag                       1
 #define SensorData_main_tag                      2
 #define SensorData_vin_tag                       3
 #define SensorData_timestamp_ms_tag              4
 #define SensorData_uptime_ms_tag                 5
+#define SensorData_sample_count_tag              6
+#define SensorData_usb_fixed_tag                 7
+#define SensorData_main_fixed_tag                8
+#define SensorData_vin_fixed_tag                 9
+#define SensorData_sequence_tag                  10
+#define SensorData_acquired_us_tag               11
+#define SensorData_dropped_frames_tag            12
+#define SensorData_dropped_samples_tag           13
 #define WifiStatus_connected_tag                 1
 #define WifiStatus_ssid_tag                      2
 #define WifiStatus_rssi_tag                      3
@@ -108,31 +262,98 @@ extern "C" {
 #define UartData_data_tag                        1
 #define LoadSwStatus_main_tag                    1
 #define LoadSwStatus_usb_tag                     2
+#define SensorHistory_samples_tag                1
+#define StatsSummary_min_tag                     1
+#define StatsSummary_max_tag                     2
+#define StatsSummary_mean_tag                    3
+#define StatsSummary_ewma_tag                    4
+#define StatsSummary_p50_tag                     5
+#define StatsSummary_p95_tag                     6
+#define StatsSummary_p99_tag                     7
+#define ChannelStats_current_tag                 1
+#define ChannelStats_power_tag                   2
+#define ChannelStats_current_histogram_tag       3
+#define ChannelStats_power_histogram_tag         4
+#define StatsWindow_length_s_tag                 1
+#define StatsWindow_complete_tag                 2
+#define StatsWindow_elapsed_ms_tag               3
+#define StatsWindow_sample_count_tag             4
+#define StatsWindow_usb_tag                      5
+#define StatsWindow_main_tag                     6
+#define StatsWindow_vin_tag                      7
+#define SensorStats_uptime_ms_tag                1
+#define SensorStats_ewma_tau_ms_tag              2
+#define SensorStats_windows_tag                  3
+#define SensorChannelBatch_voltage_mv_tag        1
+#define SensorChannelBatch_current_ma_tag        2
+#define SensorChannelBatch_voltage_delta_mv_tag  3
+#define SensorChannelBatch_current_delta_ma_tag  4
+#define SensorBatch_base_us_tag                  1
+#define SensorBatch_timestamp_ms_tag             2
+#define SensorBatch_base_sequence_tag            3
+#define SensorBatch_count_tag                    4
+#define SensorBatch_time_delta_us_tag            5
+#define SensorBatch_usb_tag                      6
+#define SensorBatch_main_tag                     7
+#define SensorBatch_vin_tag                      8
 #define StatusMessage_sensor_data_tag            1
 #define StatusMessage_wifi_status_tag            2
 #define StatusMessage_sw_status_tag              3
 #define StatusMessage_uart_data_tag              4
 #define StatusMessage_event_data_tag             5
+#define StatusMessage_sensor_batch_tag           6
 
 /* Struct field encoding specification for nanopb */
 #define SensorChannelData_FIELDLIST(X, a) \
 X(a, STATIC,   SINGULAR, FLOAT,    voltage,           1) \
 X(a, STATIC,   SINGULAR, FLOAT,    current,           2) \
-X(a, STATIC,   SINGULAR, FLOAT,    power,             3)
+X(a, STATIC,   SINGULAR, FLOAT,    power,             3) \
+X(a, STATIC,   SINGULAR, FLOAT,    voltage_min,       4) \
+X(a, STATIC,   SINGULAR, FLOAT,    voltage_max,       5) \
+X(a, STATIC,   SINGULAR, FLOAT,    current_min,       6) \
+X(a, STATIC,   SINGULAR, FLOAT,    current_max,       7) \
+X(a, STATIC,   SINGULAR, FLOAT,    current_rms,       8) \
+X(a, STATIC,   SINGULAR, FLOAT,    power_max,         9)
 #define SensorChannelData_CALLBACK NULL
 #define SensorChannelData_DEFAULT NULL
 
+#define SensorChannelFixed_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, SINT32,   voltage_uv,        1) \
+X(a, STATIC,   SINGULAR, SINT32,   current_ua,        2) \
+X(a, STATIC,   SINGULAR, SINT32,   power_uw,          3) \
+X(a, STATIC,   SINGULAR, SINT32,   voltage_min_uv,    4) \
+X(a, STATIC,   SINGULAR, SINT32,   voltage_max_uv,    5) \
+X(a, STATIC,   SINGULAR, SINT32,   current_min_ua,    6) \
+X(a, STATIC,   SINGULAR, SINT32,   current_max_ua,    7) \
+X(a, STATIC,   SINGULAR, SINT32,   current_rms_ua,    8) \
+X(a, STATIC,   SINGULAR, SINT32,   power_max_uw,      9) \
+X(a, STATIC,   SINGULAR, SINT64,   charge_uah,       10) \
+X(a, STATIC,   SINGULAR, SINT64,   energy_uwh,       11)
+#define SensorChannelFixed_CALLBACK NULL
+#define SensorChannelFixed_DEFAULT NULL
+
 #define SensorData_FIELDLIST(X, a) \
 X(a, STATIC,   OPTIONAL, MESSAGE,  usb,               1) \
 X(a, STATIC,   OPTIONAL, MESSAGE,  main,              2) \
 X(a, STATIC,   OPTIONAL, MESSAGE,  vin,               3) \
 X(a, STATIC,   SINGULAR, UINT64,   timestamp_ms,      4) \
-X(a, STATIC,   SINGULAR, UINT64,   uptime_ms,         5)
+X(a, STATIC,   SINGULAR, UINT64,   uptime_ms,         5) \
+X(a, STATIC,   SINGULAR, UINT32,   sample_count,      6) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  usb_fixed,         7) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  main_fixed,        8) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  vin_fixed,         9) \
+X(a, STATIC,   SINGULAR, UINT32,   sequence,         10) \
+X(a, STATIC,   SINGULAR, UINT64,   acquired_us,      11) \
+X(a, STATIC,   SINGULAR, UINT32,   dropped_frames,   12) \
+X(a, STATIC,   SINGULAR, UINT32,   dropped_samples,  13)
 #define SensorData_CALLBACK NULL
 #define SensorData_DEFAULT NULL
 #define SensorData_usb_MSGTYPE SensorChannelData
 #define SensorData_main_MSGTYPE SensorChannelData
 #define SensorData_vin_MSGTYPE SensorChannelData
+#define SensorData_usb_fixed_MSGTYPE SensorChannelFixed
+#define SensorData_main_fixed_MSGTYPE SensorChannelFixed
+#define SensorData_vin_fixed_MSGTYPE SensorChannelFixed
 
 #define WifiStatus_FIELDLIST(X, a) \
 X(a, STATIC,   SINGULAR, BOOL,     connected,         1) \
@@ -161,12 +382,85 @@ X(a, STATIC,   SINGULAR, BOOL,     usb,               2)
 #define LoadSwStatus_CALLBACK NULL
 #define LoadSwStatus_DEFAULT NULL
 
+#define SensorHistory_FIELDLIST(X, a) \
+X(a, CALLBACK, REPEATED, MESSAGE,  samples,           1)
+#define SensorHistory_CALLBACK pb_default_field_callback
+#define SensorHistory_DEFAULT NULL
+#define SensorHistory_samples_MSGTYPE SensorData
+
+#define StatsSummary_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, SINT32,   min,               1) \
+X(a, STATIC,   SINGULAR, SINT32,   max,               2) \
+X(a, STATIC,   SINGULAR, SINT32,   mean,              3) \
+X(a, STATIC,   SINGULAR, SINT32,   ewma,              4) \
+X(a, STATIC,   SINGULAR, SINT32,   p50,               5) \
+X(a, STATIC,   SINGULAR, SINT32,   p95,               6) \
+X(a, STATIC,   SINGULAR, SINT32,   p99,               7)
+#define StatsSummary_CALLBACK NULL
+#define StatsSummary_DEFAULT NULL
+
+#define ChannelStats_FIELDLIST(X, a) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  current,           1) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  power,             2) \
+X(a, CALLBACK, REPEATED, UINT32,   current_histogram,   3) \
+X(a, CALLBACK, REPEATED, UINT32,   power_histogram,   4)
+#define ChannelStats_CALLBACK pb_default_field_callback
+#define ChannelStats_DEFAULT NULL
+#define ChannelStats_current_MSGTYPE StatsSummary
+#define ChannelStats_power_MSGTYPE StatsSummary
+
+#define StatsWindow_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, UINT32,   length_s,          1) \
+X(a, STATIC,   SINGULAR, BOOL,     complete,          2) \
+X(a, STATIC,   SINGULAR, UINT32,   elapsed_ms,        3) \
+X(a, STATIC,   SINGULAR, UINT32,   sample_count,      4) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  usb,               5) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  main,              6) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  vin,               7)
+#define StatsWindow_CALLBACK NULL
+#define StatsWindow_DEFAULT NULL
+#define StatsWindow_usb_MSGTYPE ChannelStats
+#define StatsWindow_main_MSGTYPE ChannelStats
+#define StatsWindow_vin_MSGTYPE ChannelStats
+
+#define SensorStats_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, UINT64,   uptime_ms,         1) \
+X(a, STATIC,   SINGULAR, UINT32,   ewma_tau_ms,       2) \
+X(a, CALLBACK, REPEATED, MESSAGE,  windows,           3)
+#define SensorStats_CALLBACK pb_default_field_callback
+#define SensorStats_DEFAULT NULL
+#define SensorStats_windows_MSGTYPE StatsWindow
+
+#define SensorChannelBatch_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, SINT32,   voltage_mv,        1) \
+X(a, STATIC,   SINGULAR, SINT32,   current_ma,        2) \
+X(a, CALLBACK, REPEATED, SINT32,   voltage_delta_mv,   3) \
+X(a, CALLBACK, REPEATED, SINT32,   current_delta_ma,   4)
+#define SensorChannelBatch_CALLBACK pb_default_field_callback
+#define SensorChannelBatch_DEFAULT NULL
+
+#define SensorBatch_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, UINT64,   base_us,           1) \
+X(a, STATIC,   SINGULAR, UINT64,   timestamp_ms,      2) \
+X(a, STATIC,   SINGULAR, UINT32,   base_sequence,     3) \
+X(a, STATIC,   SINGULAR, UINT32,   count,             4) \
+X(a, CALLBACK, REPEATED, SINT32,   time_delta_us,     5) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  usb,               6) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  main,              7) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  vin,               8)
+#define SensorBatch_CALLBACK pb_default_field_callback
+#define SensorBatch_DEFAULT NULL
+#define SensorBatch_usb_MSGTYPE SensorChannelBatch
+#define SensorBatch_main_MSGTYPE SensorChannelBatch
+#define SensorBatch_vin_MSGTYPE SensorChannelBatch
+
 #define StatusMessage_FIELDLIST(X, a) \
 X(a, STATIC,   ONEOF,    MESSAGE,  (payload,sensor_data,payload.sensor_data),   1) \
 X(a, STATIC,   ONEOF,    MESSAGE,  (payload,wifi_status,payload.wifi_status),   2) \
 X(a, STATIC,   ONEOF,    MESSAGE,  (payload,sw_status,payload.sw_status),   3) \
 X(a, STATIC,   ONEOF,    MESSAGE,  (payload,uart_data,payload.uart_data),   4) \
-X(a, STATIC,   ONEOF,    MESSAGE,  (payload,event_data,payload.event_data),   5)
+X(a, STATIC,   ONEOF,    MESSAGE,  (payload,event_data,payload.event_data),   5) \
+X(a, STATIC,   ONEOF,    MESSAGE,  (payload,sensor_batch,payload.sensor_batch),   6)
 #define StatusMessage_CALLBACK NULL
 #define StatusMessage_DEFAULT NULL
 #define StatusMessage_payload_sensor_data_MSGTYPE SensorData
@@ -174,33 +468,58 @@ X(a, STATIC,   ONEOF,    MESSAGE,  (payload,event_data,payload.event_data),   5)
 #define StatusMessage_payload_sw_status_MSGTYPE LoadSwStatus
 #define StatusMessage_payload_uart_data_MSGTYPE UartData
 #define StatusMessage_payload_event_data_MSGTYPE EventData
+#define StatusMessage_payload_sensor_batch_MSGTYPE SensorBatch
 
 extern const pb_msgdesc_t SensorChannelData_msg;
+extern const pb_msgdesc_t SensorChannelFixed_msg;
 extern const pb_msgdesc_t SensorData_msg;
 extern const pb_msgdesc_t WifiStatus_msg;
 extern const pb_msgdesc_t EventData_msg;
 extern const pb_msgdesc_t UartData_msg;
 extern const pb_msgdesc_t LoadSwStatus_msg;
+extern const pb_msgdesc_t SensorHistory_msg;
+extern const pb_msgdesc_t StatsSummary_msg;
+extern const pb_msgdesc_t ChannelStats_msg;
+extern const pb_msgdesc_t StatsWindow_msg;
+extern const pb_msgdesc_t SensorStats_msg;
+extern const pb_msgdesc_t SensorChannelBatch_msg;
+extern const pb_msgdesc_t SensorBatch_msg;
 extern const pb_msgdesc_t StatusMessage_msg;
 
 /* Defines for backwards compatibility with code written before nanopb-0.4.0 */
 #define SensorChannelData_fields &SensorChannelData_msg
+#define SensorChannelFixed_fields &SensorChannelFixed_msg
 #define SensorData_fields &SensorData_msg
 #define WifiStatus_fields &WifiStatus_msg
 #define EventData_fields &EventData_msg
 #define UartData_fields &UartData_msg
 #define LoadSwStatus_fields &LoadSwStatus_msg
+#define SensorHistory_fields &SensorHistory_msg
+#define StatsSummary_fields &StatsSummary_msg
+#define ChannelStats_fields &ChannelStats_msg
+#define StatsWindow_fields &StatsWindow_msg
+#define SensorStats_fields &SensorStats_msg
+#define SensorChannelBatch_fields &SensorChannelBatch_msg
+#define SensorBatch_fields &SensorBatch_msg
 #define StatusMessage_fields &StatusMessage_msg
 
 /* Maximum encoded size of messages (where known) */
 /* WifiStatus_size depends on runtime parameters */
 /* EventData_size depends on runtime parameters */
 /* UartData_size depends on runtime parameters */
+/* SensorHistory_size depends on runtime parameters */
+/* ChannelStats_size depends on runtime parameters */
+/* StatsWindow_size depends on runtime parameters */
+/* SensorStats_size depends on runtime parameters */
+/* SensorChannelBatch_size depends on runtime parameters */
+/* SensorBatch_size depends on runtime parameters */
 /* StatusMessage_size depends on runtime parameters */
 #define LoadSwStatus_size                        4
 #define STATUS_PB_H_MAX_SIZE                     SensorData_size
-#define SensorChannelData_size                   15
-#define SensorData_size                          73
+#define SensorChannelData_size                   45
+#define SensorChannelFixed_size                  76
+#define SensorData_size                          432
+#define StatsSummary_size                        42
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -8,14 +8,33 @@
 #include "esp_err.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #define VIN_CURRENT_LIMIT_MAX 8.0f
 #define MAIN_CURRENT_LIMIT_MAX 7.5f
 #define USB_CURRENT_LIMIT_MAX 4.5f
 
-esp_err_t climit_set_vin(double value);
-esp_err_t climit_set_main(double value);
-esp_err_t climit_set_usb(double value);
+#define CLIMIT_DISABLED_MA 15000 // programmed when a channel has no limit (0)
+#define WLIMIT_DISABLED_MA 16380 // full scale of the shunt register with 10mOhm shunts
+
+esp_err_t climit_set_vin(uint32_t milliamps);
+esp_err_t climit_set_main(uint32_t milliamps);
+esp_err_t climit_set_usb(uint32_t milliamps);
+
+// Warning limits raise an EV_WARNING event instead of tripping the load switches
+esp_err_t climit_set_vin_warning(uint32_t milliamps);
+esp_err_t climit_set_main_warning(uint32_t milliamps);
+esp_err_t climit_set_usb_warning(uint32_t milliamps);
+
+#define TRIP_SAMPLES_MAX 16
+
+// Fast-trip limits are checked in software on every conversion and open the channel's load switch (both for
+// VIN) once `samples` conversions in a row are above them, 0 disables a channel
+esp_err_t climit_set_vin_trip(uint32_t milliamps);
+esp_err_t climit_set_main_trip(uint32_t milliamps);
+esp_err_t climit_set_usb_trip(uint32_t milliamps);
+esp_err_t climit_set_trip_samples(uint8_t samples);
+uint8_t climit_get_trip_samples();
 bool is_overcurrent();
 
 #endif // ODROID_POWER_MATE_CLIMIT_H
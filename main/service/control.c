@@ -65,13 +65,16 @@ static esp_err_t control_post_handler(httpd_req_t* req)
         return ESP_FAIL;
     }
 
+    // both switches in one request change together
+    uint8_t which = 0;
     cJSON* item_12v = cJSON_GetObjectItem(root, "load_12v_on");
     if (cJSON_IsBool(item_12v))
-        set_main_load_switch(cJSON_IsTrue(item_12v));
-
+        which |= LOAD_SW_MAIN;
     cJSON* item_5v = cJSON_GetObjectItem(root, "load_5v_on");
     if (cJSON_IsBool(item_5v))
-        set_usb_load_switch(cJSON_IsTrue(item_5v));
+        which |= LOAD_SW_USB;
+    if (which)
+        set_load_switches(which, cJSON_IsTrue(item_12v), cJSON_IsTrue(item_5v));
 
     cJSON* power_trigger = cJSON_GetObjectItem(root, "power_trigger");
     if (cJSON_IsTrue(power_trigger))
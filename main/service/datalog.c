@@ -0,0 +1,200 @@
+#include "datalog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "auth.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "pb_encode.h"
+#include "pbmsg.h"
+#include "status.pb.h"
+#include "webserver.h"
+
+#define HISTORY_CHUNK_SIZE 1024
+
+static const char* TAG = "datalog";
+
+// One history entry, kept in integer units so the whole ring stays small
+struct datalog_entry
+{
+    uint64_t uptime_ms; // a 32-bit uptime would wrap after 49.7 days
+    uint16_t voltage_mv[INA3221_BUS_NUMBER];
+    int16_t current_ma[INA3221_BUS_NUMBER];
+};
+
+static struct datalog_entry history[SENSOR_BUFFER_SIZE];
+static uint32_t history_head; // total number of entries ever added
+static portMUX_TYPE history_lock = portMUX_INITIALIZER_UNLOCKED;
+
+struct chunk_writer
+{
+    httpd_req_t* req;
+    size_t len;
+    uint8_t buf[HISTORY_CHUNK_SIZE];
+};
+
+void datalog_add(uint64_t uptime_ms, const sensor_data_t channels[INA3221_BUS_NUMBER])
+{
+    struct datalog_entry entry = {.uptime_ms = uptime_ms};
+
+    for (int i = 0; i < INA3221_BUS_NUMBER; i++)
+    {
+        int32_t current_ua = channels[i].current_ua;
+        entry.voltage_mv[i] = (uint16_t)((channels[i].voltage_uv + 500) / 1000);
+        entry.current_ma[i] = (int16_t)((current_ua + (current_ua < 0 ? -500 : 500)) / 1000);
+    }
+
+    portENTER_CRITICAL(&history_lock);
+    history[history_head % SENSOR_BUFFER_SIZE] = entry;
+    history_head++;
+    portEXIT_CRITICAL(&history_lock);
+}
+
+// Copies entry `seq` out of the ring, fails if it has been overwritten in the meantime
+static bool datalog_get(uint32_t seq, struct datalog_entry* out)
+{
+    bool ok = false;
+
+    portENTER_CRITICAL(&history_lock);
+    if (seq < history_head && history_head - seq <= SENSOR_BUFFER_SIZE)
+    {
+        *out = history[seq % SENSOR_BUFFER_SIZE];
+        ok = true;
+    }
+    portEXIT_CRITICAL(&history_lock);
+
+    return ok;
+}
+
+static bool chunk_flush(struct chunk_writer* w)
+{
+    if (w->len == 0)
+        return true;
+    esp_err_t err = httpd_resp_send_chunk(w->req, (const char*)w->buf, w->len);
+    w->len = 0;
+    return err == ESP_OK;
+}
+
+static bool chunk_write_callback(pb_ostream_t* stream, const pb_byte_t* buf, size_t count)
+{
+    struct chunk_writer* w = (struct chunk_writer*)stream->state;
+
+    while (count > 0)
+    {
+        size_t n = sizeof(w->buf) - w->len;
+        if (n > count)
+            n = count;
+        memcpy(w->buf + w->len, buf, n);
+        w->len += n;
+        buf += n;
+        count -= n;
+
+        if (w->len == sizeof(w->buf) && !chunk_flush(w))
+            return false;
+    }
+    return true;
+}
+
+static uint64_t query_u64(const char* query, const char* key, uint64_t def)
+{
+    char val[24];
+    if (query == NULL || httpd_query_key_value(query, key, val, sizeof(val)) != ESP_OK)
+        return def;
+    return strtoull(val, NULL, 10);
+}
+
+/*
+ * GET /api/history?from=<uptime_ms>&to=<uptime_ms>&count=<n>
+ * Streams a SensorHistory protobuf with the stored samples inside [from, to], limited to the newest `count`.
+ */
+static esp_err_t history_get_handler(httpd_req_t* req)
+{
+    esp_err_t err = api_auth_check(req);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    char query[96];
+    bool has_query = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK;
+    uint64_t from = query_u64(has_query ? query : NULL, "from", 0);
+    uint64_t to = query_u64(has_query ? query : NULL, "to", UINT64_MAX);
+    uint64_t count = query_u64(has_query ? query : NULL, "count", SENSOR_BUFFER_SIZE);
+
+    struct chunk_writer* w = malloc(sizeof(struct chunk_writer));
+    if (w == NULL)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    w->req = req;
+    w->len = 0;
+
+    // wall clock of each entry is derived from its uptime with the current offset
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    int64_t wall_offset_ms = ((int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000) - esp_timer_get_time() / 1000;
+
+    portENTER_CRITICAL(&history_lock);
+    uint32_t head = history_head;
+    portEXIT_CRITICAL(&history_lock);
+    uint32_t first = head > SENSOR_BUFFER_SIZE ? head - SENSOR_BUFFER_SIZE : 0;
+
+    // walk back from the newest entry to honour `count`
+    uint32_t start = head;
+    uint32_t matched = 0;
+    struct datalog_entry entry;
+    while (start > first && matched < count && datalog_get(start - 1, &entry) && entry.uptime_ms >= from)
+    {
+        start--;
+        if (entry.uptime_ms <= to)
+            matched++;
+    }
+
+    httpd_resp_set_type(req, "application/x-protobuf");
+    pb_ostream_t stream = {.callback = &chunk_write_callback, .state = w, .max_size = SIZE_MAX};
+    bool ok = true;
+
+    for (uint32_t seq = start; seq < head && ok; seq++)
+    {
+        if (!datalog_get(seq, &entry) || entry.uptime_ms > to)
+            continue;
+
+        SensorData sample = SensorData_init_zero;
+        SensorChannelFixed* channels[] = {&sample.usb_fixed, &sample.main_fixed, &sample.vin_fixed};
+        sample.has_usb_fixed = sample.has_main_fixed = sample.has_vin_fixed = true;
+        for (int i = 0; i < INA3221_BUS_NUMBER; i++)
+        {
+            channels[i]->voltage_uv = entry.voltage_mv[i] * 1000;
+            channels[i]->current_ua = entry.current_ma[i] * 1000;
+            channels[i]->power_uw = entry.voltage_mv[i] * entry.current_ma[i]; // mV * mA = uW
+        }
+        fill_legacy_channels(&sample);
+        sample.uptime_ms = entry.uptime_ms;
+        sample.timestamp_ms = (int64_t)entry.uptime_ms + wall_offset_ms;
+        sample.sample_count = 1;
+
+        ok = pb_encode_tag(&stream, PB_WT_STRING, SensorHistory_samples_tag) &&
+            pb_encode_submessage(&stream, SensorData_fields, &sample);
+    }
+
+    if (ok)
+        ok = chunk_flush(w);
+    free(w);
+
+    if (!ok)
+    {
+        ESP_LOGW(TAG, "history transfer aborted: %s", PB_GET_ERROR(&stream));
+        return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+void register_history_endpoint(httpd_handle_t server)
+{
+    httpd_uri_t get_uri = {.uri = "/api/history", .method = HTTP_GET, .handler = history_get_handler, .user_ctx = NULL};
+    httpd_register_uri_handler(server, &get_uri);
+}
@@ -0,0 +1,16 @@
+#ifndef ODROID_POWER_MATE_DATALOG_H
+#define ODROID_POWER_MATE_DATALOG_H
+
+#include <stdint.h>
+
+#include "monitor.h"
+
+/**
+ * @brief Appends one published sample to the in-RAM history ring, overwriting the oldest entry when full.
+ *
+ * @param uptime_ms Device uptime of the sample.
+ * @param channels Mean voltage/current of each channel in micro-units, in ina3221_channel_t order.
+ */
+void datalog_add(uint64_t uptime_ms, const sensor_data_t channels[INA3221_BUS_NUMBER]);
+
+#endif // ODROID_POWER_MATE_DATALOG_H
@@ -1,5 +1,6 @@
 #include "dbg_console.h"
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include "argtable3/argtable3.h"
@@ -10,6 +11,9 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
+#include "i2cbus.h"
+#include "monitor.h"
+#include "webserver.h"
 #include "wifi.h"
 
 
@@ -158,6 +162,365 @@ static void register_wifi_status(void)
     ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
 }
 
+/* 'sensor_stats' command */
+static int sensor_stats_handler(int argc, char** argv)
+{
+    struct monitor_timing t;
+    monitor_get_timing(&t);
+
+    printf("Sensor timer:\n");
+    printf("  Ticks: %" PRIu32 "\n", t.timer_ticks);
+    printf("  Dispatch latency avg/max: %" PRId64 " / %" PRId64 " us\n",
+           t.timer_ticks ? t.timer_latency_sum_us / t.timer_ticks : 0, t.timer_latency_max_us);
+    printf("  Callback busy max: %" PRId64 " us\n", t.timer_busy_max_us);
+    // not a measurement of the old path: it read the INA3221 inside the callback, so it held the esp_timer task
+    // for at least one read, estimated here by the longest read of the acquisition task
+    printf("  Old inline path busy max (estimate): %" PRId64 " us\n", t.acquisition_max_us);
+    printf("Acquisition:\n");
+    printf("  Conversions read: %" PRIu32 "\n", t.conversions);
+    printf("  Conversions skipped: %" PRIu32 "\n", t.skipped_conversions);
+    printf("  Not-ready polls: %" PRIu32 "\n", t.not_ready_polls);
+    printf("  Read errors: %" PRIu32 "\n", t.read_errors);
+    printf("  Read time max: %" PRId64 " us\n", t.acquisition_max_us);
+    printf("  Ring overruns: %" PRIu32 "\n", t.ring_overruns);
+    struct ws_lane_stats lanes[WS_LANE_COUNT];
+    ws_get_lane_stats(lanes);
+    printf("  WS control messages sent/dropped/superseded: %" PRIu32 " / %" PRIu32 " / %" PRIu32 "\n",
+           lanes[WS_LANE_CONTROL].sent, lanes[WS_LANE_CONTROL].dropped, lanes[WS_LANE_CONTROL].superseded);
+    printf("  WS bulk messages sent/dropped: %" PRIu32 " / %" PRIu32 "\n", lanes[WS_LANE_BULK].sent,
+           lanes[WS_LANE_BULK].dropped);
+    printf("  WS frames sent: %" PRIu32 "\n", ws_get_sent_frames());
+    struct ws_pool_stats pool;
+    ws_pool_get_stats(&pool);
+    for (int c = 0; c < WS_POOL_CLASSES; c++)
+    {
+        const struct ws_pool_class_stats* cls = &pool.classes[c];
+        printf("  WS pool %zu B: %u/%u in use, high water %u, alloc failures %" PRIu32 "\n", cls->size, cls->in_use,
+               cls->count, cls->high_water, cls->alloc_failures);
+    }
+    printf("Warning alerts:\n");
+    printf("  Events: %" PRIu32 "\n", t.warning_alerts);
+    printf("  ISR to event avg/max: %" PRId64 " / %" PRId64 " us\n",
+           t.warning_alerts ? t.warning_latency_sum_us / t.warning_alerts : 0, t.warning_latency_max_us);
+    printf("Critical alerts:\n");
+    printf("  Trips: %" PRIu32 "\n", t.critical_alerts);
+    printf("  ISR to switch off last/max: %" PRId64 " / %" PRId64 " us\n", t.critical_latency_last_us,
+           t.critical_latency_max_us);
+    printf("Fast trips:\n");
+    printf("  Trips: %" PRIu32 "\n", t.fast_trips);
+    printf("  Conversion to switch off last/max: %" PRId64 " / %" PRId64 " us\n", t.fast_trip_latency_last_us,
+           t.fast_trip_latency_max_us);
+
+    if (argc > 1 && strcmp(argv[1], "reset") == 0)
+    {
+        monitor_reset_timing();
+        printf("Counters reset.\n");
+    }
+
+    return 0;
+}
+
+static void register_sensor_stats(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "sensor_stats",
+        .help = "Show sensor timer jitter and acquisition timing ('sensor_stats reset' clears the counters)",
+        .hint = "[reset]",
+        .func = &sensor_stats_handler,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
+/* 'i2c_stats' command */
+static int i2c_stats_handler(int argc, char** argv)
+{
+    static const char* const names[I2C_BUS_DEVICE_MAX] = {"INA3221", "PCA9557"};
+
+    printf("I2C scheduler latency (wait = queued, bus = transaction):\n");
+    printf("  %-8s %-8s %-6s %-14s %-14s %s\n", "Device", "Count", "Errors", "Wait avg/max", "Bus avg/max",
+           "Total max(us)");
+    for (int i = 0; i < I2C_BUS_DEVICE_MAX; i++)
+    {
+        struct i2c_bus_latency l;
+        i2c_bus_get_latency(i, &l);
+        uint32_t n = l.transactions ? l.transactions : 1;
+        printf("  %-8s %-8" PRIu32 " %-6" PRIu32 " %6" PRId64 "/%-7" PRId64 " %6" PRId64 "/%-7" PRId64 " %" PRId64 "\n",
+               names[i], l.transactions, l.errors, l.wait_sum_us / n, l.wait_max_us, l.bus_sum_us / n, l.bus_max_us,
+               l.total_max_us);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "reset") == 0)
+    {
+        i2c_bus_reset_latency();
+        printf("Counters reset.\n");
+    }
+
+    return 0;
+}
+
+static void register_i2c_stats(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "i2c_stats",
+        .help = "Show per-device I2C scheduler latency ('i2c_stats reset' clears the counters)",
+        .hint = "[reset]",
+        .func = &i2c_stats_handler,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
+static struct
+{
+    struct arg_int* iterations;
+    struct arg_end* end;
+} sensor_bench_args;
+
+/* 'sensor_bench' command */
+static int sensor_bench_handler(int argc, char** argv)
+{
+    int nerrors = arg_parse(argc, argv, (void**)&sensor_bench_args);
+    if (nerrors != 0)
+    {
+        arg_print_errors(stderr, sensor_bench_args.end, argv[0]);
+        return 1;
+    }
+
+    int n = sensor_bench_args.iterations->count ? sensor_bench_args.iterations->ival[0] : 200;
+    if (n <= 0 || n > SENSOR_BENCH_MAX_ITERATIONS)
+    {
+        printf("Iterations must be 1..%d\n", SENSOR_BENCH_MAX_ITERATIONS);
+        return 1;
+    }
+    uint32_t iterations = n;
+    const uint32_t clocks[] = {100000, 400000};
+
+    printf("Burst read of all INA3221 shunt/bus registers, %" PRIu32 " iterations\n", iterations);
+    printf("  %-8s %-8s %-8s %-8s %-8s %s\n", "Clock", "Avg(us)", "Min(us)", "Max(us)", "Errors", "Max rate(Hz)");
+    for (int i = 0; i < sizeof(clocks) / sizeof(clocks[0]); i++)
+    {
+        struct sensor_bench_result r;
+        if (monitor_bench_bus(clocks[i], iterations, &r) != ESP_OK)
+        {
+            printf("  %-8" PRIu32 " failed\n", clocks[i]);
+            continue;
+        }
+        printf("  %-8" PRIu32 " %-8" PRId64 " %-8" PRId64 " %-8" PRId64 " %-8" PRIu32 " %" PRId64 "\n", r.clk_hz, r.avg_us,
+               r.min_us, r.max_us, r.errors, r.avg_us > 0 ? 1000000 / r.avg_us : 0);
+    }
+
+    return 0;
+}
+
+static void register_sensor_bench(void)
+{
+    sensor_bench_args.iterations = arg_int0("n", "iterations", "<n>", "Number of reads per clock (default 200)");
+    sensor_bench_args.end = arg_end(1);
+
+    const esp_console_cmd_t cmd = {.command = "sensor_bench",
+                                   .help = "Measure INA3221 bus time per sample at 100kHz and 400kHz",
+                                   .hint = NULL,
+                                   .func = &sensor_bench_handler,
+                                   .argtable = &sensor_bench_args};
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
+static struct
+{
+    struct arg_int* iterations;
+    struct arg_end* end;
+} sensor_cycles_args;
+
+/* 'sensor_cycles' command */
+static int sensor_cycles_handler(int argc, char** argv)
+{
+    int nerrors = arg_parse(argc, argv, (void**)&sensor_cycles_args);
+    if (nerrors != 0)
+    {
+        arg_print_errors(stderr, sensor_cycles_args.end, argv[0]);
+        return 1;
+    }
+
+    uint32_t iterations = sensor_cycles_args.iterations->count ? sensor_cycles_args.iterations->ival[0] : 1000;
+    struct conversion_bench_result r;
+    if (monitor_bench_conversion(iterations, &r) != ESP_OK)
+    {
+        printf("Benchmark failed\n");
+        return 1;
+    }
+
+    printf("Per-conversion convert + aggregate cost, %" PRIu32 " iterations\n", r.iterations);
+    printf("  float (soft-float) : %" PRIu32 " cycles\n", r.float_cycles);
+    printf("  fixed (uV/uA)      : %" PRIu32 " cycles\n", r.fixed_cycles);
+    return 0;
+}
+
+static void register_sensor_cycles(void)
+{
+    sensor_cycles_args.iterations = arg_int0("n", "iterations", "<n>", "Number of conversions (default 1000)");
+    sensor_cycles_args.end = arg_end(1);
+
+    const esp_console_cmd_t cmd = {.command = "sensor_cycles",
+                                   .help = "Compare CPU cycles of the float and fixed-point sample pipeline",
+                                   .hint = NULL,
+                                   .func = &sensor_cycles_handler,
+                                   .argtable = &sensor_cycles_args};
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
+static struct
+{
+    struct arg_str* channel;
+    struct arg_str* action;
+    struct arg_int* load_ma;
+    struct arg_int* conversions;
+    struct arg_end* end;
+} sensor_cal_args;
+
+// First point of a two-point calibration, kept until the second one is taken
+static struct
+{
+    bool valid;
+    int channel;
+    int32_t measured_ua;
+    int32_t reference_ua;
+} cal_point;
+
+static const char* const cal_channel_names[] = {"usb", "main", "vin"}; // ina3221_channel_t order
+
+static void print_calibration(void)
+{
+    printf("  %-6s %-12s %s\n", "Chan", "Gain(ppm)", "Offset(uA)");
+    for (int i = 0; i < INA3221_BUS_NUMBER; i++)
+    {
+        struct current_calibration cal;
+        monitor_get_calibration(i, &cal);
+        printf("  %-6s %-12" PRId32 " %" PRId32 "\n", cal_channel_names[i], cal.gain_ppm, cal.offset_ua);
+    }
+}
+
+/* 'sensor_cal' command */
+static int sensor_cal_handler(int argc, char** argv)
+{
+    int nerrors = arg_parse(argc, argv, (void**)&sensor_cal_args);
+    if (nerrors != 0)
+    {
+        arg_print_errors(stderr, sensor_cal_args.end, argv[0]);
+        return 1;
+    }
+
+    if (sensor_cal_args.channel->count == 0)
+    {
+        print_calibration();
+        return 0;
+    }
+
+    int channel = -1;
+    for (int i = 0; i < INA3221_BUS_NUMBER; i++)
+    {
+        if (strcmp(sensor_cal_args.channel->sval[0], cal_channel_names[i]) == 0)
+            channel = i;
+    }
+    if (channel < 0 || sensor_cal_args.action->count == 0)
+    {
+        printf("Usage: sensor_cal <usb|main|vin> <low|high|reset> [load_mA] [-n conversions]\n");
+        return 1;
+    }
+
+    const char* action = sensor_cal_args.action->sval[0];
+    if (strcmp(action, "reset") == 0)
+    {
+        struct current_calibration unity = {.gain_ppm = 1000000, .offset_ua = 0};
+        cal_point.valid = false;
+        if (monitor_set_calibration(channel, &unity) != ESP_OK)
+        {
+            printf("Failed to store calibration\n");
+            return 1;
+        }
+        print_calibration();
+        return 0;
+    }
+
+    bool low = strcmp(action, "low") == 0;
+    if ((!low && strcmp(action, "high") != 0) || sensor_cal_args.load_ma->count == 0)
+    {
+        printf("Usage: sensor_cal <usb|main|vin> <low|high|reset> [load_mA] [-n conversions]\n");
+        return 1;
+    }
+
+    int n = sensor_cal_args.conversions->count ? sensor_cal_args.conversions->ival[0] : 64;
+    if (n <= 0 || n > CAL_MEASURE_MAX_CONVERSIONS)
+    {
+        printf("Conversions must be 1..%d\n", CAL_MEASURE_MAX_CONVERSIONS);
+        return 1;
+    }
+    uint32_t conversions = n;
+    int32_t reference_ua = sensor_cal_args.load_ma->ival[0] * 1000;
+    int32_t measured_ua;
+
+    printf("Averaging %" PRIu32 " conversions of %s...\n", conversions, cal_channel_names[channel]);
+    esp_err_t err = monitor_measure_uncalibrated(channel, conversions, &measured_ua);
+    if (err != ESP_OK)
+    {
+        printf("Measurement failed: %s\n", esp_err_to_name(err));
+        return 1;
+    }
+    printf("  uncalibrated %" PRId32 " uA, reference %" PRId32 " uA\n", measured_ua, reference_ua);
+
+    if (low)
+    {
+        cal_point.valid = true;
+        cal_point.channel = channel;
+        cal_point.measured_ua = measured_ua;
+        cal_point.reference_ua = reference_ua;
+        printf("Low point stored, now apply the high load and run 'sensor_cal %s high <mA>'\n",
+               cal_channel_names[channel]);
+        return 0;
+    }
+
+    if (!cal_point.valid || cal_point.channel != channel)
+    {
+        printf("Take the low point of %s first\n", cal_channel_names[channel]);
+        return 1;
+    }
+    if (measured_ua - cal_point.measured_ua == 0 || reference_ua == cal_point.reference_ua)
+    {
+        printf("The two points must be taken at different loads\n");
+        return 1;
+    }
+
+    // reference = measured * gain + offset through both points
+    struct current_calibration cal;
+    cal.gain_ppm = (int32_t)((int64_t)(reference_ua - cal_point.reference_ua) * 1000000 /
+                             (measured_ua - cal_point.measured_ua));
+    cal.offset_ua = (int32_t)(cal_point.reference_ua - (int64_t)cal_point.measured_ua * cal.gain_ppm / 1000000);
+    cal_point.valid = false;
+
+    if (monitor_set_calibration(channel, &cal) != ESP_OK)
+    {
+        printf("Calibration out of range (gain %" PRId32 "ppm, offset %" PRId32 "uA), not stored\n", cal.gain_ppm,
+               cal.offset_ua);
+        return 1;
+    }
+    print_calibration();
+    return 0;
+}
+
+static void register_sensor_cal(void)
+{
+    sensor_cal_args.channel = arg_str0(NULL, NULL, "<usb|main|vin>", "Channel to calibrate, omit to show the table");
+    sensor_cal_args.action = arg_str0(NULL, NULL, "<low|high|reset>", "Calibration step");
+    sensor_cal_args.load_ma = arg_int0(NULL, NULL, "<load_mA>", "Known load current of this step");
+    sensor_cal_args.conversions = arg_int0("n", "conversions", "<n>", "Conversions to average (default 64)");
+    sensor_cal_args.end = arg_end(4);
+
+    const esp_console_cmd_t cmd = {.command = "sensor_cal",
+                                   .help = "Two-point current calibration against a known load",
+                                   .hint = NULL,
+                                   .func = &sensor_cal_handler,
+                                   .argtable = &sensor_cal_args};
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
 esp_err_t initialize_dbg_console(void)
 {
     esp_console_repl_t* repl = NULL;
@@ -173,6 +536,11 @@ esp_err_t initialize_dbg_console(void)
     register_wifi_scan();
     register_wifi_connect();
     register_wifi_status();
+    register_sensor_stats();
+    register_i2c_stats();
+    register_sensor_bench();
+    register_sensor_cycles();
+    register_sensor_cal();
 
     printf("Debug console initialized.\n");
 
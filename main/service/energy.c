@@ -0,0 +1,238 @@
+#include "energy.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "auth.h"
+#include "cJSON.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "nconfig.h"
+#include "sensor.h"
+#include "webserver.h"
+
+// The bus voltage is always a whole number of INA3221_BUS_LSB_MV steps, so energy is integrated in
+// LSB * uA * us = 8 fJ units. With at most 4095 LSBs, 16.4A and ENERGY_MAX_GAP_US this fits 63 bits.
+#define ENERGY_LSB_UV (INA3221_BUS_LSB_MV * 1000)
+#define ENERGY_UNITS_PER_UJ (1000000000LL / INA3221_BUS_LSB_MV)
+#define CHARGE_PC_PER_UC 1000000LL
+// Remainders are only folded into the totals once they reach about one joule/coulomb, which keeps the
+// 64-bit divisions out of the per-conversion path
+#define ENERGY_CARRY_UNITS (ENERGY_UNITS_PER_UJ * 1000000)
+#define CHARGE_CARRY_PC (CHARGE_PC_PER_UC * 1000000)
+
+static const char* TAG = "energy";
+
+struct energy_accumulator
+{
+    int64_t charge_uc;
+    int64_t energy_uj;
+    int64_t charge_pc; // uA * us not yet folded into charge_uc
+    int64_t energy_units; // ENERGY_LSB_UV * uA * us not yet folded into energy_uj
+};
+
+static struct energy_accumulator accumulators[INA3221_BUS_NUMBER];
+static int64_t last_acquired_us;
+static int64_t since_ms;
+static portMUX_TYPE energy_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Last values written to NVS, only touched by energy_checkpoint()
+static struct energy_totals saved;
+static int64_t last_checkpoint_us;
+
+// Indexed in ina3221_channel_t order
+static const enum nconfig_type energy_keys[INA3221_BUS_NUMBER] = {USB_ENERGY, MAIN_ENERGY, VIN_ENERGY};
+
+void energy_add(int64_t acquired_us, const int32_t voltage_uv[INA3221_BUS_NUMBER],
+                const int32_t current_ua[INA3221_BUS_NUMBER])
+{
+    int64_t dt = acquired_us - last_acquired_us;
+    bool first = last_acquired_us == 0;
+    last_acquired_us = acquired_us;
+
+    // each conversion is the average over the time since the previous one was read
+    if (first || dt <= 0 || dt > ENERGY_MAX_GAP_US)
+        return;
+
+    portENTER_CRITICAL(&energy_lock);
+    for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+    {
+        struct energy_accumulator* acc = &accumulators[i];
+        int64_t charge = (int64_t)current_ua[i] * dt;
+
+        acc->charge_pc += charge;
+        acc->energy_units += charge * (voltage_uv[i] / ENERGY_LSB_UV);
+
+        if (acc->charge_pc >= CHARGE_CARRY_PC || acc->charge_pc <= -CHARGE_CARRY_PC)
+        {
+            acc->charge_uc += acc->charge_pc / CHARGE_PC_PER_UC;
+            acc->charge_pc %= CHARGE_PC_PER_UC;
+        }
+        if (acc->energy_units >= ENERGY_CARRY_UNITS || acc->energy_units <= -ENERGY_CARRY_UNITS)
+        {
+            acc->energy_uj += acc->energy_units / ENERGY_UNITS_PER_UJ;
+            acc->energy_units %= ENERGY_UNITS_PER_UJ;
+        }
+    }
+    portEXIT_CRITICAL(&energy_lock);
+}
+
+void energy_get(struct energy_totals* totals)
+{
+    struct energy_accumulator copy[INA3221_BUS_NUMBER];
+
+    portENTER_CRITICAL(&energy_lock);
+    memcpy(copy, accumulators, sizeof(copy));
+    totals->since_ms = since_ms;
+    portEXIT_CRITICAL(&energy_lock);
+
+    for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+    {
+        totals->charge_uc[i] = copy[i].charge_uc + copy[i].charge_pc / CHARGE_PC_PER_UC;
+        totals->energy_uj[i] = copy[i].energy_uj + copy[i].energy_units / ENERGY_UNITS_PER_UJ;
+    }
+}
+
+void energy_checkpoint(bool force)
+{
+    int64_t now = esp_timer_get_time();
+    if (!force && now - last_checkpoint_us < (int64_t)ENERGY_CHECKPOINT_INTERVAL_S * 1000000)
+        return;
+    last_checkpoint_us = now;
+
+    struct energy_totals totals;
+    energy_get(&totals);
+
+    char buf[48];
+    for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+    {
+        if (!force && totals.charge_uc[i] == saved.charge_uc[i] && totals.energy_uj[i] == saved.energy_uj[i])
+            continue;
+
+        snprintf(buf, sizeof(buf), "%" PRId64 ",%" PRId64, totals.charge_uc[i], totals.energy_uj[i]);
+        if (nconfig_write(energy_keys[i], buf) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to checkpoint CH%d energy", i + 1);
+            continue;
+        }
+        saved.charge_uc[i] = totals.charge_uc[i];
+        saved.energy_uj[i] = totals.energy_uj[i];
+    }
+
+    if (force || totals.since_ms != saved.since_ms)
+    {
+        snprintf(buf, sizeof(buf), "%" PRId64, totals.since_ms);
+        if (nconfig_write(ENERGY_SINCE, buf) == ESP_OK)
+            saved.since_ms = totals.since_ms;
+    }
+}
+
+void energy_reset(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    portENTER_CRITICAL(&energy_lock);
+    memset(accumulators, 0, sizeof(accumulators));
+    since_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    portEXIT_CRITICAL(&energy_lock);
+
+    energy_checkpoint(true);
+    ESP_LOGI(TAG, "Energy counters reset");
+}
+
+void energy_init(void)
+{
+    char buf[48];
+
+    for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+    {
+        if (nconfig_read(energy_keys[i], buf, sizeof(buf)) != ESP_OK)
+            continue;
+
+        char* end;
+        accumulators[i].charge_uc = strtoll(buf, &end, 10);
+        accumulators[i].energy_uj = *end == ',' ? strtoll(end + 1, NULL, 10) : 0;
+        saved.charge_uc[i] = accumulators[i].charge_uc;
+        saved.energy_uj[i] = accumulators[i].energy_uj;
+    }
+    if (nconfig_read(ENERGY_SINCE, buf, sizeof(buf)) == ESP_OK)
+        since_ms = strtoll(buf, NULL, 10);
+    saved.since_ms = since_ms;
+    last_checkpoint_us = esp_timer_get_time();
+
+    ESP_LOGI(TAG, "Restored energy: VIN %" PRId64 "uJ, MAIN %" PRId64 "uJ, USB %" PRId64 "uJ",
+             accumulators[INA3221_CHANNEL_3].energy_uj, accumulators[INA3221_CHANNEL_2].energy_uj,
+             accumulators[INA3221_CHANNEL_1].energy_uj);
+}
+
+static void add_channel(cJSON* root, const char* name, const struct energy_totals* totals, uint8_t channel)
+{
+    cJSON* item = cJSON_AddObjectToObject(root, name);
+    cJSON_AddNumberToObject(item, "charge_uah", (double)(totals->charge_uc[channel] / 3600));
+    cJSON_AddNumberToObject(item, "energy_uwh", (double)(totals->energy_uj[channel] / 3600));
+}
+
+/*
+ * GET /api/energy
+ * Charge (uAh) and energy (uWh) per channel since the last reset.
+ */
+static esp_err_t energy_get_handler(httpd_req_t* req)
+{
+    esp_err_t err = api_auth_check(req);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    struct energy_totals totals;
+    energy_get(&totals);
+
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "since_ms", (double)totals.since_ms);
+    cJSON_AddNumberToObject(root, "uptime_ms", (double)(esp_timer_get_time() / 1000));
+    add_channel(root, "vin", &totals, INA3221_CHANNEL_3);
+    add_channel(root, "main", &totals, INA3221_CHANNEL_2);
+    add_channel(root, "usb", &totals, INA3221_CHANNEL_1);
+
+    char* json_string = cJSON_Print(root);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_string, strlen(json_string));
+
+    free(json_string);
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+/*
+ * POST /api/energy
+ * Zeroes the counters of every channel.
+ */
+static esp_err_t energy_post_handler(httpd_req_t* req)
+{
+    esp_err_t err = api_auth_check(req);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    energy_reset();
+    httpd_resp_sendstr(req, "{\"status\":\"ok\"}");
+    return ESP_OK;
+}
+
+void register_energy_endpoint(httpd_handle_t server)
+{
+    httpd_uri_t get_uri = {.uri = "/api/energy", .method = HTTP_GET, .handler = energy_get_handler, .user_ctx = NULL};
+    httpd_register_uri_handler(server, &get_uri);
+
+    httpd_uri_t post_uri = {
+        .uri = "/api/energy", .method = HTTP_POST, .handler = energy_post_handler, .user_ctx = NULL};
+    httpd_register_uri_handler(server, &post_uri);
+}
@@ -0,0 +1,47 @@
+#ifndef ODROID_POWER_MATE_ENERGY_H
+#define ODROID_POWER_MATE_ENERGY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ina3221.h"
+
+#define ENERGY_CHECKPOINT_INTERVAL_S 300 // at most one NVS write per channel every 5 minutes
+#define ENERGY_MAX_GAP_US 60000000 // longer than the slowest conversion period (1024 averages, 8.244ms)
+
+/**
+ * Charge and energy integrated since the last reset, per channel in ina3221_channel_t order.
+ */
+struct energy_totals
+{
+    int64_t charge_uc[INA3221_BUS_NUMBER]; // micro-coulombs, 1 Ah = 3.6e9 uC
+    int64_t energy_uj[INA3221_BUS_NUMBER]; // micro-joules, 1 Wh = 3.6e9 uJ
+    int64_t since_ms; // wall clock time of the last reset, 0 if it was never set
+};
+
+/**
+ * @brief Restores the totals checkpointed before the last reboot.
+ */
+void energy_init(void);
+
+/**
+ * @brief Integrates one conversion over the time since the previous one, called from the acquisition task for
+ * every conversion.
+ */
+void energy_add(int64_t acquired_us, const int32_t voltage_uv[INA3221_BUS_NUMBER],
+                const int32_t current_ua[INA3221_BUS_NUMBER]);
+
+void energy_get(struct energy_totals* totals);
+
+/**
+ * @brief Zeroes all channels and persists the zeroed totals right away.
+ */
+void energy_reset(void);
+
+/**
+ * @brief Writes the totals to NVS if they changed and the last checkpoint is at least
+ * ENERGY_CHECKPOINT_INTERVAL_S old, or unconditionally when force is set.
+ */
+void energy_checkpoint(bool force);
+
+#endif // ODROID_POWER_MATE_ENERGY_H
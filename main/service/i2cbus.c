@@ -0,0 +1,145 @@
+#include "i2cbus.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#define I2C_BUS_SUBMIT_TIMEOUT (pdMS_TO_TICKS(100))
+
+static const char* TAG = "i2cbus";
+
+// Lives on the submitting task's stack until the scheduler signals done
+struct i2c_transaction
+{
+    enum i2c_bus_device device;
+    i2c_bus_fn fn;
+    void* arg;
+    esp_err_t result;
+    int64_t queued_us;
+    SemaphoreHandle_t done;
+    StaticSemaphore_t done_buffer;
+};
+
+static QueueHandle_t queues[I2C_BUS_PRIO_MAX];
+static TaskHandle_t scheduler_task_handle = NULL;
+
+static struct i2c_bus_latency latency[I2C_BUS_DEVICE_MAX];
+static portMUX_TYPE latency_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Highest priority transaction waiting, looked up again after every transaction
+static bool next_transaction(struct i2c_transaction** transaction)
+{
+    for (int i = 0; i < I2C_BUS_PRIO_MAX; i++)
+    {
+        if (xQueueReceive(queues[i], transaction, 0) == pdTRUE)
+            return true;
+    }
+    return false;
+}
+
+static void account(const struct i2c_transaction* transaction, int64_t start, int64_t end)
+{
+    int64_t wait = start - transaction->queued_us;
+    int64_t bus = end - start;
+
+    portENTER_CRITICAL(&latency_lock);
+    struct i2c_bus_latency* l = &latency[transaction->device];
+    l->transactions++;
+    if (transaction->result != ESP_OK)
+        l->errors++;
+    l->wait_sum_us += wait;
+    l->bus_sum_us += bus;
+    if (wait > l->wait_max_us)
+        l->wait_max_us = wait;
+    if (bus > l->bus_max_us)
+        l->bus_max_us = bus;
+    if (wait + bus > l->total_max_us)
+        l->total_max_us = wait + bus;
+    portEXIT_CRITICAL(&latency_lock);
+}
+
+static void i2c_scheduler_task(void* pvParameters)
+{
+    struct i2c_transaction* transaction;
+
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        while (next_transaction(&transaction))
+        {
+            int64_t start = esp_timer_get_time();
+            transaction->result = transaction->fn(transaction->arg);
+            account(transaction, start, esp_timer_get_time());
+            xSemaphoreGive(transaction->done);
+        }
+    }
+}
+
+esp_err_t i2c_bus_init(void)
+{
+    for (int i = 0; i < I2C_BUS_PRIO_MAX; i++)
+    {
+        queues[i] = xQueueCreate(I2C_BUS_QUEUE_LEN, sizeof(struct i2c_transaction*));
+        if (queues[i] == NULL)
+            return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(i2c_scheduler_task, "i2c_sched_task", 1024 * 3, NULL, I2C_BUS_TASK_PRIORITY,
+                    &scheduler_task_handle) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create scheduler task");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t i2c_bus_run(enum i2c_bus_device device, enum i2c_bus_priority priority, i2c_bus_fn fn, void* arg)
+{
+    if (device >= I2C_BUS_DEVICE_MAX || priority >= I2C_BUS_PRIO_MAX)
+        return ESP_ERR_INVALID_ARG;
+
+    // before the scheduler exists (early init) there is nobody to contend with
+    if (scheduler_task_handle == NULL)
+        return fn(arg);
+
+    struct i2c_transaction transaction = {
+        .device = device,
+        .fn = fn,
+        .arg = arg,
+        .queued_us = esp_timer_get_time(),
+    };
+    transaction.done = xSemaphoreCreateBinaryStatic(&transaction.done_buffer);
+
+    struct i2c_transaction* pointer = &transaction;
+    if (xQueueSend(queues[priority], &pointer, I2C_BUS_SUBMIT_TIMEOUT) != pdTRUE)
+    {
+        ESP_LOGW(TAG, "Queue %d full, transaction for device %d dropped", priority, device);
+        return ESP_ERR_TIMEOUT;
+    }
+    xTaskNotifyGive(scheduler_task_handle);
+
+    // the transaction lives on this stack, so it has to be waited for no matter how long it takes
+    xSemaphoreTake(transaction.done, portMAX_DELAY);
+    return transaction.result;
+}
+
+void i2c_bus_get_latency(enum i2c_bus_device device, struct i2c_bus_latency* out)
+{
+    portENTER_CRITICAL(&latency_lock);
+    *out = latency[device];
+    portEXIT_CRITICAL(&latency_lock);
+}
+
+void i2c_bus_reset_latency(void)
+{
+    portENTER_CRITICAL(&latency_lock);
+    memset(latency, 0, sizeof(latency));
+    portEXIT_CRITICAL(&latency_lock);
+}
@@ -0,0 +1,64 @@
+#ifndef ODROID_POWER_MATE_I2CBUS_H
+#define ODROID_POWER_MATE_I2CBUS_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define I2C_BUS_QUEUE_LEN 8 // pending transactions per priority
+#define I2C_BUS_TASK_PRIORITY 16 // above every task that submits transactions
+
+// Devices sharing I2C port 0, latency is accounted per device
+enum i2c_bus_device
+{
+    I2C_BUS_INA3221, // 0x40
+    I2C_BUS_PCA9557, // 0x18
+    I2C_BUS_DEVICE_MAX,
+};
+
+// Lower value runs first, a queued transaction only ever waits behind the one currently on the bus
+enum i2c_bus_priority
+{
+    I2C_BUS_PRIO_SWITCH, // load switch and trigger pins, the critical alert path
+    I2C_BUS_PRIO_CONFIG, // sensor configuration and alert limits
+    I2C_BUS_PRIO_SAMPLE, // conversion reads of the acquisition task
+    I2C_BUS_PRIO_MAX,
+};
+
+/**
+ * Per-device transaction latency. wait is the time spent queued until the scheduler started the
+ * transaction, bus is the time the transaction itself took.
+ */
+struct i2c_bus_latency
+{
+    uint32_t transactions;
+    uint32_t errors;
+    int64_t wait_sum_us;
+    int64_t wait_max_us;
+    int64_t bus_sum_us;
+    int64_t bus_max_us;
+    int64_t total_max_us;
+};
+
+/**
+ * One bus transaction. It runs on the scheduler task and may issue any number of register accesses to its
+ * device; nothing else touches the bus until it returns.
+ */
+typedef esp_err_t (*i2c_bus_fn)(void* arg);
+
+/**
+ * @brief Starts the scheduler task. Transactions submitted before this run directly on the caller.
+ */
+esp_err_t i2c_bus_init(void);
+
+/**
+ * @brief Queues a transaction and blocks the caller until the scheduler has run it.
+ *
+ * @return The transaction's result, or ESP_ERR_TIMEOUT if its priority queue stayed full.
+ */
+esp_err_t i2c_bus_run(enum i2c_bus_device device, enum i2c_bus_priority priority, i2c_bus_fn fn, void* arg);
+
+void i2c_bus_get_latency(enum i2c_bus_device device, struct i2c_bus_latency* out);
+void i2c_bus_reset_latency(void);
+
+#endif // ODROID_POWER_MATE_I2CBUS_H
@@ -3,10 +3,15 @@
 //
 
 #include "monitor.h"
+#include <inttypes.h>
 #include <nconfig.h>
+#include <string.h>
 #include <sys/time.h>
 #include <time.h>
 #include "climit.h"
+#include "datalog.h"
+#include "energy.h"
+#include "esp_cpu.h"
 #include "esp_log.h"
 #include "esp_netif.h"
 #include "esp_timer.h"
@@ -14,9 +19,15 @@
 #include "event.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h" // Added for FreeRTOS tasks
+#include "i2cbus.h"
 #include "ina3221.h"
 #include "pbmsg.h"
+#include "profile.h"
+#include "scope.h"
+#include "sensor.h"
+#include "stats.h"
 #include "sw.h"
+#include "watchdog.h"
 #include "webserver.h"
 #include "wifi.h"
 
@@ -27,7 +38,21 @@
 #define PM_SDA CONFIG_I2C_GPIO_SDA
 #define PM_SCL CONFIG_I2C_GPIO_SCL
 
+#define SENSOR_MIN_POLL_US 200
+#define FAST_I2C_CLK_HZ 400000 // fast-mode I2C while conversions run at the hardware rate
+
+// Estimated I2C time per sample until it has been measured at a clock
+#define SAMPLE_REGISTER_READS 7 // six results and the mask poll
+#define REGISTER_READ_BITS 48 // start, address and pointer, repeated start, address and two data bytes, stop
+#define REGISTER_READ_OVERHEAD_US 40 // driver and scheduler time per read on top of the bits on the wire
+
+// Adaptive publish rate: fast while the signal moves, a slow heartbeat while it is steady
+#define ADAPTIVE_FAST_PERIOD_MS 100
+#define ADAPTIVE_HEARTBEAT_MS 5000
+#define ADAPTIVE_HOLD_MS 2000 // stay fast this long after the last change
+
 #define PM_INT_CRITICAL CONFIG_GPIO_INA3221_INT_CRITICAL
+#define PM_INT_WARNING CONFIG_GPIO_INA3221_INT_WARNING
 #define PM_EXPANDER_RST CONFIG_GPIO_EXPANDER_RESET
 
 static const char* TAG = "monitor";
@@ -38,6 +63,109 @@ static esp_timer_handle_t long_press_timer;
 // static esp_timer_handle_t shutdown_load_sw; // No longer needed
 
 static TaskHandle_t shutdown_task_handle = NULL; // Global task handle
+static TaskHandle_t warning_task_handle = NULL;
+static TaskHandle_t acquisition_task_handle = NULL;
+static TaskHandle_t publish_task_handle = NULL;
+
+#define SAMPLE_RING_SIZE 64
+
+// Measurements are carried as integer micro-volts/amps; the ESP32-C3 has no FPU
+struct sensor_sample
+{
+    uint64_t timestamp_ms;
+    uint64_t uptime_ms;
+    int64_t acquired_us; // when the conversion was read, for gap and jitter analysis on the client
+    uint32_t sequence; // conversion number, conversions overwritten before they were read and failed reads leave a gap
+    int32_t voltage_uv[INA3221_BUS_NUMBER];
+    int32_t current_ua[INA3221_BUS_NUMBER];
+};
+
+// Filled by the acquisition task, drained by the publisher task
+static struct sensor_sample sample_ring[SAMPLE_RING_SIZE];
+static uint32_t sample_ring_head;
+static uint32_t sample_ring_tail;
+static portMUX_TYPE sample_ring_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t dropped_samples; // skipped conversions, ring overruns and failed reads since boot, never reset
+
+// Most recent conversion for pollers that cannot wait for the publish period
+static int32_t last_current_ua[INA3221_BUS_NUMBER];
+static int64_t last_acquired_us;
+static portMUX_TYPE last_sample_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Conversions averaged into one published SensorData message
+struct sensor_window
+{
+    int64_t voltage_sum[INA3221_BUS_NUMBER];
+    int32_t voltage_min[INA3221_BUS_NUMBER];
+    int32_t voltage_max[INA3221_BUS_NUMBER];
+    int64_t current_sum[INA3221_BUS_NUMBER];
+    uint64_t current_sq_sum[INA3221_BUS_NUMBER];
+    int32_t current_min[INA3221_BUS_NUMBER];
+    int32_t current_max[INA3221_BUS_NUMBER];
+    int64_t power_max[INA3221_BUS_NUMBER]; // uV * uA, scaled to uW once per publish
+    struct sensor_sample last;
+    uint32_t count;
+};
+
+// Raw conversions streamed as SensorBatch messages while capture mode is on, publish task only
+static struct sensor_batch batch;
+
+static struct monitor_timing timing;
+static portMUX_TYPE timing_lock = portMUX_INITIALIZER_UNLOCKED; // timing is updated from several tasks
+static int64_t sensor_next_fire_us;
+static volatile uint32_t publish_period_ms = 1000;
+static volatile uint8_t pending_critical_flags;
+static volatile uint8_t pending_warning_flags;
+static portMUX_TYPE alert_flags_lock = portMUX_INITIALIZER_UNLOCKED; // set and taken from different tasks
+static volatile int64_t warning_isr_us;
+
+#define WARNING_EVENT_HOLDOFF_US 1000000 // at most one warning event per channel per second
+
+// Configuration change requested from outside, applied by the acquisition task between conversions
+static ina3221_config_t requested_config;
+static uint32_t requested_clk_hz;
+static volatile bool config_pending;
+static bool conversion_fast;
+static uint32_t normal_clk_hz; // I2C clock set up by the driver, used outside the fast modes
+// I2C time per sample (mask poll and result reads) at the normal [0] and fast [1] clock, 0 until measured
+static volatile uint32_t sample_bus_us[2];
+static portMUX_TYPE config_lock = portMUX_INITIALIZER_UNLOCKED;
+static volatile bool capture_mode;
+
+// Averaging and conversion times used outside the fast modes, from nconfig
+static uint8_t normal_avg = INA3221_AVG_16;
+static uint8_t normal_vbus = INA3221_CT_140;
+static uint8_t normal_vsht = INA3221_CT_1100;
+
+static volatile bool adaptive_enabled;
+static volatile bool adaptive_fast;
+static volatile int32_t adaptive_threshold_ua = 50000;
+
+// Software fast-trip, checked by the acquisition task on every conversion
+static volatile int32_t trip_limit_ua[INA3221_BUS_NUMBER]; // 0 = disabled
+static volatile uint8_t trip_samples = 3;
+static uint8_t trip_count[INA3221_BUS_NUMBER];
+static const uint8_t trip_switches[INA3221_BUS_NUMBER] = {LOAD_SW_USB, LOAD_SW_MAIN, LOAD_SW_MAIN | LOAD_SW_USB};
+
+// Last trip, reported by the publish task so events and messages stay out of the acquisition path
+struct fast_trip
+{
+    uint8_t channels; // BIT(channel) of every channel that tripped
+    int32_t current_ua[INA3221_BUS_NUMBER];
+    int64_t latency_us;
+    esp_err_t result;
+};
+static struct fast_trip last_trip;
+static volatile bool trip_pending;
+static volatile int64_t critical_isr_us;
+
+struct adaptive_state
+{
+    bool active;
+    bool reference_valid;
+    int32_t reference_ua[INA3221_BUS_NUMBER]; // mean current of the last published window
+    TickType_t last_activity;
+};
 
 ina3221_t ina3221 = {
     .shunt = {10, 10, 10},
@@ -57,44 +185,734 @@ ina3221_t ina3221 = {
         },
 };
 
-static void sensor_timer_callback(void* arg)
+// Calibrated current = shunt counts * scale / 2^CAL_SCALE_SHIFT + offset. With 10mOhm shunts one count is
+// 4000uA, so the scaled product of a full-scale reading still fits in 32 bits.
+#define CAL_SCALE_SHIFT 4
+#define CAL_MEASURE_MARGIN_MS 1000 // on top of the conversion time when waiting for a measurement
+
+struct channel_calibration
+{
+    int32_t scale; // uA per shunt count, Q4
+    int32_t offset_ua;
+};
+
+// Indexed in ina3221_channel_t order, only touched by the acquisition task
+static struct channel_calibration calibration[INA3221_BUS_NUMBER];
+static struct current_calibration calibration_settings[INA3221_BUS_NUMBER];
+static struct channel_calibration requested_calibration[INA3221_BUS_NUMBER];
+static volatile bool calibration_pending;
+static const enum nconfig_type calibration_keys[INA3221_BUS_NUMBER] = {USB_CALIBRATION, MAIN_CALIBRATION,
+                                                                       VIN_CALIBRATION};
+
+// Uncalibrated averaging for monitor_measure_uncalibrated(), filled by the acquisition task
+static portMUX_TYPE measure_lock = portMUX_INITIALIZER_UNLOCKED; // the caller may give up while the task adds
+static uint32_t measure_remaining;
+static int64_t measure_raw_sum[INA3221_BUS_NUMBER];
+static uint32_t measure_count;
+
+static const uint16_t ct_us[] = {140, 204, 332, 588, 1100, 2116, 4156, 8244};
+static const uint16_t avg_count[] = {1, 4, 16, 64, 128, 256, 512, 1024};
+
+// Time the INA3221 needs to finish one averaged conversion of every enabled channel
+static uint32_t conversion_period_us(const ina3221_config_t* config)
+{
+    uint32_t per_channel = (config->ebus ? ct_us[config->vbus] : 0) + (config->esht ? ct_us[config->vsht] : 0);
+    uint32_t channels = config->ch1 + config->ch2 + config->ch3;
+    return per_channel * channels * avg_count[config->avg];
+}
+
+static uint32_t fast_clk_hz() { return normal_clk_hz < FAST_I2C_CLK_HZ ? FAST_I2C_CLK_HZ : normal_clk_hz; }
+
+// Measured bus time per sample at the clock of the normal or the fast modes, estimated before the first sample
+static uint32_t sample_bus_time_us(bool fast)
+{
+    uint32_t measured = sample_bus_us[fast];
+    if (measured != 0)
+        return measured;
+    uint32_t clk_hz = fast ? fast_clk_hz() : normal_clk_hz;
+    return SAMPLE_REGISTER_READS * (REGISTER_READ_BITS * 1000000 / clk_hz + REGISTER_READ_OVERHEAD_US);
+}
+
+// INA3221 transactions, run on the I2C scheduler task (see i2cbus.h)
+static esp_err_t bus_read_mask(void* arg) { return sensor_read_mask(&ina3221, arg); }
+
+static esp_err_t bus_read_raw(void* arg) { return sensor_read_raw(&ina3221, arg); }
+
+static esp_err_t bus_sync(void* arg) { return ina3221_sync(&ina3221); }
+
+static esp_err_t bus_get_status(void* arg) { return ina3221_get_status(&ina3221); }
+
+struct alert_limit
+{
+    ina3221_channel_t channel;
+    uint32_t milliamps;
+    bool critical;
+};
+
+static esp_err_t bus_set_alert_limit(void* arg)
+{
+    const struct alert_limit* limit = arg;
+    if (limit->critical)
+        return sensor_set_critical_alert_ma(&ina3221, limit->channel, limit->milliamps);
+    return sensor_set_warning_alert_ma(&ina3221, limit->channel, limit->milliamps);
+}
+
+// Returns the latched flags and clears them in one step, so a flag set in between is never lost
+static uint8_t take_pending_flags(volatile uint8_t* flags)
+{
+    portENTER_CRITICAL(&alert_flags_lock);
+    uint8_t taken = *flags;
+    *flags = 0;
+    portEXIT_CRITICAL(&alert_flags_lock);
+    return taken;
+}
+
+// Reads the mask/enable register. This also clears CVRF and the latched alert flags, so any
+// alert flags seen here are kept for shutdown_load_sw_task and warning_alert_task.
+static esp_err_t read_mask_register(ina3221_mask_t* mask, enum i2c_bus_priority priority)
+{
+    esp_err_t err = i2c_bus_run(I2C_BUS_INA3221, priority, bus_read_mask, mask);
+    if (err == ESP_OK)
+    {
+        portENTER_CRITICAL(&alert_flags_lock);
+        pending_critical_flags |= mask->cf;
+        pending_warning_flags |= mask->wf;
+        portEXIT_CRITICAL(&alert_flags_lock);
+    }
+    return err;
+}
+
+// uA per shunt count with the nominal shunt value: nV / mOhm = uA
+static int32_t nominal_ua_per_count(uint8_t channel)
+{
+    return (INA3221_SHUNT_LSB_UV * 1000) / (int32_t)ina3221.shunt[channel];
+}
+
+static void calibration_from_settings(uint8_t channel, const struct current_calibration* settings,
+                                      struct channel_calibration* cal)
+{
+    cal->scale = (int32_t)((int64_t)(nominal_ua_per_count(channel) << CAL_SCALE_SHIFT) * settings->gain_ppm / 1000000);
+    cal->offset_ua = settings->offset_ua;
+}
+
+static void sample_from_raw(const struct sensor_raw* raw, struct sensor_sample* sample)
+{
+    for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+    {
+        sample->voltage_uv[i] = raw->bus[i] * (INA3221_BUS_LSB_MV * 1000);
+        sample->current_ua[i] = ((raw->shunt[i] * calibration[i].scale) >> CAL_SCALE_SHIFT) + calibration[i].offset_ua;
+    }
+}
+
+static esp_err_t read_sensor_sample(struct sensor_sample* sample, struct sensor_raw* raw)
 {
     struct timeval tv;
     gettimeofday(&tv, NULL);
-    uint64_t timestamp_ms = (uint64_t)tv.tv_sec * 1000 + (uint64_t)tv.tv_usec / 1000;
-    uint64_t uptime_ms = (uint64_t)esp_timer_get_time() / 1000;
+    sample->timestamp_ms = (uint64_t)tv.tv_sec * 1000 + (uint64_t)tv.tv_usec / 1000;
+    sample->acquired_us = esp_timer_get_time();
+    sample->uptime_ms = (uint64_t)sample->acquired_us / 1000;
+
+    esp_err_t err = i2c_bus_run(I2C_BUS_INA3221, I2C_BUS_PRIO_SAMPLE, bus_read_raw, raw);
+    if (err != ESP_OK)
+        return err;
+
+    sample_from_raw(raw, sample);
+    return ESP_OK;
+}
+
+static uint32_t sample_ring_push(const struct sensor_sample* sample)
+{
+    portENTER_CRITICAL(&sample_ring_lock);
+    sample_ring[sample_ring_head % SAMPLE_RING_SIZE] = *sample;
+    sample_ring_head++;
+    uint32_t fill = sample_ring_head - sample_ring_tail;
+    portEXIT_CRITICAL(&sample_ring_lock);
+
+    return fill;
+}
+
+static bool sample_ring_pop(struct sensor_sample* sample)
+{
+    bool ret = false;
+
+    portENTER_CRITICAL(&sample_ring_lock);
+    if (sample_ring_head - sample_ring_tail > SAMPLE_RING_SIZE)
+    {
+        // publisher fell behind, the oldest entries were overwritten
+        uint32_t lost = sample_ring_head - sample_ring_tail - SAMPLE_RING_SIZE;
+        portENTER_CRITICAL(&timing_lock);
+        timing.ring_overruns += lost;
+        portEXIT_CRITICAL(&timing_lock);
+        dropped_samples += lost;
+        sample_ring_tail = sample_ring_head - SAMPLE_RING_SIZE;
+    }
+    if (sample_ring_tail != sample_ring_head)
+    {
+        *sample = sample_ring[sample_ring_tail % SAMPLE_RING_SIZE];
+        sample_ring_tail++;
+        ret = true;
+    }
+    portEXIT_CRITICAL(&sample_ring_lock);
+
+    return ret;
+}
 
+static void window_add(struct sensor_window* window, const struct sensor_sample* sample)
+{
+    for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+    {
+        int32_t voltage = sample->voltage_uv[i];
+        int32_t current = sample->current_ua[i];
+        int64_t power = (int64_t)voltage * current;
+
+        if (window->count == 0 || voltage < window->voltage_min[i])
+            window->voltage_min[i] = voltage;
+        if (window->count == 0 || voltage > window->voltage_max[i])
+            window->voltage_max[i] = voltage;
+        if (window->count == 0 || current < window->current_min[i])
+            window->current_min[i] = current;
+        if (window->count == 0 || current > window->current_max[i])
+            window->current_max[i] = current;
+        if (window->count == 0 || power > window->power_max[i])
+            window->power_max[i] = power;
+
+        window->voltage_sum[i] += voltage;
+        window->current_sum[i] += current;
+        window->current_sq_sum[i] += (uint64_t)((int64_t)current * current);
+    }
+    window->last = *sample;
+    window->count++;
+}
+
+static uint32_t isqrt64(uint64_t value)
+{
+    uint64_t root = 0;
+    uint64_t bit = 1ULL << 62;
+
+    while (bit > value)
+        bit >>= 2;
+    while (bit != 0)
+    {
+        if (value >= root + bit)
+        {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)root;
+}
+
+static void publish_sensor_window(const struct sensor_window* window)
+{
     StatusMessage message = StatusMessage_init_zero;
     message.which_payload = StatusMessage_sensor_data_tag;
     SensorData* sensor_data = &message.payload.sensor_data;
 
-    sensor_data->has_usb = true;
-    sensor_data->has_main = true;
-    sensor_data->has_vin = true;
+    sensor_data->has_usb_fixed = true;
+    sensor_data->has_main_fixed = true;
+    sensor_data->has_vin_fixed = true;
+
+    SensorChannelFixed* channels[] = {&sensor_data->usb_fixed, &sensor_data->main_fixed, &sensor_data->vin_fixed};
+    sensor_data_t channel_data_log[INA3221_BUS_NUMBER];
+    struct energy_totals energy;
+    energy_get(&energy);
+
+    for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+    {
+        int32_t voltage = (int32_t)(window->voltage_sum[i] / window->count);
+        int32_t current = (int32_t)(window->current_sum[i] / window->count);
+        int32_t power = (int32_t)((int64_t)voltage * current / 1000000);
+
+        channel_data_log[i].voltage_uv = voltage;
+        channel_data_log[i].current_ua = current;
+        channel_data_log[i].power_uw = power;
+        channel_data_log[i].timestamp = (uint32_t)window->last.uptime_ms;
+
+        channels[i]->voltage_uv = voltage;
+        channels[i]->current_ua = current;
+        channels[i]->power_uw = power;
+        channels[i]->voltage_min_uv = window->voltage_min[i];
+        channels[i]->voltage_max_uv = window->voltage_max[i];
+        channels[i]->current_min_ua = window->current_min[i];
+        channels[i]->current_max_ua = window->current_max[i];
+        channels[i]->current_rms_ua = (int32_t)isqrt64(window->current_sq_sum[i] / window->count);
+        channels[i]->power_max_uw = (int32_t)(window->power_max[i] / 1000000);
+        channels[i]->charge_uah = energy.charge_uc[i] / 3600;
+        channels[i]->energy_uwh = energy.energy_uj[i] / 3600;
+    }
+    fill_legacy_channels(sensor_data);
+
+    datalog_add(window->last.uptime_ms, channel_data_log);
 
-    SensorChannelData* channels[] = {&sensor_data->usb, &sensor_data->main, &sensor_data->vin};
+    sensor_data->timestamp_ms = window->last.timestamp_ms;
+    sensor_data->uptime_ms = window->last.uptime_ms;
+    sensor_data->sample_count = window->count;
+    sensor_data->sequence = window->last.sequence;
+    sensor_data->acquired_us = (uint64_t)window->last.acquired_us;
+    sensor_data->dropped_frames = ws_get_dropped_frames();
+    portENTER_CRITICAL(&sample_ring_lock);
+    sensor_data->dropped_samples = dropped_samples;
+    portEXIT_CRITICAL(&sample_ring_lock);
+
+    send_status_message(&message);
+}
+
+static void flush_sensor_batch()
+{
+    send_sensor_batch(&batch);
+    batch.count = 0;
+}
+
+static void batch_add(const struct sensor_sample* sample)
+{
+    // a batch only holds consecutive conversions, so the client can tell where samples went missing
+    if (batch.count > 0 && sample->sequence != batch.base_sequence + batch.count)
+        flush_sensor_batch();
+
+    if (batch.count == 0)
+    {
+        batch.timestamp_ms = sample->timestamp_ms;
+        batch.base_us = sample->acquired_us;
+        batch.base_sequence = sample->sequence;
+    }
+
+    uint32_t n = batch.count++;
+    batch.offset_us[n] = (int32_t)(sample->acquired_us - batch.base_us);
+    for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+    {
+        batch.voltage_mv[i][n] = sample->voltage_uv[i] / 1000;
+        batch.current_ma[i][n] = sample->current_ua[i] / 1000;
+    }
+
+    if (batch.count == SENSOR_BATCH_MAX)
+        flush_sensor_batch();
+}
+
+// Queues an INA3221 conversion setting change for the acquisition task: fast = no averaging, shortest times
+static void request_conversion_config(bool fast)
+{
+    ina3221_config_t config = requested_config;
+
+    if (fast)
+    {
+        // no averaging and the shortest conversion time whose period still covers the bus time per sample,
+        // otherwise the INA3221 overwrites conversions before they are read
+        uint32_t bus_us = sample_bus_time_us(true);
+        config.avg = INA3221_AVG_1;
+        for (uint8_t ct = INA3221_CT_140; ct <= INA3221_CT_8244; ct++)
+        {
+            config.vbus = ct;
+            config.vsht = ct;
+            if (conversion_period_us(&config) >= bus_us)
+                break;
+        }
+    }
+    else
+    {
+        config.avg = normal_avg;
+        config.vbus = normal_vbus;
+        config.vsht = normal_vsht;
+    }
+
+    requested_config = config;
+    // each sample costs seven register reads, about 3.6ms at 100kHz, which would hold the fast modes far
+    // below the conversion rate
+    requested_clk_hz = fast ? fast_clk_hz() : normal_clk_hz;
+    config_pending = true;
+}
+
+void monitor_update_conversion_mode()
+{
+    // capture mode, the adaptive fast rate, an armed scope and a boot profile all want the hardware rate
+    bool fast = capture_mode || adaptive_fast || scope_is_sampling() || profile_is_running();
+
+    portENTER_CRITICAL(&config_lock);
+    if (fast != conversion_fast)
+    {
+        conversion_fast = fast;
+        request_conversion_config(fast);
+    }
+    portEXIT_CRITICAL(&config_lock);
+}
+
+static bool adaptive_sample_changed(const struct adaptive_state* state, const struct sensor_sample* sample)
+{
+    if (!state->reference_valid)
+        return false;
 
     for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
     {
-        float voltage, current, power;
-        ina3221_get_bus_voltage(&ina3221, i, &voltage);
-        ina3221_get_shunt_value(&ina3221, i, NULL, &current);
+        int32_t delta = sample->current_ua[i] - state->reference_ua[i];
+        if (delta > adaptive_threshold_ua || delta < -adaptive_threshold_ua)
+            return true;
+    }
+    return false;
+}
+
+// Moves between the fast and heartbeat rates, returns true when the fast rate was just entered
+static bool adaptive_update(struct adaptive_state* state, bool changed)
+{
+    TickType_t now = xTaskGetTickCount();
+
+    if (!adaptive_enabled)
+    {
+        if (state->active)
+        {
+            adaptive_fast = false;
+            monitor_update_conversion_mode();
+        }
+        state->active = false;
+        state->reference_valid = false;
+        return false;
+    }
+
+    if (changed)
+    {
+        state->last_activity = now;
+        if (!state->active)
+        {
+            state->active = true;
+            adaptive_fast = true;
+            monitor_update_conversion_mode();
+            return true;
+        }
+    }
+    else if (state->active && now - state->last_activity >= pdMS_TO_TICKS(ADAPTIVE_HOLD_MS))
+    {
+        state->active = false;
+        adaptive_fast = false;
+        monitor_update_conversion_mode();
+    }
+    return false;
+}
+
+static uint32_t current_publish_period_ms(const struct adaptive_state* state)
+{
+    if (!adaptive_enabled)
+        return publish_period_ms;
+    return state->active ? ADAPTIVE_FAST_PERIOD_MS : ADAPTIVE_HEARTBEAT_MS;
+}
+
+static void arm_sensor_timer(int64_t delay_us)
+{
+    sensor_next_fire_us = esp_timer_get_time() + delay_us;
+    esp_timer_start_once(sensor_timer, delay_us);
+}
+
+// Runs on the shared esp_timer task, so it only records dispatch timing and wakes the acquisition task
+static void sensor_timer_callback(void* arg)
+{
+    int64_t now = esp_timer_get_time();
+
+    int64_t late = now - sensor_next_fire_us;
+    if (late < 0)
+        late = 0;
+
+    if (acquisition_task_handle != NULL)
+        xTaskNotifyGive(acquisition_task_handle);
+
+    int64_t busy = esp_timer_get_time() - now;
+
+    portENTER_CRITICAL(&timing_lock);
+    if (late > timing.timer_latency_max_us)
+        timing.timer_latency_max_us = late;
+    timing.timer_latency_sum_us += late;
+    timing.timer_ticks++;
+    if (busy > timing.timer_busy_max_us)
+        timing.timer_busy_max_us = busy;
+    portEXIT_CRITICAL(&timing_lock);
+}
+
+// Opens the load switch of every channel that has been above its trip limit for trip_samples conversions
+static void fast_trip_check(const struct sensor_sample* sample)
+{
+    uint8_t channels = 0;
+    uint8_t which = 0;
+
+    for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+    {
+        int32_t limit = trip_limit_ua[i];
+        if (limit == 0 || sample->current_ua[i] <= limit)
+        {
+            trip_count[i] = 0;
+            continue;
+        }
+        if (++trip_count[i] < trip_samples)
+            continue;
+        trip_count[i] = 0;
+        channels |= BIT(i);
+        which |= trip_switches[i];
+    }
+    if (channels == 0)
+        return;
+
+    esp_err_t err = trip_load_switches(which);
+    if (err == ESP_ERR_INVALID_STATE)
+        return; // nothing was on, e.g. current flowing while the switch is already open
+
+    int64_t latency = esp_timer_get_time() - sample->acquired_us;
+    if (err == ESP_OK)
+    {
+        portENTER_CRITICAL(&timing_lock);
+        timing.fast_trips++;
+        timing.fast_trip_latency_last_us = latency;
+        if (latency > timing.fast_trip_latency_max_us)
+            timing.fast_trip_latency_max_us = latency;
+        portEXIT_CRITICAL(&timing_lock);
+    }
+
+    if (!trip_pending)
+    {
+        last_trip.channels = channels;
+        memcpy(last_trip.current_ua, sample->current_ua, sizeof(last_trip.current_ua));
+        last_trip.latency_us = latency;
+        last_trip.result = err;
+        trip_pending = true;
+    }
+    xTaskNotifyGive(publish_task_handle);
+}
+
+static void report_fast_trip()
+{
+    static const char* const names[] = {"USB", "MAIN", "VIN"}; // ina3221_channel_t order
+
+    struct fast_trip trip = last_trip;
+    trip_pending = false;
+
+    for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+    {
+        if (!(trip.channels & BIT(i)))
+            continue;
+        if (trip.result == ESP_OK)
+            push_eventf(EV_CRITICAL, "fast trip: %s %" PRId32 "mA over %" PRId32 "mA for %u samples, off after %" PRId64
+                        "us", names[i], trip.current_ua[i] / 1000, trip_limit_ua[i] / 1000, trip_samples,
+                        trip.latency_us);
+        else
+            push_eventf(EV_FATAL, "fast trip: %s %" PRId32 "mA, load switch write failed: %s", names[i],
+                        trip.current_ua[i] / 1000, esp_err_to_name(trip.result));
+    }
+    send_sw_status_message();
+}
+
+/*
+ * Conversion-ready driven acquisition. The INA3221 runs in continuous mode; the task sleeps for
+ * most of one conversion period, then polls CVRF and reads the result registers only when a new
+ * conversion has completed. A conversion is never read twice, but one the INA3221 overwrites before it
+ * is read (bus time longer than the period, a delayed task) is lost; the number of conversion periods
+ * between two reads tells how many, and the sequence number skips over them.
+ */
+static void sensor_acquisition_task(void* pvParameters)
+{
+    struct sensor_sample sample;
+    struct sensor_raw raw;
+    ina3221_mask_t mask;
+    uint32_t sequence = 0;
+    int64_t last_read_us = 0; // 0 after a configuration change, nothing to count from
+    bool fast = false; // the fast conversion setting and I2C clock are applied
+
+    uint32_t period_us = conversion_period_us(&ina3221.config);
+    uint32_t poll_us = period_us / 16 > SENSOR_MIN_POLL_US ? period_us / 16 : SENSOR_MIN_POLL_US;
+
+    read_mask_register(&mask, I2C_BUS_PRIO_SAMPLE); // discard a conversion that completed before we started
+    arm_sensor_timer(period_us);
+
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        if (config_pending)
+        {
+            portENTER_CRITICAL(&config_lock);
+            config_pending = false;
+            ina3221.config = requested_config;
+            uint32_t clk_hz = requested_clk_hz;
+            fast = conversion_fast;
+            portEXIT_CRITICAL(&config_lock);
+            if (sensor_set_bus_clock(&ina3221, clk_hz) != ESP_OK)
+                ESP_LOGE(TAG, "Failed to set INA3221 I2C clock");
+            if (i2c_bus_run(I2C_BUS_INA3221, I2C_BUS_PRIO_CONFIG, bus_sync, NULL) != ESP_OK)
+                ESP_LOGE(TAG, "Failed to apply INA3221 configuration");
+
+            period_us = conversion_period_us(&ina3221.config);
+            poll_us = period_us / 16 > SENSOR_MIN_POLL_US ? period_us / 16 : SENSOR_MIN_POLL_US;
+            ESP_LOGI(TAG, "INA3221 conversion period now %" PRIu32 "us, I2C at %" PRIu32 "Hz", period_us, clk_hz);
+
+            read_mask_register(&mask, I2C_BUS_PRIO_SAMPLE);
+            arm_sensor_timer(period_us);
+            last_read_us = 0;
+            continue;
+        }
+
+        if (calibration_pending)
+        {
+            portENTER_CRITICAL(&config_lock);
+            calibration_pending = false;
+            memcpy(calibration, requested_calibration, sizeof(calibration));
+            portEXIT_CRITICAL(&config_lock);
+        }
+
+        int64_t poll_start = esp_timer_get_time();
+        if (read_mask_register(&mask, I2C_BUS_PRIO_SAMPLE) != ESP_OK || !mask.cvrf)
+        {
+            portENTER_CRITICAL(&timing_lock);
+            timing.not_ready_polls++;
+            portEXIT_CRITICAL(&timing_lock);
+            arm_sensor_timer(poll_us);
+            continue;
+        }
+
+        int64_t start = esp_timer_get_time();
+        uint32_t conversions = 1;
+        if (last_read_us != 0)
+        {
+            int64_t periods = (start - last_read_us + period_us / 2) / period_us;
+            if (periods > 1)
+                conversions = periods > UINT16_MAX ? UINT16_MAX : (uint32_t)periods;
+        }
+        last_read_us = start;
+        sequence += conversions;
+        sample.sequence = sequence;
+        if (conversions > 1)
+        {
+            portENTER_CRITICAL(&sample_ring_lock);
+            dropped_samples += conversions - 1;
+            portEXIT_CRITICAL(&sample_ring_lock);
+        }
+
+        esp_err_t err = read_sensor_sample(&sample, &raw);
+        int64_t elapsed = esp_timer_get_time() - start;
+        portENTER_CRITICAL(&timing_lock);
+        timing.skipped_conversions += conversions - 1;
+        if (elapsed > timing.acquisition_max_us)
+            timing.acquisition_max_us = elapsed;
+        if (err != ESP_OK)
+            timing.read_errors++;
+        else
+            timing.conversions++;
+        portEXIT_CRITICAL(&timing_lock);
+
+        // next conversion completes one period after this one did
+        int64_t next = (int64_t)period_us - elapsed - poll_us;
+        arm_sensor_timer(next > 0 ? next : poll_us);
 
-        current /= 1000.0f; // mA to A
-        power = voltage * current;
+        if (err == ESP_OK)
+        {
+            uint32_t bus_us = (uint32_t)(start + elapsed - poll_start);
+            uint32_t avg_us = sample_bus_us[fast];
+            sample_bus_us[fast] = avg_us ? avg_us - avg_us / 8 + bus_us / 8 : bus_us;
+
+            // the estimate the fast setting was chosen with was too low, move to a longer conversion time
+            if (fast && period_us < sample_bus_us[fast])
+            {
+                portENTER_CRITICAL(&config_lock);
+                if (conversion_fast && !config_pending)
+                    request_conversion_config(true);
+                portEXIT_CRITICAL(&config_lock);
+            }
+        }
 
-        // For protobuf
-        channels[i]->voltage = voltage;
-        channels[i]->current = current;
-        channels[i]->power = power;
+        if (err != ESP_OK)
+        {
+            portENTER_CRITICAL(&sample_ring_lock);
+            dropped_samples++;
+            portEXIT_CRITICAL(&sample_ring_lock);
+            continue;
+        }
+        fast_trip_check(&sample);
+        watchdog_sample(sample.acquired_us, sample.current_ua);
+        energy_add(sample.acquired_us, sample.voltage_uv, sample.current_ua);
+
+        portENTER_CRITICAL(&last_sample_lock);
+        memcpy(last_current_ua, sample.current_ua, sizeof(last_current_ua));
+        last_acquired_us = sample.acquired_us;
+        portEXIT_CRITICAL(&last_sample_lock);
+
+        portENTER_CRITICAL(&measure_lock);
+        if (measure_remaining > 0)
+        {
+            for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+                measure_raw_sum[i] += raw.shunt[i];
+            measure_count++;
+            measure_remaining--;
+        }
+        portEXIT_CRITICAL(&measure_lock);
+
+        // a finished scope capture no longer needs the hardware rate
+        if (scope_feed(sample.acquired_us, sample.voltage_uv, sample.current_ua))
+            monitor_update_conversion_mode();
+        if (profile_feed(sample.acquired_us, sample.voltage_uv, sample.current_ua))
+        {
+            monitor_update_conversion_mode();
+            xTaskNotifyGive(publish_task_handle);
+        }
+
+        // the publisher wakes on its own at every publish period, only hurry it when the ring fills up
+        if (sample_ring_push(&sample) >= SAMPLE_RING_SIZE / 2)
+            xTaskNotifyGive(publish_task_handle);
     }
+}
+
+static void sensor_publish_task(void* pvParameters)
+{
+    struct sensor_sample sample;
+    struct sensor_window window = {0};
+    struct adaptive_state adaptive = {0};
+    TickType_t last_publish = xTaskGetTickCount();
+
+    while (1)
+    {
+        TickType_t elapsed = xTaskGetTickCount() - last_publish;
+        TickType_t period = pdMS_TO_TICKS(current_publish_period_ms(&adaptive));
+        TickType_t wait = elapsed < period ? period - elapsed : 0;
+        // while waiting for the heartbeat, still look at the signal often enough to catch a change
+        if (adaptive_enabled && wait > pdMS_TO_TICKS(ADAPTIVE_FAST_PERIOD_MS))
+            wait = pdMS_TO_TICKS(ADAPTIVE_FAST_PERIOD_MS);
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        if (trip_pending)
+            report_fast_trip();
+        profile_report();
 
-    // datalog_add(timestamp, channel_data_log);
+        bool changed = false;
+        bool streaming = capture_mode;
+        while (sample_ring_pop(&sample))
+        {
+            if (streaming)
+                batch_add(&sample);
+            window_add(&window, &sample);
+            stats_add(sample.acquired_us, sample.voltage_uv, sample.current_ua);
+            if (adaptive_enabled && adaptive_sample_changed(&adaptive, &sample))
+                changed = true;
+        }
 
-    sensor_data->timestamp_ms = timestamp_ms;
-    sensor_data->uptime_ms = uptime_ms;
+        // a partly filled batch waits for the next wake-up, unless capture mode has just been turned off
+        if (!streaming && batch.count > 0)
+            flush_sensor_batch();
 
-    send_pb_message(StatusMessage_fields, &message);
+        // publish the edge of a transient right away instead of at the end of the heartbeat
+        bool edge = adaptive_update(&adaptive, changed);
+        if (!edge && xTaskGetTickCount() - last_publish < pdMS_TO_TICKS(current_publish_period_ms(&adaptive)))
+            continue;
+
+        last_publish = xTaskGetTickCount();
+        if (window.count > 0)
+        {
+            publish_sensor_window(&window);
+            if (adaptive_enabled)
+            {
+                for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+                    adaptive.reference_ua[i] = (int32_t)(window.current_sum[i] / window.count);
+                adaptive.reference_valid = true;
+            }
+            memset(&window, 0, sizeof(window));
+        }
+        energy_checkpoint(false);
+    }
 }
 
 static void status_wifi_callback(void* arg)
@@ -131,7 +949,7 @@ static void status_wifi_callback(void* arg)
         wifi_status->ip_address.arg = ""; // Empty string
     }
 
-    send_pb_message(StatusMessage_fields, &message);
+    send_status_message(&message);
 }
 
 // Placeholder for long press action
@@ -160,14 +978,30 @@ static void shutdown_load_sw_task(void* pvParameters)
 
         ESP_LOGW(TAG, "critical interrupt triggered (via task)");
         gpio_set_level(PM_EXPANDER_RST, 0);
-        ina3221_get_status(&ina3221);
+
+        int64_t isr_us = critical_isr_us;
+        int64_t latency = isr_us != 0 ? esp_timer_get_time() - isr_us : 0;
+        critical_isr_us = 0;
+        if (isr_us != 0)
+        {
+            portENTER_CRITICAL(&timing_lock);
+            timing.critical_alerts++;
+            timing.critical_latency_last_us = latency;
+            if (latency > timing.critical_latency_max_us)
+                timing.critical_latency_max_us = latency;
+            portEXIT_CRITICAL(&timing_lock);
+        }
+        i2c_bus_run(I2C_BUS_INA3221, I2C_BUS_PRIO_SWITCH, bus_get_status, NULL);
         vTaskDelay(100 / portTICK_PERIOD_MS);
         gpio_set_level(PM_EXPANDER_RST, 1);
         config_sw();
 
-        uint16_t cf = ina3221.mask.cf; // order : channel1:channel2:channel3
+        // the acquisition task may have consumed the latched flags while polling for conversion-ready
+        // order : channel1:channel2:channel3
+        uint16_t cf = ina3221.mask.cf | take_pending_flags(&pending_critical_flags);
 
-        push_eventf(EV_CRITICAL, "load switch disabled");
+        scope_notify_switch();
+        push_eventf(EV_CRITICAL, "load switch disabled %" PRId64 "us after the alert", latency);
 
         if (cf & BIT0) // CH3 VIN
             push_eventf(EV_CRITICAL, "critical fault detected: VIN");
@@ -183,11 +1017,64 @@ static void shutdown_load_sw_task(void* pvParameters)
     }
 }
 
+static void warning_alert_task(void* pvParameters)
+{
+    static const char* const names[] = {"VIN", "MAIN", "USB"}; // flag order : channel3:channel2:channel1
+    int64_t last_event_us[INA3221_BUS_NUMBER] = {0};
+    ina3221_mask_t mask;
+
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        int64_t isr_us = warning_isr_us;
+        warning_isr_us = 0;
+
+        // the acquisition task may already have read (and cleared) the flags
+        read_mask_register(&mask, I2C_BUS_PRIO_CONFIG);
+        uint8_t wf = take_pending_flags(&pending_warning_flags);
+
+        int64_t now = esp_timer_get_time();
+        bool pushed = false;
+        for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+        {
+            if (!(wf & BIT(i)) || (last_event_us[i] != 0 && now - last_event_us[i] < WARNING_EVENT_HOLDOFF_US))
+                continue;
+            last_event_us[i] = now;
+            push_eventf(EV_WARNING, "current warning: %s", names[i]);
+            pushed = true;
+        }
+
+        if (pushed && isr_us != 0)
+        {
+            int64_t latency = esp_timer_get_time() - isr_us;
+            portENTER_CRITICAL(&timing_lock);
+            timing.warning_alerts++;
+            timing.warning_latency_sum_us += latency;
+            if (latency > timing.warning_latency_max_us)
+                timing.warning_latency_max_us = latency;
+            portEXIT_CRITICAL(&timing_lock);
+        }
+    }
+}
+
+static void IRAM_ATTR warning_isr_handler(void* arg)
+{
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    if (warning_isr_us == 0)
+        warning_isr_us = esp_timer_get_time();
+    if (warning_task_handle != NULL)
+        vTaskNotifyGiveFromISR(warning_task_handle, &xHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
 static void IRAM_ATTR critical_isr_handler(void* arg)
 {
     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
     if (gpio_get_level(PM_INT_CRITICAL) == 0) // Falling edge
     {
+        if (critical_isr_us == 0)
+            critical_isr_us = esp_timer_get_time();
         if (shutdown_task_handle != NULL)
         {
             vTaskNotifyGiveFromISR(shutdown_task_handle, &xHigherPriorityTaskWoken);
@@ -209,58 +1096,199 @@ static void gpio_init()
     gpio_install_isr_service(0);
     gpio_isr_handler_add(PM_INT_CRITICAL, critical_isr_handler, (void*)PM_INT_CRITICAL);
 
+    // warning int, asserted (low) while an averaged measurement is above its warning limit
+    gpio_set_intr_type(PM_INT_WARNING, GPIO_INTR_NEGEDGE);
+    gpio_set_direction(PM_INT_WARNING, GPIO_MODE_INPUT);
+    gpio_isr_handler_add(PM_INT_WARNING, warning_isr_handler, (void*)PM_INT_WARNING);
+
     // rst expander
     gpio_set_level(PM_EXPANDER_RST, 1);
     gpio_set_direction(PM_EXPANDER_RST, GPIO_MODE_OUTPUT);
 }
 
-esp_err_t climit_set_vin(double value)
+// Parses a current limit stored as decimal amps ("3.50") into milliamps
+static uint32_t parse_limit_ma(const char* str)
 {
-    float lim = (float)(value * 1000);
-    ESP_LOGI(TAG, "Setting VIN current limit to: %fmA", lim);
-    if (value > 0.0f)
-        return ina3221_set_critical_alert(&ina3221, CHANNEL_VIN, lim);
-    return ina3221_set_critical_alert(&ina3221, CHANNEL_VIN, (15.0f * 1000.0f));
+    uint32_t ma = 0;
+    uint32_t scale = 1000;
+
+    while (*str >= '0' && *str <= '9')
+        ma = ma * 10 + (*str++ - '0');
+    ma *= 1000;
+    if (*str == '.')
+    {
+        str++;
+        while (scale > 1 && *str >= '0' && *str <= '9')
+        {
+            scale /= 10;
+            ma += (*str++ - '0') * scale;
+        }
+    }
+    return ma;
 }
 
-esp_err_t climit_set_main(double value)
+static esp_err_t climit_set(const char* name, ina3221_channel_t channel, uint32_t milliamps)
 {
-    float lim = (float)(value * 1000);
-    ESP_LOGI(TAG, "Setting MAIN current limit to: %fmA", lim);
-    if (value > 0.0f)
-        return ina3221_set_critical_alert(&ina3221, CHANNEL_MAIN, lim);
-    return ina3221_set_critical_alert(&ina3221, CHANNEL_VIN, (15.0f * 1000.0f));
+    ESP_LOGI(TAG, "Setting %s current limit to: %" PRIu32 "mA", name, milliamps);
+    struct alert_limit limit = {
+        .channel = channel, .milliamps = milliamps > 0 ? milliamps : CLIMIT_DISABLED_MA, .critical = true};
+    return i2c_bus_run(I2C_BUS_INA3221, I2C_BUS_PRIO_CONFIG, bus_set_alert_limit, &limit);
 }
 
-esp_err_t climit_set_usb(double value)
+esp_err_t climit_set_vin(uint32_t milliamps) { return climit_set("VIN", CHANNEL_VIN, milliamps); }
+
+esp_err_t climit_set_main(uint32_t milliamps) { return climit_set("MAIN", CHANNEL_MAIN, milliamps); }
+
+esp_err_t climit_set_usb(uint32_t milliamps) { return climit_set("USB", CHANNEL_USB, milliamps); }
+
+static esp_err_t climit_set_warning(const char* name, ina3221_channel_t channel, uint32_t milliamps)
 {
-    float lim = (float)(value * 1000);
-    ESP_LOGI(TAG, "Setting USB current limit to: %fmA", lim);
-    if (value > 0.0f)
-        return ina3221_set_critical_alert(&ina3221, CHANNEL_USB, lim);
-    return ina3221_set_critical_alert(&ina3221, CHANNEL_VIN, (15.0f * 1000.0f));
+    ESP_LOGI(TAG, "Setting %s current warning to: %" PRIu32 "mA", name, milliamps);
+    struct alert_limit limit = {
+        .channel = channel, .milliamps = milliamps > 0 ? milliamps : WLIMIT_DISABLED_MA, .critical = false};
+    return i2c_bus_run(I2C_BUS_INA3221, I2C_BUS_PRIO_CONFIG, bus_set_alert_limit, &limit);
+}
+
+esp_err_t climit_set_vin_warning(uint32_t milliamps) { return climit_set_warning("VIN", CHANNEL_VIN, milliamps); }
+
+esp_err_t climit_set_main_warning(uint32_t milliamps) { return climit_set_warning("MAIN", CHANNEL_MAIN, milliamps); }
+
+esp_err_t climit_set_usb_warning(uint32_t milliamps) { return climit_set_warning("USB", CHANNEL_USB, milliamps); }
+
+static esp_err_t climit_set_trip(const char* name, ina3221_channel_t channel, uint32_t milliamps)
+{
+    ESP_LOGI(TAG, "Setting %s fast-trip limit to: %" PRIu32 "mA", name, milliamps);
+    trip_limit_ua[channel] = (int32_t)milliamps * 1000;
+    return ESP_OK;
+}
+
+esp_err_t climit_set_vin_trip(uint32_t milliamps) { return climit_set_trip("VIN", CHANNEL_VIN, milliamps); }
+
+esp_err_t climit_set_main_trip(uint32_t milliamps) { return climit_set_trip("MAIN", CHANNEL_MAIN, milliamps); }
+
+esp_err_t climit_set_usb_trip(uint32_t milliamps) { return climit_set_trip("USB", CHANNEL_USB, milliamps); }
+
+esp_err_t climit_set_trip_samples(uint8_t samples)
+{
+    if (samples < 1 || samples > TRIP_SAMPLES_MAX)
+        return ESP_ERR_INVALID_ARG;
+    trip_samples = samples;
+    return ESP_OK;
+}
+
+uint8_t climit_get_trip_samples() { return trip_samples; }
+
+static int table_index(const uint16_t* table, int count, long value)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (table[i] == value)
+            return i;
+    }
+    return -1;
+}
+
+static void load_conversion_setting()
+{
+    char buf[10];
+    int avg = -1, vbus = -1, vsht = -1;
+
+    if (nconfig_read(SENSOR_AVERAGING, buf, sizeof(buf)) == ESP_OK)
+        avg = table_index(avg_count, 8, strtol(buf, NULL, 10));
+    if (nconfig_read(SENSOR_BUS_CT, buf, sizeof(buf)) == ESP_OK)
+        vbus = table_index(ct_us, 8, strtol(buf, NULL, 10));
+    if (nconfig_read(SENSOR_SHUNT_CT, buf, sizeof(buf)) == ESP_OK)
+        vsht = table_index(ct_us, 8, strtol(buf, NULL, 10));
+
+    if (avg < 0 || vbus < 0 || vsht < 0)
+    {
+        ESP_LOGW(TAG, "Invalid stored conversion setting, using defaults");
+        return;
+    }
+    normal_avg = avg;
+    normal_vbus = vbus;
+    normal_vsht = vsht;
+}
+
+// Parses "<gain_ppm>,<offset_ua>", falling back to unity for anything out of range
+static void parse_calibration(const char* str, struct current_calibration* cal)
+{
+    char* end;
+    long gain = strtol(str, &end, 10);
+    long offset = *end == ',' ? strtol(end + 1, NULL, 10) : 0;
+
+    if (gain < CALIBRATION_GAIN_MIN_PPM || gain > CALIBRATION_GAIN_MAX_PPM || offset < -CALIBRATION_OFFSET_MAX_UA ||
+        offset > CALIBRATION_OFFSET_MAX_UA)
+    {
+        gain = 1000000;
+        offset = 0;
+    }
+    cal->gain_ppm = gain;
+    cal->offset_ua = offset;
+}
+
+static void load_calibration()
+{
+    char buf[24];
+
+    for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+    {
+        if (nconfig_read(calibration_keys[i], buf, sizeof(buf)) != ESP_OK)
+            buf[0] = '\0';
+        parse_calibration(buf, &calibration_settings[i]);
+        calibration_from_settings(i, &calibration_settings[i], &calibration[i]);
+        ESP_LOGI(TAG, "CH%d calibration: gain %" PRId32 "ppm, offset %" PRId32 "uA", i + 1,
+                 calibration_settings[i].gain_ppm, calibration_settings[i].offset_ua);
+    }
+    memcpy(requested_calibration, calibration, sizeof(calibration));
 }
 
 void init_status_monitor()
 {
     gpio_init();
+    load_conversion_setting();
+    ina3221.config.avg = normal_avg;
+    ina3221.config.vbus = normal_vbus;
+    ina3221.config.vsht = normal_vsht;
     ESP_ERROR_CHECK(ina3221_init_desc(&ina3221, 0x40, 0, PM_SDA, PM_SCL));
-    ESP_ERROR_CHECK(ina3221_sync(&ina3221));
+    normal_clk_hz = ina3221.i2c_dev.cfg.master.clk_speed;
+    requested_clk_hz = normal_clk_hz;
+    ESP_ERROR_CHECK(i2c_bus_run(I2C_BUS_INA3221, I2C_BUS_PRIO_CONFIG, bus_sync, NULL));
+    requested_config = ina3221.config;
+    load_calibration();
+    energy_init();
 
-    double lim;
     char buf[10];
 
     nconfig_read(VIN_CURRENT_LIMIT, buf, sizeof(buf));
-    lim = atof(buf);
-    climit_set_vin(lim);
+    climit_set_vin(parse_limit_ma(buf));
 
     nconfig_read(MAIN_CURRENT_LIMIT, buf, sizeof(buf));
-    lim = atof(buf);
-    climit_set_main(lim);
+    climit_set_main(parse_limit_ma(buf));
 
     nconfig_read(USB_CURRENT_LIMIT, buf, sizeof(buf));
-    lim = atof(buf);
-    climit_set_usb(lim);
+    climit_set_usb(parse_limit_ma(buf));
+
+    nconfig_read(VIN_WARNING_LIMIT, buf, sizeof(buf));
+    climit_set_vin_warning(parse_limit_ma(buf));
+
+    nconfig_read(MAIN_WARNING_LIMIT, buf, sizeof(buf));
+    climit_set_main_warning(parse_limit_ma(buf));
+
+    nconfig_read(USB_WARNING_LIMIT, buf, sizeof(buf));
+    climit_set_usb_warning(parse_limit_ma(buf));
+
+    nconfig_read(VIN_TRIP_LIMIT, buf, sizeof(buf));
+    climit_set_vin_trip(parse_limit_ma(buf));
+
+    nconfig_read(MAIN_TRIP_LIMIT, buf, sizeof(buf));
+    climit_set_main_trip(parse_limit_ma(buf));
+
+    nconfig_read(USB_TRIP_LIMIT, buf, sizeof(buf));
+    climit_set_usb_trip(parse_limit_ma(buf));
+
+    nconfig_read(TRIP_SAMPLES, buf, sizeof(buf));
+    climit_set_trip_samples(strtol(buf, NULL, 10));
 
     const esp_timer_create_args_t sensor_timer_args = {.callback = &sensor_timer_callback,
                                                        .name = "sensor_reading_timer"};
@@ -274,15 +1302,25 @@ void init_status_monitor()
 
     xTaskCreate(shutdown_load_sw_task, "shutdown_sw_task", configMINIMAL_STACK_SIZE * 3, NULL, 15,
                 &shutdown_task_handle);
+    xTaskCreate(warning_alert_task, "warning_task", configMINIMAL_STACK_SIZE * 3, NULL, 13, &warning_task_handle);
 
     nconfig_read(SENSOR_PERIOD_MS, buf, sizeof(buf));
-    ESP_ERROR_CHECK(esp_timer_start_periodic(sensor_timer, strtol(buf, NULL, 10) * 1000));
+    publish_period_ms = strtol(buf, NULL, 10);
+    nconfig_read(SENSOR_ADAPTIVE_THRESHOLD, buf, sizeof(buf));
+    adaptive_threshold_ua = strtol(buf, NULL, 10) * 1000;
+    nconfig_read(SENSOR_ADAPTIVE, buf, sizeof(buf));
+    adaptive_enabled = strcmp(buf, "1") == 0;
+    ESP_LOGI(TAG, "INA3221 conversion period %" PRIu32 "us, publish period %" PRIu32 "ms",
+             conversion_period_us(&ina3221.config), publish_period_ms);
     ESP_ERROR_CHECK(esp_timer_start_periodic(wifi_status_timer, 1000000 * 5));
+
+    xTaskCreate(sensor_publish_task, "sensor_pub_task", 1024 * 4, NULL, 5, &publish_task_handle);
+    xTaskCreate(sensor_acquisition_task, "sensor_acq_task", 1024 * 3, NULL, 14, &acquisition_task_handle);
 }
 
 esp_err_t update_sensor_period(int period)
 {
-    if (period < 100 || period > 10000) // 0.1 sec ~ 10 sec
+    if (period < SENSOR_PERIOD_MIN_MS || period > SENSOR_PERIOD_MAX_MS)
     {
         return ESP_ERR_INVALID_ARG;
     }
@@ -294,6 +1332,337 @@ esp_err_t update_sensor_period(int period)
         return err;
     }
 
-    esp_timer_stop(sensor_timer);
-    return esp_timer_start_periodic(sensor_timer, period * 1000);
+    publish_period_ms = period;
+    return ESP_OK;
+}
+
+esp_err_t monitor_set_capture_mode(bool enable)
+{
+    ESP_LOGI(TAG, "High-rate capture mode %s", enable ? "on" : "off");
+    capture_mode = enable;
+    monitor_update_conversion_mode();
+    return ESP_OK;
+}
+
+bool monitor_get_capture_mode() { return capture_mode; }
+
+esp_err_t monitor_set_adaptive(bool enable, int threshold_ma)
+{
+    if (threshold_ma < ADAPTIVE_THRESHOLD_MIN_MA || threshold_ma > ADAPTIVE_THRESHOLD_MAX_MA)
+        return ESP_ERR_INVALID_ARG;
+
+    char buf[10];
+    sprintf(buf, "%d", threshold_ma);
+    esp_err_t err = nconfig_write(SENSOR_ADAPTIVE_THRESHOLD, buf);
+    if (err != ESP_OK)
+        return err;
+    err = nconfig_write(SENSOR_ADAPTIVE, enable ? "1" : "0");
+    if (err != ESP_OK)
+        return err;
+
+    ESP_LOGI(TAG, "Adaptive sensor rate %s, threshold %dmA", enable ? "on" : "off", threshold_ma);
+    adaptive_threshold_ua = threshold_ma * 1000;
+    adaptive_enabled = enable;
+    return ESP_OK;
+}
+
+bool monitor_get_adaptive(int* threshold_ma)
+{
+    if (threshold_ma)
+        *threshold_ma = adaptive_threshold_ua / 1000;
+    return adaptive_enabled;
+}
+
+esp_err_t monitor_check_conversion(const struct conversion_setting* setting)
+{
+    if (table_index(avg_count, 8, setting->averaging) < 0 || table_index(ct_us, 8, setting->bus_ct_us) < 0 ||
+        table_index(ct_us, 8, setting->shunt_ct_us) < 0)
+        return ESP_ERR_INVALID_ARG;
+    return ESP_OK;
+}
+
+esp_err_t monitor_set_conversion(const struct conversion_setting* setting)
+{
+    if (monitor_check_conversion(setting) != ESP_OK)
+        return ESP_ERR_INVALID_ARG;
+    int avg = table_index(avg_count, 8, setting->averaging);
+    int vbus = table_index(ct_us, 8, setting->bus_ct_us);
+    int vsht = table_index(ct_us, 8, setting->shunt_ct_us);
+
+    char buf[10];
+    sprintf(buf, "%u", setting->averaging);
+    esp_err_t err = nconfig_write(SENSOR_AVERAGING, buf);
+    if (err == ESP_OK)
+    {
+        sprintf(buf, "%u", setting->bus_ct_us);
+        err = nconfig_write(SENSOR_BUS_CT, buf);
+    }
+    if (err == ESP_OK)
+    {
+        sprintf(buf, "%u", setting->shunt_ct_us);
+        err = nconfig_write(SENSOR_SHUNT_CT, buf);
+    }
+    if (err != ESP_OK)
+        return err;
+
+    portENTER_CRITICAL(&config_lock);
+    normal_avg = avg;
+    normal_vbus = vbus;
+    normal_vsht = vsht;
+    // the fast modes keep their own setting, this one is picked up when they end
+    if (!conversion_fast)
+        request_conversion_config(false);
+    portEXIT_CRITICAL(&config_lock);
+
+    ESP_LOGI(TAG, "Conversion setting: %u averages, bus %uus, shunt %uus, max %" PRIu32 ".%03" PRIu32 "Hz",
+             setting->averaging, setting->bus_ct_us, setting->shunt_ct_us, monitor_get_max_sample_rate_mhz() / 1000,
+             monitor_get_max_sample_rate_mhz() % 1000);
+    return ESP_OK;
+}
+
+void monitor_get_conversion(struct conversion_setting* setting)
+{
+    setting->averaging = avg_count[normal_avg];
+    setting->bus_ct_us = ct_us[normal_vbus];
+    setting->shunt_ct_us = ct_us[normal_vsht];
+}
+
+uint32_t monitor_get_max_sample_rate_mhz()
+{
+    ina3221_config_t config = ina3221.config;
+    config.avg = normal_avg;
+    config.vbus = normal_vbus;
+    config.vsht = normal_vsht;
+
+    // a sample can be read no faster than its register reads take at the normal I2C clock
+    uint32_t period_us = conversion_period_us(&config);
+    uint32_t bus_us = sample_bus_time_us(false);
+    return (uint32_t)(1000000000ULL / (period_us > bus_us ? period_us : bus_us));
+}
+
+void monitor_get_calibration(ina3221_channel_t channel, struct current_calibration* cal)
+{
+    portENTER_CRITICAL(&config_lock);
+    *cal = calibration_settings[channel];
+    portEXIT_CRITICAL(&config_lock);
+}
+
+esp_err_t monitor_set_calibration(ina3221_channel_t channel, const struct current_calibration* cal)
+{
+    if (channel >= INA3221_BUS_NUMBER || cal->gain_ppm < CALIBRATION_GAIN_MIN_PPM ||
+        cal->gain_ppm > CALIBRATION_GAIN_MAX_PPM || cal->offset_ua < -CALIBRATION_OFFSET_MAX_UA ||
+        cal->offset_ua > CALIBRATION_OFFSET_MAX_UA)
+        return ESP_ERR_INVALID_ARG;
+
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%" PRId32 ",%" PRId32, cal->gain_ppm, cal->offset_ua);
+    esp_err_t err = nconfig_write(calibration_keys[channel], buf);
+    if (err != ESP_OK)
+        return err;
+
+    struct channel_calibration table;
+    calibration_from_settings(channel, cal, &table);
+
+    portENTER_CRITICAL(&config_lock);
+    calibration_settings[channel] = *cal;
+    requested_calibration[channel] = table;
+    calibration_pending = true;
+    portEXIT_CRITICAL(&config_lock);
+
+    ESP_LOGI(TAG, "CH%d calibration set: gain %" PRId32 "ppm, offset %" PRId32 "uA", channel + 1, cal->gain_ppm,
+             cal->offset_ua);
+    return ESP_OK;
+}
+
+esp_err_t monitor_measure_uncalibrated(ina3221_channel_t channel, uint32_t conversions, int32_t* current_ua)
+{
+    if (channel >= INA3221_BUS_NUMBER || conversions == 0 || conversions > CAL_MEASURE_MAX_CONVERSIONS)
+        return ESP_ERR_INVALID_ARG;
+
+    portENTER_CRITICAL(&measure_lock);
+    if (measure_remaining > 0)
+    {
+        portEXIT_CRITICAL(&measure_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    memset(measure_raw_sum, 0, sizeof(measure_raw_sum));
+    measure_count = 0;
+    measure_remaining = conversions;
+    portEXIT_CRITICAL(&measure_lock);
+
+    // up to 4096 conversions of up to ~50 s each, so the wait is worked out in 64 bits
+    uint64_t timeout_ms = (uint64_t)conversions * conversion_period_us(&ina3221.config) / 1000 + CAL_MEASURE_MARGIN_MS;
+    TickType_t timeout = (TickType_t)(timeout_ms * configTICK_RATE_HZ / 1000);
+    TickType_t start = xTaskGetTickCount();
+    for (;;)
+    {
+        portENTER_CRITICAL(&measure_lock);
+        if (measure_remaining == 0)
+            break;
+        if (xTaskGetTickCount() - start > timeout)
+        {
+            // the acquisition task stops adding once this is zero
+            measure_remaining = 0;
+            portEXIT_CRITICAL(&measure_lock);
+            return ESP_ERR_TIMEOUT;
+        }
+        portEXIT_CRITICAL(&measure_lock);
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    int64_t raw_sum = measure_raw_sum[channel];
+    uint32_t count = measure_count;
+    portEXIT_CRITICAL(&measure_lock);
+
+    *current_ua = (int32_t)(raw_sum * nominal_ua_per_count(channel) / count);
+    return ESP_OK;
+}
+
+struct bench_args
+{
+    uint32_t clk_hz;
+    int64_t elapsed_us;
+};
+
+static esp_err_t bus_bench(void* arg)
+{
+    struct bench_args* bench = arg;
+    return sensor_bench_read(&ina3221, bench->clk_hz, &bench->elapsed_us);
+}
+
+// One transaction per read: the timings exclude queueing, and switch transactions never wait behind the whole
+// run; debug use only
+esp_err_t monitor_bench_bus(uint32_t clk_hz, uint32_t iterations, struct sensor_bench_result* result)
+{
+    int64_t total = 0;
+
+    if (iterations == 0 || iterations > SENSOR_BENCH_MAX_ITERATIONS)
+        return ESP_ERR_INVALID_ARG;
+
+    *result = (struct sensor_bench_result){.clk_hz = clk_hz, .iterations = iterations, .min_us = INT64_MAX};
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        struct bench_args bench = {.clk_hz = clk_hz};
+        if (i2c_bus_run(I2C_BUS_INA3221, I2C_BUS_PRIO_SAMPLE, bus_bench, &bench) != ESP_OK)
+        {
+            result->errors++;
+            continue;
+        }
+        total += bench.elapsed_us;
+        if (bench.elapsed_us < result->min_us)
+            result->min_us = bench.elapsed_us;
+        if (bench.elapsed_us > result->max_us)
+            result->max_us = bench.elapsed_us;
+    }
+
+    if (result->errors == iterations)
+    {
+        ESP_LOGW(TAG, "All benchmark reads failed at %" PRIu32 "Hz", clk_hz);
+        return ESP_FAIL;
+    }
+    result->avg_us = total / (iterations - result->errors);
+    return ESP_OK;
+}
+
+// The per-conversion math as it was done in float before the switch to micro-units, kept for comparison
+struct float_window
+{
+    float voltage_sum[INA3221_BUS_NUMBER];
+    float voltage_min[INA3221_BUS_NUMBER];
+    float voltage_max[INA3221_BUS_NUMBER];
+    float current_sum[INA3221_BUS_NUMBER];
+    float current_sq_sum[INA3221_BUS_NUMBER];
+    float current_min[INA3221_BUS_NUMBER];
+    float current_max[INA3221_BUS_NUMBER];
+    float power_max[INA3221_BUS_NUMBER];
+    uint32_t count;
+};
+
+static void float_window_add(struct float_window* window, const struct sensor_raw* raw)
+{
+    for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+    {
+        float voltage = raw->bus[i] * (INA3221_BUS_LSB_MV / 1000.0f);
+        float current = raw->shunt[i] * (INA3221_SHUNT_LSB_UV / 1000.0f) / ina3221.shunt[i];
+        float power = voltage * current;
+
+        if (window->count == 0 || voltage < window->voltage_min[i])
+            window->voltage_min[i] = voltage;
+        if (window->count == 0 || voltage > window->voltage_max[i])
+            window->voltage_max[i] = voltage;
+        if (window->count == 0 || current < window->current_min[i])
+            window->current_min[i] = current;
+        if (window->count == 0 || current > window->current_max[i])
+            window->current_max[i] = current;
+        if (window->count == 0 || power > window->power_max[i])
+            window->power_max[i] = power;
+
+        window->voltage_sum[i] += voltage;
+        window->current_sum[i] += current;
+        window->current_sq_sum[i] += current * current;
+    }
+    window->count++;
+}
+
+esp_err_t monitor_bench_conversion(uint32_t iterations, struct conversion_bench_result* result)
+{
+    static struct float_window float_window;
+    static struct sensor_window fixed_window;
+    struct sensor_raw raw[8];
+    struct sensor_sample sample = {0};
+
+    if (iterations == 0)
+        return ESP_ERR_INVALID_ARG;
+
+    // a spread of plausible readings so neither path sees only constants
+    for (int i = 0; i < 8; i++)
+    {
+        for (int ch = 0; ch < INA3221_BUS_NUMBER; ch++)
+        {
+            raw[i].bus[ch] = (int16_t)(500 + i * 211 + ch * 97);
+            raw[i].shunt[ch] = (int16_t)(i * 173 + ch * 61 - 200);
+        }
+    }
+
+    memset(&float_window, 0, sizeof(float_window));
+    esp_cpu_cycle_count_t start = esp_cpu_get_cycle_count();
+    for (uint32_t i = 0; i < iterations; i++)
+        float_window_add(&float_window, &raw[i % 8]);
+    uint32_t float_cycles = esp_cpu_get_cycle_count() - start;
+
+    memset(&fixed_window, 0, sizeof(fixed_window));
+    start = esp_cpu_get_cycle_count();
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        sample_from_raw(&raw[i % 8], &sample);
+        window_add(&fixed_window, &sample);
+    }
+    uint32_t fixed_cycles = esp_cpu_get_cycle_count() - start;
+
+    result->iterations = iterations;
+    result->float_cycles = float_cycles / iterations;
+    result->fixed_cycles = fixed_cycles / iterations;
+    return ESP_OK;
+}
+
+int64_t monitor_get_last_current(int32_t current_ua[INA3221_BUS_NUMBER])
+{
+    portENTER_CRITICAL(&last_sample_lock);
+    memcpy(current_ua, last_current_ua, sizeof(last_current_ua));
+    int64_t acquired_us = last_acquired_us;
+    portEXIT_CRITICAL(&last_sample_lock);
+    return acquired_us;
+}
+
+void monitor_get_timing(struct monitor_timing* out)
+{
+    portENTER_CRITICAL(&timing_lock);
+    *out = timing;
+    portEXIT_CRITICAL(&timing_lock);
+}
+
+void monitor_reset_timing()
+{
+    portENTER_CRITICAL(&timing_lock);
+    memset(&timing, 0, sizeof(timing));
+    portEXIT_CRITICAL(&timing_lock);
 }
\ No newline at end of file
@@ -5,21 +5,165 @@
 #ifndef ODROID_REMOTE_HTTP_MONITOR_H
 #define ODROID_REMOTE_HTTP_MONITOR_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "esp_http_server.h"
+#include "sensor.h"
 
-#define SENSOR_BUFFER_SIZE 100
+#define SENSOR_BUFFER_SIZE 1024 // entries of on-device sample history
 
 typedef struct
 {
-    float voltage;
-    float current;
-    float power;
+    int32_t voltage_uv;
+    int32_t current_ua;
+    int32_t power_uw;
     uint32_t timestamp;
 } sensor_data_t;
 
+/**
+ * Sensor timer and acquisition timing counters.
+ *
+ * timer_latency_* is how late the sensor esp_timer callback was dispatched compared to its schedule, and
+ * timer_busy_max_us is the longest time the callback held the shared esp_timer task.
+ */
+struct monitor_timing
+{
+    uint32_t timer_ticks;
+    int64_t timer_latency_sum_us;
+    int64_t timer_latency_max_us;
+    int64_t timer_busy_max_us;
+    int64_t acquisition_max_us;
+    uint32_t conversions;
+    uint32_t skipped_conversions; // overwritten by the INA3221 before they were read
+    uint32_t not_ready_polls;
+    uint32_t read_errors;
+    uint32_t ring_overruns;
+    uint32_t warning_alerts;
+    int64_t warning_latency_sum_us; // warning pin ISR to EV_WARNING event pushed
+    int64_t warning_latency_max_us;
+    uint32_t critical_alerts;
+    int64_t critical_latency_last_us; // critical pin ISR to expander reset asserted
+    int64_t critical_latency_max_us;
+    uint32_t fast_trips;
+    int64_t fast_trip_latency_last_us; // tripping conversion read to load switch write done
+    int64_t fast_trip_latency_max_us;
+};
+
+/**
+ * CPU cycles spent per conversion converting raw registers and folding them into the publish window,
+ * for the old float path and the current fixed-point one.
+ */
+struct conversion_bench_result
+{
+    uint32_t iterations;
+    uint32_t float_cycles;
+    uint32_t fixed_cycles;
+};
+
+/**
+ * Per-channel current calibration, stored in nconfig as "<gain_ppm>,<offset_ua>".
+ * calibrated = nominal * gain_ppm / 1000000 + offset_ua
+ */
+struct current_calibration
+{
+    int32_t gain_ppm;
+    int32_t offset_ua;
+};
+
+/**
+ * INA3221 averaging and conversion times used while nothing asks for the hardware rate.
+ * Values are sample counts and microseconds, restricted to what the INA3221 supports.
+ */
+struct conversion_setting
+{
+    uint16_t averaging; // 1, 4, 16, 64, 128, 256, 512, 1024
+    uint16_t bus_ct_us; // 140, 204, 332, 588, 1100, 2116, 4156, 8244
+    uint16_t shunt_ct_us;
+};
+
+#define CALIBRATION_GAIN_MIN_PPM 500000
+#define CALIBRATION_GAIN_MAX_PPM 1500000
+#define CALIBRATION_OFFSET_MAX_UA 200000
+#define CAL_MEASURE_MAX_CONVERSIONS 4096
+
+#define SENSOR_BENCH_MAX_ITERATIONS 10000 // bus benchmark reads per clock
+
+#define SENSOR_PERIOD_MIN_MS 100
+#define SENSOR_PERIOD_MAX_MS 10000
+#define ADAPTIVE_THRESHOLD_MIN_MA 4 // one shunt LSB with the 10mOhm shunts
+#define ADAPTIVE_THRESHOLD_MAX_MA 5000
+
 void init_status_monitor();
 esp_err_t update_sensor_period(int period);
+/**
+ * @brief Runs conversions as fast as they can be read and streams them as SensorBatch messages.
+ *
+ * Reading a sample takes seven register reads, so the I2C clock is raised to 400kHz and the shortest
+ * conversion time whose period covers the measured bus time per sample is used: CT_204 and about 800Hz with
+ * the estimated 1.1ms, rather than the 1.2kHz of CT_140. A conversion that is still overwritten before it is
+ * read leaves a sequence gap and counts in dropped_samples.
+ */
+esp_err_t monitor_set_capture_mode(bool enable);
+bool monitor_get_capture_mode();
+
+/**
+ * @brief Enables the adaptive publish rate.
+ *
+ * While any channel's current moves more than threshold_ma away from the last published mean, conversions
+ * run unaveraged and SensorData is published every 100ms; once the signal has been steady for 2s it falls
+ * back to one message every 5s. The setting is persisted.
+ */
+esp_err_t monitor_set_adaptive(bool enable, int threshold_ma);
+bool monitor_get_adaptive(int* threshold_ma);
+
+/**
+ * @brief Validates and persists the normal averaging/conversion times. The acquisition task re-arms with them
+ * before its next conversion unless a fast mode is active, in which case they apply once it ends.
+ */
+esp_err_t monitor_set_conversion(const struct conversion_setting* setting);
+esp_err_t monitor_check_conversion(const struct conversion_setting* setting);
+void monitor_get_conversion(struct conversion_setting* setting);
+
+/**
+ * @brief Highest achievable sample rate of the normal setting in mHz: one result per conversion period of all
+ * channels, but no faster than the measured (or, before the first sample, estimated) I2C time per sample.
+ */
+uint32_t monitor_get_max_sample_rate_mhz();
+
+/**
+ * @brief Re-evaluates whether conversions should run at the hardware rate (capture mode, adaptive fast rate
+ * or an armed scope capture) and queues the INA3221 setting change if needed.
+ */
+void monitor_update_conversion_mode();
+void monitor_get_timing(struct monitor_timing* out);
+
+/**
+ * @brief Copies the calibrated currents of the most recent conversion, in ina3221_channel_t order.
+ *
+ * @return esp_timer time the conversion was read, 0 before the first one.
+ */
+int64_t monitor_get_last_current(int32_t current_ua[INA3221_BUS_NUMBER]);
+esp_err_t monitor_bench_bus(uint32_t clk_hz, uint32_t iterations, struct sensor_bench_result* result);
+void monitor_reset_timing();
+esp_err_t monitor_bench_conversion(uint32_t iterations, struct conversion_bench_result* result);
+
+void monitor_get_calibration(ina3221_channel_t channel, struct current_calibration* cal);
+
+/**
+ * @brief Validates, persists and applies a channel's current calibration. The acquisition task picks it up
+ * before its next conversion.
+ */
+esp_err_t monitor_set_calibration(ina3221_channel_t channel, const struct current_calibration* cal);
+
+/**
+ * @brief Averages the next `conversions` conversions of a channel with the nominal shunt scale, ignoring its
+ * calibration. Blocks the caller until they have been read. `conversions` must be 1..CAL_MEASURE_MAX_CONVERSIONS.
+ *
+ * @param[out] current_ua Mean uncalibrated current.
+ * @return ESP_ERR_TIMEOUT if the conversions did not arrive, ESP_ERR_INVALID_STATE if a measurement is already
+ *         running.
+ */
+esp_err_t monitor_measure_uncalibrated(ina3221_channel_t channel, uint32_t conversions, int32_t* current_ua);
 
 #endif // ODROID_REMOTE_HTTP_MONITOR_H
@@ -0,0 +1,42 @@
+#include "pattern.h"
+
+#include <string.h>
+
+void pattern_init(struct pattern_matcher* m, const char* pattern)
+{
+    memset(m, 0, sizeof(*m));
+    strncpy(m->pattern, pattern, sizeof(m->pattern) - 1);
+    m->len = strlen(m->pattern);
+
+    // fail[i]: length of the longest proper prefix of pattern[0..i] that is also its suffix
+    for (uint8_t i = 1, k = 0; i < m->len; i++)
+    {
+        while (k > 0 && m->pattern[i] != m->pattern[k])
+            k = m->fail[k - 1];
+        if (m->pattern[i] == m->pattern[k])
+            k++;
+        m->fail[i] = k;
+    }
+}
+
+bool pattern_feed(struct pattern_matcher* m, const uint8_t* data, size_t len)
+{
+    bool matched = false;
+
+    if (m->len == 0)
+        return false;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        while (m->state > 0 && data[i] != (uint8_t)m->pattern[m->state])
+            m->state = m->fail[m->state - 1];
+        if (data[i] == (uint8_t)m->pattern[m->state])
+            m->state++;
+        if (m->state == m->len)
+        {
+            matched = true;
+            m->state = m->fail[m->state - 1];
+        }
+    }
+    return matched;
+}
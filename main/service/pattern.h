@@ -0,0 +1,34 @@
+#ifndef ODROID_POWER_MATE_PATTERN_H
+#define ODROID_POWER_MATE_PATTERN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PATTERN_MAX_LEN 32 // including the terminator
+
+/**
+ * Streaming substring matcher (Knuth-Morris-Pratt) for the console UART: constant work per byte and no
+ * buffering, so a match split across reads is still found.
+ */
+struct pattern_matcher
+{
+    char pattern[PATTERN_MAX_LEN];
+    uint8_t len;
+    uint8_t fail[PATTERN_MAX_LEN];
+    uint8_t state; // bytes of the pattern matched so far
+};
+
+/**
+ * @brief Prepares the matcher for `pattern`, truncated to PATTERN_MAX_LEN - 1 bytes. An empty pattern never matches.
+ */
+void pattern_init(struct pattern_matcher* m, const char* pattern);
+
+/**
+ * @brief Feeds received bytes.
+ *
+ * @return true if the pattern ended within `data`; matching continues with the following bytes.
+ */
+bool pattern_feed(struct pattern_matcher* m, const uint8_t* data, size_t len);
+
+#endif // ODROID_POWER_MATE_PATTERN_H
@@ -20,16 +20,150 @@ bool encode_string(pb_ostream_t* stream, const pb_field_t* field, void* const* a
     return pb_encode_string(stream, (uint8_t*)str, strlen(str));
 }
 
-void send_pb_message(const pb_msgdesc_t* fields, const void* src_struct)
+#ifdef CONFIG_SENSOR_LEGACY_FLOAT_CHANNELS
+static void fill_legacy_channel(SensorChannelData* legacy, const SensorChannelFixed* fixed)
+{
+    legacy->voltage = fixed->voltage_uv / 1e6f;
+    legacy->current = fixed->current_ua / 1e6f;
+    legacy->power = fixed->power_uw / 1e6f;
+    legacy->voltage_min = fixed->voltage_min_uv / 1e6f;
+    legacy->voltage_max = fixed->voltage_max_uv / 1e6f;
+    legacy->current_min = fixed->current_min_ua / 1e6f;
+    legacy->current_max = fixed->current_max_ua / 1e6f;
+    legacy->current_rms = fixed->current_rms_ua / 1e6f;
+    legacy->power_max = fixed->power_max_uw / 1e6f;
+}
+#endif
+
+void fill_legacy_channels(SensorData* data)
 {
-    uint8_t buffer[PB_BUFFER_SIZE];
-    pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+#ifdef CONFIG_SENSOR_LEGACY_FLOAT_CHANNELS
+    data->has_usb = data->has_main = data->has_vin = true;
+    fill_legacy_channel(&data->usb, &data->usb_fixed);
+    fill_legacy_channel(&data->main, &data->main_fixed);
+    fill_legacy_channel(&data->vin, &data->vin_fixed);
+#endif
+}
 
+// Encodes straight into a pool buffer of at least size bytes, NULL if there is none or encoding fails
+static struct ws_buffer* encode_frame(const pb_msgdesc_t* fields, const void* src_struct, size_t size,
+                                      enum ws_lane lane)
+{
+    struct ws_buffer* buf = ws_alloc_frame(size, lane);
+    if (!buf)
+        return NULL;
+
+    pb_ostream_t stream = pb_ostream_from_buffer(buf->data, buf->size);
     if (!pb_encode(&stream, fields, src_struct))
     {
         ESP_LOGE(TAG, "Failed to encode protobuf message: %s", PB_GET_ERROR(&stream));
+        ws_buffer_free(buf);
+        return NULL;
+    }
+
+    buf->len = stream.bytes_written;
+    return buf;
+}
+
+void send_pb_message(const pb_msgdesc_t* fields, const void* src_struct)
+{
+    struct ws_buffer* buf = encode_frame(fields, src_struct, PB_BUFFER_SIZE, WS_LANE_CONTROL);
+    if (buf)
+        ws_send_frame(buf, WS_LANE_CONTROL);
+}
+
+void send_status_message(const StatusMessage* message)
+{
+    enum ws_state_slot slot;
+    switch (message->which_payload)
+    {
+    case StatusMessage_sensor_data_tag:
+        slot = WS_STATE_SENSOR;
+        break;
+    case StatusMessage_wifi_status_tag:
+        slot = WS_STATE_WIFI;
+        break;
+    case StatusMessage_sw_status_tag:
+        slot = WS_STATE_SWITCH;
+        break;
+    default:
+        send_pb_message(StatusMessage_fields, message);
         return;
     }
 
-    push_data_to_ws(buffer, stream.bytes_written);
-}
\ No newline at end of file
+    struct ws_buffer* buf = encode_frame(StatusMessage_fields, message, PB_BUFFER_SIZE, WS_LANE_CONTROL);
+    if (buf)
+        ws_send_state(buf, slot);
+}
+
+// A column of struct sensor_batch, sent as its differences from the second value on
+struct delta_column
+{
+    const int32_t* values;
+    uint32_t count;
+};
+
+static bool encode_deltas(pb_ostream_t* stream, const pb_field_t* field, void* const* arg)
+{
+    const struct delta_column* column = (const struct delta_column*)(*arg);
+    if (column->count < 2)
+        return true;
+
+    // packed: one length-delimited field holding the zigzag varints
+    pb_ostream_t sizing = PB_OSTREAM_SIZING;
+    for (uint32_t i = 1; i < column->count; i++)
+        pb_encode_svarint(&sizing, column->values[i] - column->values[i - 1]);
+
+    if (!pb_encode_tag(stream, PB_WT_STRING, field->tag) || !pb_encode_varint(stream, sizing.bytes_written))
+        return false;
+    for (uint32_t i = 1; i < column->count; i++)
+    {
+        if (!pb_encode_svarint(stream, column->values[i] - column->values[i - 1]))
+            return false;
+    }
+    return true;
+}
+
+void send_sensor_batch(const struct sensor_batch* batch)
+{
+    struct delta_column time_column = {batch->offset_us, batch->count};
+    struct delta_column voltage_columns[INA3221_BUS_NUMBER];
+    struct delta_column current_columns[INA3221_BUS_NUMBER];
+
+    if (batch->count == 0)
+        return;
+
+    StatusMessage message = StatusMessage_init_zero;
+    message.which_payload = StatusMessage_sensor_batch_tag;
+    SensorBatch* sensor_batch = &message.payload.sensor_batch;
+
+    sensor_batch->base_us = (uint64_t)batch->base_us;
+    sensor_batch->timestamp_ms = batch->timestamp_ms;
+    sensor_batch->base_sequence = batch->base_sequence;
+    sensor_batch->count = batch->count;
+    sensor_batch->time_delta_us.funcs.encode = &encode_deltas;
+    sensor_batch->time_delta_us.arg = &time_column;
+
+    sensor_batch->has_usb = true;
+    sensor_batch->has_main = true;
+    sensor_batch->has_vin = true;
+    SensorChannelBatch* channels[] = {&sensor_batch->usb, &sensor_batch->main, &sensor_batch->vin};
+
+    for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+    {
+        voltage_columns[i] = (struct delta_column){batch->voltage_mv[i], batch->count};
+        current_columns[i] = (struct delta_column){batch->current_ma[i], batch->count};
+
+        channels[i]->voltage_mv = batch->voltage_mv[i][0];
+        channels[i]->current_ma = batch->current_ma[i][0];
+        channels[i]->voltage_delta_mv.funcs.encode = &encode_deltas;
+        channels[i]->voltage_delta_mv.arg = &voltage_columns[i];
+        channels[i]->current_delta_ma.funcs.encode = &encode_deltas;
+        channels[i]->current_delta_ma.arg = &current_columns[i];
+    }
+
+    // bulk data like the console, so a capture never holds back an event
+    struct ws_buffer* buf = encode_frame(StatusMessage_fields, &message, SENSOR_BATCH_BUFFER_SIZE, WS_LANE_BULK);
+    if (buf)
+        ws_send_frame(buf, WS_LANE_BULK);
+}
@@ -5,18 +5,56 @@
 #ifndef ODROID_POWER_MATE_PB_H
 #define ODROID_POWER_MATE_PB_H
 
-#define PB_BUFFER_SIZE 256
+#define PB_BUFFER_SIZE 512 // room for a worst-case SensorData, energy counters included
+
+#define SENSOR_BATCH_MAX 32 // conversions per SensorBatch, half the acquisition ring
+#define SENSOR_BATCH_BUFFER_SIZE 1024 // worst case is about 23 bytes per conversion plus the first one in full
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "esp_log.h"
 
 #include "pb_encode.h"
 #include "pb.h"
 #include "status.pb.h"
+#include "ina3221.h"
 #include "webserver.h"
 
+// Consecutive conversions collected for one SensorBatch message, in mV/mA
+struct sensor_batch
+{
+    uint64_t timestamp_ms; // of the first conversion
+    int64_t base_us;
+    uint32_t base_sequence;
+    uint32_t count;
+    int32_t offset_us[SENSOR_BATCH_MAX]; // acquisition time relative to base_us
+    int32_t voltage_mv[INA3221_BUS_NUMBER][SENSOR_BATCH_MAX];
+    int32_t current_ma[INA3221_BUS_NUMBER][SENSOR_BATCH_MAX];
+};
+
 bool encode_string(pb_ostream_t* stream, const pb_field_t* field, void* const* arg);
+
+/**
+ * @brief Fills the float usb/main/vin channels from the *_fixed ones for consumers that predate them.
+ *        Soft-float on the ESP32-C3, so it does nothing unless CONFIG_SENSOR_LEGACY_FLOAT_CHANNELS is set.
+ */
+void fill_legacy_channels(SensorData* data);
+
+/**
+ * @brief Encodes a message straight into a websocket pool buffer and queues it for the clients.
+ */
 void send_pb_message(const pb_msgdesc_t* fields, const void* src_struct);
 
+/**
+ * @brief Sends a StatusMessage. Sensor data, Wi-Fi and switch status only describe the current state,
+ *        so a newer one replaces a pending one of the same kind instead of queueing behind it.
+ */
+void send_status_message(const StatusMessage* message);
+
+/**
+ * @brief Delta-encodes a batch into a SensorBatch message and pushes it to the websocket clients.
+ */
+void send_sensor_batch(const struct sensor_batch* batch);
+
 #endif // ODROID_POWER_MATE_PB_H
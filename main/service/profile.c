@@ -0,0 +1,377 @@
+#include "profile.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "auth.h"
+#include "cJSON.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "event.h"
+#include "freertos/FreeRTOS.h"
+#include "monitor.h"
+#include "webserver.h"
+
+#define PROFILE_CHANNEL INA3221_CHANNEL_2 // MAIN
+
+static const char* TAG = "profile";
+
+static const char* const trigger_names[] = {"main_on", "power_button"};
+
+// Profile being recorded, only touched by the acquisition task
+struct profile_work
+{
+    struct boot_profile profile;
+    int64_t start_us;
+    int64_t last_us;
+    int64_t energy_pj; // uW * us
+    // current bucket of the trace
+    int64_t bucket_sum_ua;
+    uint32_t bucket_count;
+    int32_t bucket_peak_ua;
+    // candidate steady window
+    uint32_t window_start_us;
+    int64_t window_energy_pj;
+    int64_t window_sum_ua;
+    uint32_t window_count;
+    int32_t window_min_ua;
+    int32_t window_max_ua;
+};
+
+static struct profile_work work;
+static bool recording;
+
+// Requests from sw.c, picked up by the acquisition task at its next conversion
+static volatile bool active; // a profile is requested or being recorded
+static bool pending_start;
+static bool pending_cancel;
+static enum profile_trigger pending_trigger;
+static int64_t pending_start_us;
+static int64_t pending_time_ms;
+static portMUX_TYPE profile_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static struct boot_profile history[PROFILE_HISTORY];
+static uint8_t history_head; // next slot to write
+static uint8_t history_count;
+static uint32_t finished_count;
+static uint32_t reported_count;
+
+void profile_start(enum profile_trigger trigger)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    int64_t now = esp_timer_get_time();
+
+    bool started = false;
+    portENTER_CRITICAL(&profile_lock);
+    // the power button of a board whose MAIN rail just came up belongs to the same boot
+    if (!active || pending_cancel)
+    {
+        pending_start = true;
+        pending_cancel = false;
+        pending_trigger = trigger;
+        pending_start_us = now;
+        pending_time_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+        active = true;
+        started = true;
+    }
+    portEXIT_CRITICAL(&profile_lock);
+
+    if (started)
+    {
+        ESP_LOGI(TAG, "Profiling boot (%s)", trigger_names[trigger]);
+        monitor_update_conversion_mode();
+    }
+}
+
+void profile_cancel(void)
+{
+    portENTER_CRITICAL(&profile_lock);
+    if (active)
+    {
+        pending_start = false;
+        pending_cancel = true;
+    }
+    portEXIT_CRITICAL(&profile_lock);
+}
+
+bool profile_is_running(void) { return active; }
+
+static int16_t clamp_ma(int32_t ua)
+{
+    int32_t ma = ua / 1000;
+    if (ma > INT16_MAX)
+        return INT16_MAX;
+    if (ma < INT16_MIN)
+        return INT16_MIN;
+    return (int16_t)ma;
+}
+
+static void close_bucket(struct boot_profile* p)
+{
+    struct profile_point* point = &p->trace[p->points];
+
+    if (work.bucket_count > 0)
+    {
+        point->mean_ma = clamp_ma((int32_t)(work.bucket_sum_ua / work.bucket_count));
+        point->peak_ma = clamp_ma(work.bucket_peak_ua);
+    }
+    else
+    {
+        // slower conversions than buckets, repeat the previous value
+        *point = p->points > 0 ? p->trace[p->points - 1] : (struct profile_point){0};
+    }
+    p->points++;
+
+    work.bucket_sum_ua = 0;
+    work.bucket_count = 0;
+    work.bucket_peak_ua = INT32_MIN;
+}
+
+// Halves the trace resolution by merging neighbouring buckets
+static void compact_trace(struct boot_profile* p)
+{
+    for (uint8_t i = 0; i < p->points / 2; i++)
+    {
+        struct profile_point a = p->trace[2 * i];
+        struct profile_point b = p->trace[2 * i + 1];
+        p->trace[i].mean_ma = (int16_t)(((int32_t)a.mean_ma + b.mean_ma) / 2);
+        p->trace[i].peak_ma = a.peak_ma > b.peak_ma ? a.peak_ma : b.peak_ma;
+    }
+    p->points /= 2;
+    p->bucket_us *= 2;
+}
+
+static void begin_recording(void)
+{
+    memset(&work, 0, sizeof(work));
+    work.profile.trigger = pending_trigger;
+    work.profile.time_ms = pending_time_ms;
+    work.profile.uptime_ms = (uint64_t)pending_start_us / 1000;
+    work.profile.bucket_us = PROFILE_TRACE_BUCKET_US;
+    work.profile.peak_ua = INT32_MIN;
+    work.start_us = pending_start_us;
+    work.last_us = pending_start_us;
+    work.bucket_peak_ua = INT32_MIN;
+    recording = true;
+}
+
+static void finish_recording(uint32_t offset_us, bool settled)
+{
+    struct boot_profile* p = &work.profile;
+
+    if (work.bucket_count > 0 && p->points < PROFILE_TRACE_POINTS)
+        close_bucket(p);
+    p->duration_us = offset_us;
+    p->settled = settled;
+    if (settled)
+    {
+        p->settle_us = work.window_start_us;
+        p->idle_ua = (int32_t)(work.window_sum_ua / work.window_count);
+        p->energy_uj = work.window_energy_pj / 1000000;
+    }
+    else
+    {
+        p->energy_uj = work.energy_pj / 1000000;
+    }
+    recording = false;
+
+    portENTER_CRITICAL(&profile_lock);
+    history[history_head] = *p;
+    history_head = (history_head + 1) % PROFILE_HISTORY;
+    if (history_count < PROFILE_HISTORY)
+        history_count++;
+    finished_count++;
+    if (!pending_start)
+        active = false;
+    portEXIT_CRITICAL(&profile_lock);
+}
+
+bool profile_feed(int64_t acquired_us, const int32_t voltage_uv[INA3221_BUS_NUMBER],
+                  const int32_t current_ua[INA3221_BUS_NUMBER])
+{
+    if (!active)
+        return false;
+
+    portENTER_CRITICAL(&profile_lock);
+    bool start = pending_start;
+    bool cancel = pending_cancel;
+    pending_start = false;
+    pending_cancel = false;
+    if (cancel)
+        active = false;
+    portEXIT_CRITICAL(&profile_lock);
+
+    if (cancel)
+    {
+        recording = false;
+        return true;
+    }
+    if (start)
+        begin_recording();
+    if (!recording || acquired_us < work.start_us)
+        return false;
+
+    struct boot_profile* p = &work.profile;
+    uint32_t offset = (uint32_t)(acquired_us - work.start_us);
+    int32_t current = current_ua[PROFILE_CHANNEL];
+
+    p->samples++;
+    work.energy_pj += (int64_t)(voltage_uv[PROFILE_CHANNEL] / 1000) * current / 1000 * (acquired_us - work.last_us);
+    work.last_us = acquired_us;
+
+    if (current > p->peak_ua)
+    {
+        p->peak_ua = current;
+        p->peak_at_us = offset;
+    }
+
+    while (offset >= (p->points + 1) * p->bucket_us)
+    {
+        if (p->points == PROFILE_TRACE_POINTS)
+            compact_trace(p);
+        else
+            close_bucket(p);
+    }
+    work.bucket_sum_ua += current;
+    work.bucket_count++;
+    if (current > work.bucket_peak_ua)
+        work.bucket_peak_ua = current;
+
+    // restart the steady window whenever the current leaves the band
+    int32_t min = work.window_count > 0 && work.window_min_ua < current ? work.window_min_ua : current;
+    int32_t max = work.window_count > 0 && work.window_max_ua > current ? work.window_max_ua : current;
+    if (max - min > PROFILE_STEADY_BAND_UA)
+    {
+        work.window_start_us = offset;
+        work.window_energy_pj = work.energy_pj;
+        work.window_sum_ua = 0;
+        work.window_count = 0;
+        min = max = current;
+    }
+    work.window_min_ua = min;
+    work.window_max_ua = max;
+    work.window_sum_ua += current;
+    work.window_count++;
+
+    if (offset - work.window_start_us >= PROFILE_STEADY_HOLD_US)
+    {
+        finish_recording(offset, true);
+        return true;
+    }
+    if (offset >= PROFILE_MAX_US)
+    {
+        finish_recording(offset, false);
+        return true;
+    }
+    return false;
+}
+
+void profile_report(void)
+{
+    if (reported_count == finished_count)
+        return;
+
+    struct boot_profile p;
+    portENTER_CRITICAL(&profile_lock);
+    p = history[(history_head + PROFILE_HISTORY - 1) % PROFILE_HISTORY];
+    reported_count = finished_count;
+    portEXIT_CRITICAL(&profile_lock);
+
+    if (p.settled)
+        push_eventf(EV_INFO,
+                    "boot profile (%s): peak %" PRId32 "mA at %" PRIu32 "ms, idle %" PRId32 "mA after %" PRIu32
+                    "ms, %" PRId64 "mJ to idle",
+                    trigger_names[p.trigger], p.peak_ua / 1000, p.peak_at_us / 1000, p.idle_ua / 1000,
+                    p.settle_us / 1000, p.energy_uj / 1000);
+    else
+        push_eventf(EV_WARNING,
+                    "boot profile (%s): peak %" PRId32 "mA at %" PRIu32 "ms, not idle after %" PRIu32 "ms, %" PRId64
+                    "mJ",
+                    trigger_names[p.trigger], p.peak_ua / 1000, p.peak_at_us / 1000, p.duration_us / 1000,
+                    p.energy_uj / 1000);
+}
+
+uint8_t profile_get_history(struct boot_profile* out, uint8_t max)
+{
+    uint8_t count = 0;
+
+    portENTER_CRITICAL(&profile_lock);
+    for (; count < history_count && count < max; count++)
+        out[count] = history[(history_head + PROFILE_HISTORY - 1 - count) % PROFILE_HISTORY];
+    portEXIT_CRITICAL(&profile_lock);
+    return count;
+}
+
+static cJSON* profile_to_json(const struct boot_profile* p)
+{
+    cJSON* item = cJSON_CreateObject();
+    cJSON_AddNumberToObject(item, "time_ms", (double)p->time_ms);
+    cJSON_AddNumberToObject(item, "uptime_ms", (double)p->uptime_ms);
+    cJSON_AddStringToObject(item, "trigger", trigger_names[p->trigger]);
+    cJSON_AddBoolToObject(item, "settled", p->settled);
+    cJSON_AddNumberToObject(item, "samples", p->samples);
+    cJSON_AddNumberToObject(item, "duration_us", p->duration_us);
+    cJSON_AddNumberToObject(item, "peak_ma", p->peak_ua / 1000);
+    cJSON_AddNumberToObject(item, "peak_at_us", p->peak_at_us);
+    cJSON_AddNumberToObject(item, "settle_us", p->settle_us);
+    cJSON_AddNumberToObject(item, "idle_ma", p->idle_ua / 1000);
+    cJSON_AddNumberToObject(item, "energy_mj", (double)(p->energy_uj / 1000));
+    cJSON_AddNumberToObject(item, "bucket_us", p->bucket_us);
+
+    cJSON* mean = cJSON_AddArrayToObject(item, "mean_ma");
+    cJSON* peak = cJSON_AddArrayToObject(item, "peak_ma_trace");
+    for (uint8_t i = 0; i < p->points; i++)
+    {
+        cJSON_AddItemToArray(mean, cJSON_CreateNumber(p->trace[i].mean_ma));
+        cJSON_AddItemToArray(peak, cJSON_CreateNumber(p->trace[i].peak_ma));
+    }
+    return item;
+}
+
+/*
+ * GET /api/profile
+ * The last PROFILE_HISTORY boot profiles of the MAIN rail, newest first. The trace has one point per bucket_us.
+ */
+static esp_err_t profile_get_handler(httpd_req_t* req)
+{
+    esp_err_t err = api_auth_check(req);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    struct boot_profile* profiles = malloc(sizeof(struct boot_profile) * PROFILE_HISTORY);
+    if (profiles == NULL)
+    {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    uint8_t count = profile_get_history(profiles, PROFILE_HISTORY);
+
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "recording", profile_is_running());
+    cJSON* list = cJSON_AddArrayToObject(root, "profiles");
+    for (uint8_t i = 0; i < count; i++)
+        cJSON_AddItemToArray(list, profile_to_json(&profiles[i]));
+    free(profiles);
+
+    char* json_string = cJSON_PrintUnformatted(root);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_string, strlen(json_string));
+
+    free(json_string);
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+void register_profile_endpoint(httpd_handle_t server)
+{
+    httpd_uri_t get_uri = {
+        .uri = "/api/profile", .method = HTTP_GET, .handler = profile_get_handler, .user_ctx = NULL};
+    httpd_register_uri_handler(server, &get_uri);
+}
@@ -0,0 +1,86 @@
+#ifndef ODROID_POWER_MATE_PROFILE_H
+#define ODROID_POWER_MATE_PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ina3221.h"
+
+#define PROFILE_HISTORY 4 // finished profiles kept for /api/profile
+#define PROFILE_TRACE_POINTS 64
+#define PROFILE_TRACE_BUCKET_US 10000 // initial trace resolution, doubled whenever the trace fills up
+#define PROFILE_STEADY_BAND_UA 20000 // MAIN current stays within this band ...
+#define PROFILE_STEADY_HOLD_US 2000000 // ... for this long to count as idle
+#define PROFILE_MAX_US 120000000 // a boot that never settles is cut off here
+
+enum profile_trigger
+{
+    PROFILE_TRIGGER_MAIN_ON, // MAIN load switch turned on
+    PROFILE_TRIGGER_POWER_BUTTON, // power button pressed with the MAIN rail already up
+};
+
+// One trace bucket of the MAIN channel current
+struct profile_point
+{
+    int16_t mean_ma;
+    int16_t peak_ma;
+};
+
+/**
+ * Power profile of the MAIN rail from the trigger until the current first settles.
+ * Times are relative to the trigger.
+ */
+struct boot_profile
+{
+    int64_t time_ms; // wall clock time of the trigger
+    uint64_t uptime_ms;
+    uint8_t trigger; // enum profile_trigger
+    bool settled; // false if PROFILE_MAX_US passed first
+    uint32_t samples;
+    uint32_t duration_us;
+    int32_t peak_ua;
+    uint32_t peak_at_us;
+    uint32_t settle_us; // start of the first PROFILE_STEADY_HOLD_US window within PROFILE_STEADY_BAND_UA
+    int32_t idle_ua; // mean current over that window
+    int64_t energy_uj; // MAIN energy from the trigger to settle_us (or duration_us)
+    uint32_t bucket_us;
+    uint8_t points;
+    struct profile_point trace[PROFILE_TRACE_POINTS];
+};
+
+/**
+ * @brief Starts a profile unless one is already being recorded, called by sw.c.
+ */
+void profile_start(enum profile_trigger trigger);
+
+/**
+ * @brief Drops the profile being recorded, called by sw.c when the MAIN rail turns off.
+ */
+void profile_cancel(void);
+
+/**
+ * @brief True while a profile wants conversions at the hardware rate.
+ */
+bool profile_is_running(void);
+
+/**
+ * @brief Feeds one conversion, called from the acquisition task.
+ *
+ * @return true when this conversion finished or dropped the profile.
+ */
+bool profile_feed(int64_t acquired_us, const int32_t voltage_uv[INA3221_BUS_NUMBER],
+                  const int32_t current_ua[INA3221_BUS_NUMBER]);
+
+/**
+ * @brief Pushes the summary event of a newly finished profile, called from the publish task.
+ */
+void profile_report(void);
+
+/**
+ * @brief Copies the finished profiles, newest first.
+ *
+ * @return Number of profiles copied.
+ */
+uint8_t profile_get_history(struct boot_profile* out, uint8_t max);
+
+#endif // ODROID_POWER_MATE_PROFILE_H
@@ -0,0 +1,401 @@
+#include "scope.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "auth.h"
+#include "cJSON.h"
+#include "climit.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "monitor.h"
+#include "webserver.h"
+
+#define SCOPE_CHUNK_ENTRIES 64
+
+static const char* TAG = "scope";
+
+static const char* const state_names[] = {"idle", "armed", "triggered", "done"};
+static const char* const source_names[] = {"current", "voltage", "switch"};
+static const char* const edge_names[] = {"rising", "falling", "both"};
+static const char* const channel_names[] = {"usb", "main", "vin"}; // ina3221_channel_t order
+static const int32_t channel_max_ma[] = {USB_CURRENT_LIMIT_MAX * 1000, MAIN_CURRENT_LIMIT_MAX * 1000,
+                                         VIN_CURRENT_LIMIT_MAX * 1000};
+#define SCOPE_LEVEL_MAX_MV 26000 // INA3221 bus voltage full scale
+
+// One conversion as kept in the capture ring
+struct scope_sample
+{
+    uint32_t time_us; // low 32 bits of the uptime
+    uint16_t voltage_mv[INA3221_BUS_NUMBER];
+    int16_t current_ma[INA3221_BUS_NUMBER];
+};
+
+static struct scope_sample ring[SCOPE_BUFFER_SIZE];
+static struct scope_trigger trigger;
+static volatile enum scope_state state = SCOPE_IDLE;
+static uint32_t head; // conversions written since the capture was armed
+static uint32_t trigger_seq;
+static uint32_t first_seq; // frozen capture is [first_seq, head)
+static int64_t trigger_uptime_us;
+static int32_t previous_value;
+static bool previous_valid;
+static volatile bool switch_changed;
+static bool downloading;
+static portMUX_TYPE scope_lock = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t scope_arm(const struct scope_trigger* t)
+{
+    if (t->channel >= INA3221_BUS_NUMBER || t->post_samples == 0 ||
+        t->pre_samples + t->post_samples > SCOPE_BUFFER_SIZE)
+        return ESP_ERR_INVALID_ARG;
+
+    portENTER_CRITICAL(&scope_lock);
+    if (downloading)
+    {
+        portEXIT_CRITICAL(&scope_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    trigger = *t;
+    head = 0;
+    previous_valid = false;
+    switch_changed = false;
+    state = SCOPE_ARMED;
+    portEXIT_CRITICAL(&scope_lock);
+
+    ESP_LOGI(TAG, "Armed on %s %s of %s at %" PRId32 ", %u/%u samples", source_names[t->source], edge_names[t->edge],
+             channel_names[t->channel], t->level, t->pre_samples, t->post_samples);
+    return ESP_OK;
+}
+
+void scope_disarm(void)
+{
+    portENTER_CRITICAL(&scope_lock);
+    if (!downloading)
+        state = SCOPE_IDLE;
+    portEXIT_CRITICAL(&scope_lock);
+}
+
+enum scope_state scope_get_state(void) { return state; }
+
+bool scope_is_sampling(void) { return state == SCOPE_ARMED || state == SCOPE_TRIGGERED; }
+
+void scope_notify_switch(void) { switch_changed = true; }
+
+static bool level_crossed(int32_t value)
+{
+    bool crossed = false;
+
+    if (previous_valid)
+    {
+        bool rising = previous_value < trigger.level && value >= trigger.level;
+        bool falling = previous_value > trigger.level && value <= trigger.level;
+
+        if (trigger.edge == SCOPE_EDGE_RISING)
+            crossed = rising;
+        else if (trigger.edge == SCOPE_EDGE_FALLING)
+            crossed = falling;
+        else
+            crossed = rising || falling;
+    }
+    previous_value = value;
+    previous_valid = true;
+    return crossed;
+}
+
+bool scope_feed(int64_t uptime_us, const int32_t voltage_uv[INA3221_BUS_NUMBER],
+                const int32_t current_ua[INA3221_BUS_NUMBER])
+{
+    if (!scope_is_sampling())
+        return false;
+
+    bool done = false;
+
+    portENTER_CRITICAL(&scope_lock);
+    struct scope_sample* s = &ring[head % SCOPE_BUFFER_SIZE];
+    s->time_us = (uint32_t)uptime_us;
+    for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+    {
+        s->voltage_mv[i] = (uint16_t)(voltage_uv[i] / 1000);
+        s->current_ma[i] = (int16_t)(current_ua[i] / 1000);
+    }
+
+    if (state == SCOPE_ARMED)
+    {
+        bool fire;
+        if (trigger.source == SCOPE_SOURCE_SWITCH)
+            fire = switch_changed;
+        else if (trigger.source == SCOPE_SOURCE_CURRENT)
+            fire = level_crossed(current_ua[trigger.channel]);
+        else
+            fire = level_crossed(voltage_uv[trigger.channel]);
+
+        if (fire)
+        {
+            trigger_seq = head;
+            trigger_uptime_us = uptime_us;
+            state = SCOPE_TRIGGERED;
+        }
+    }
+    head++;
+
+    if (state == SCOPE_TRIGGERED && head - trigger_seq >= trigger.post_samples)
+    {
+        first_seq = trigger_seq > trigger.pre_samples ? trigger_seq - trigger.pre_samples : 0;
+        state = SCOPE_DONE;
+        done = true;
+    }
+    portEXIT_CRITICAL(&scope_lock);
+
+    if (done)
+        ESP_LOGI(TAG, "Capture complete, %" PRIu32 " samples", head - first_seq);
+    return done;
+}
+
+static int lookup_name(const cJSON* item, const char* const* names, int count, int def)
+{
+    if (!cJSON_IsString(item))
+        return def;
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(item->valuestring, names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static esp_err_t scope_get_handler(httpd_req_t* req)
+{
+    esp_err_t err = api_auth_check(req);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    portENTER_CRITICAL(&scope_lock);
+    enum scope_state s = state;
+    struct scope_trigger t = trigger;
+    uint32_t captured = s == SCOPE_DONE ? head - first_seq : (head < SCOPE_BUFFER_SIZE ? head : SCOPE_BUFFER_SIZE);
+    portEXIT_CRITICAL(&scope_lock);
+
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "state", state_names[s]);
+    cJSON_AddStringToObject(root, "source", source_names[t.source]);
+    cJSON_AddStringToObject(root, "edge", edge_names[t.edge]);
+    cJSON_AddStringToObject(root, "channel", channel_names[t.channel]);
+    cJSON_AddNumberToObject(root, "level", t.level / 1000); // mA or mV
+    cJSON_AddNumberToObject(root, "pre", t.pre_samples);
+    cJSON_AddNumberToObject(root, "post", t.post_samples);
+    cJSON_AddNumberToObject(root, "captured", captured);
+
+    char* json_string = cJSON_Print(root);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_string, strlen(json_string));
+
+    free(json_string);
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+/*
+ * POST /api/scope
+ * {"arm": true, "source": "current|voltage|switch", "channel": "vin|main|usb", "edge": "rising|falling|both",
+ *  "level": <mA or mV>, "pre": <samples>, "post": <samples>} starts a capture, {"arm": false} cancels it.
+ */
+static esp_err_t scope_post_handler(httpd_req_t* req)
+{
+    esp_err_t err = api_auth_check(req);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    char buf[192];
+    int ret, remaining = req->content_len;
+
+    if (remaining >= sizeof(buf))
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Request content too long");
+        return ESP_FAIL;
+    }
+
+    ret = httpd_req_recv(req, buf, remaining);
+    if (ret <= 0)
+    {
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+        {
+            httpd_resp_send_408(req);
+        }
+        return ESP_FAIL;
+    }
+    buf[ret] = '\0';
+
+    cJSON* root = cJSON_Parse(buf);
+    if (root == NULL)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON format");
+        return ESP_FAIL;
+    }
+
+    cJSON* arm_item = cJSON_GetObjectItem(root, "arm");
+    if (!cJSON_IsBool(arm_item))
+    {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing arm");
+        return ESP_FAIL;
+    }
+
+    if (cJSON_IsFalse(arm_item))
+    {
+        cJSON_Delete(root);
+        scope_disarm();
+        monitor_update_conversion_mode();
+        httpd_resp_sendstr(req, "{\"status\":\"ok\"}");
+        return ESP_OK;
+    }
+
+    int source = lookup_name(cJSON_GetObjectItem(root, "source"), source_names, 3, SCOPE_SOURCE_CURRENT);
+    int edge = lookup_name(cJSON_GetObjectItem(root, "edge"), edge_names, 3, SCOPE_EDGE_RISING);
+    int channel = lookup_name(cJSON_GetObjectItem(root, "channel"), channel_names, 3, INA3221_CHANNEL_2);
+    cJSON* level_item = cJSON_GetObjectItem(root, "level");
+    cJSON* pre_item = cJSON_GetObjectItem(root, "pre");
+    cJSON* post_item = cJSON_GetObjectItem(root, "post");
+
+    struct scope_trigger t = {
+        .source = source,
+        .edge = edge,
+        .channel = channel,
+        .level = 0,
+        .pre_samples = cJSON_IsNumber(pre_item) ? pre_item->valueint : SCOPE_BUFFER_SIZE / 4,
+        .post_samples = cJSON_IsNumber(post_item) ? post_item->valueint : SCOPE_BUFFER_SIZE * 3 / 4,
+    };
+
+    if (source < 0 || edge < 0 || channel < 0)
+    {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid trigger");
+        return ESP_FAIL;
+    }
+
+    // range-checked before scaling to uA/uV, which would overflow int32 past 2147483
+    if (cJSON_IsNumber(level_item) && source != SCOPE_SOURCE_SWITCH)
+    {
+        double level = level_item->valuedouble;
+        int32_t min = source == SCOPE_SOURCE_CURRENT ? -channel_max_ma[channel] : 0;
+        int32_t max = source == SCOPE_SOURCE_CURRENT ? channel_max_ma[channel] : SCOPE_LEVEL_MAX_MV;
+        if (level < min || level > max)
+        {
+            cJSON_Delete(root);
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Trigger level out of range");
+            return ESP_FAIL;
+        }
+        t.level = (int32_t)level * 1000;
+    }
+    cJSON_Delete(root);
+
+    err = scope_arm(&t);
+    if (err == ESP_ERR_INVALID_STATE)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Capture download in progress");
+        return ESP_FAIL;
+    }
+    if (err != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid pre/post sample count");
+        return ESP_FAIL;
+    }
+    monitor_update_conversion_mode();
+
+    httpd_resp_sendstr(req, "{\"status\":\"armed\"}");
+    return ESP_OK;
+}
+
+/*
+ * GET /api/scope/data
+ * Streams the frozen capture as a scope_blob_header followed by scope_entry records.
+ * Acquisition keeps running meanwhile; only re-arming waits for the transfer to end.
+ */
+static esp_err_t scope_data_get_handler(httpd_req_t* req)
+{
+    esp_err_t err = api_auth_check(req);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    portENTER_CRITICAL(&scope_lock);
+    bool available = state == SCOPE_DONE;
+    if (available)
+        downloading = true;
+    portEXIT_CRITICAL(&scope_lock);
+
+    if (!available)
+    {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No completed capture");
+        return ESP_FAIL;
+    }
+
+    struct scope_entry* chunk = malloc(sizeof(struct scope_entry) * SCOPE_CHUNK_ENTRIES);
+    if (chunk == NULL)
+    {
+        downloading = false;
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+
+    struct scope_blob_header header = {
+        .magic = SCOPE_BLOB_MAGIC,
+        .version = SCOPE_BLOB_VERSION,
+        .entry_size = sizeof(struct scope_entry),
+        .count = head - first_seq,
+        .trigger_index = trigger_seq - first_seq,
+        .source = trigger.source,
+        .edge = trigger.edge,
+        .channel = trigger.channel,
+        .level = trigger.level,
+        .trigger_uptime_us = trigger_uptime_us,
+    };
+    uint32_t trigger_time = (uint32_t)trigger_uptime_us;
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    err = httpd_resp_send_chunk(req, (const char*)&header, sizeof(header));
+
+    for (uint32_t seq = first_seq; seq < head && err == ESP_OK;)
+    {
+        int n = 0;
+        for (; n < SCOPE_CHUNK_ENTRIES && seq < head; n++, seq++)
+        {
+            const struct scope_sample* s = &ring[seq % SCOPE_BUFFER_SIZE];
+            chunk[n].offset_us = (int32_t)(s->time_us - trigger_time);
+            memcpy(chunk[n].voltage_mv, s->voltage_mv, sizeof(chunk[n].voltage_mv));
+            memcpy(chunk[n].current_ma, s->current_ma, sizeof(chunk[n].current_ma));
+        }
+        err = httpd_resp_send_chunk(req, (const char*)chunk, n * sizeof(struct scope_entry));
+    }
+
+    free(chunk);
+    downloading = false;
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "capture transfer aborted");
+        return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+void register_scope_endpoint(httpd_handle_t server)
+{
+    httpd_uri_t get_uri = {.uri = "/api/scope", .method = HTTP_GET, .handler = scope_get_handler, .user_ctx = NULL};
+    httpd_register_uri_handler(server, &get_uri);
+
+    httpd_uri_t post_uri = {.uri = "/api/scope", .method = HTTP_POST, .handler = scope_post_handler, .user_ctx = NULL};
+    httpd_register_uri_handler(server, &post_uri);
+
+    httpd_uri_t data_uri = {
+        .uri = "/api/scope/data", .method = HTTP_GET, .handler = scope_data_get_handler, .user_ctx = NULL};
+    httpd_register_uri_handler(server, &data_uri);
+}
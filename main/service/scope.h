@@ -0,0 +1,100 @@
+#ifndef ODROID_POWER_MATE_SCOPE_H
+#define ODROID_POWER_MATE_SCOPE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "ina3221.h"
+
+#define SCOPE_BUFFER_SIZE 512 // conversions held by one capture, pre + post trigger
+#define SCOPE_BLOB_MAGIC 0x43534d50 // "PMSC"
+#define SCOPE_BLOB_VERSION 1
+
+enum scope_source
+{
+    SCOPE_SOURCE_CURRENT, // channel current crosses level (uA)
+    SCOPE_SOURCE_VOLTAGE, // channel voltage crosses level (uV)
+    SCOPE_SOURCE_SWITCH, // MAIN or USB load switch changes state
+};
+
+enum scope_edge
+{
+    SCOPE_EDGE_RISING,
+    SCOPE_EDGE_FALLING,
+    SCOPE_EDGE_BOTH,
+};
+
+enum scope_state
+{
+    SCOPE_IDLE,
+    SCOPE_ARMED, // filling the pre-trigger ring, waiting for the trigger
+    SCOPE_TRIGGERED, // collecting post-trigger samples
+    SCOPE_DONE, // frozen, ready for download
+};
+
+struct scope_trigger
+{
+    enum scope_source source;
+    enum scope_edge edge;
+    ina3221_channel_t channel;
+    int32_t level;
+    uint16_t pre_samples;
+    uint16_t post_samples;
+};
+
+/*
+ * Layout of GET /api/scope/data, little-endian: one header followed by `count` entries in time order.
+ * Entry `trigger_index` is the first conversion at or after the trigger.
+ */
+struct scope_blob_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entry_size;
+    uint32_t count;
+    uint32_t trigger_index;
+    uint8_t source;
+    uint8_t edge;
+    uint8_t channel;
+    uint8_t reserved;
+    int32_t level;
+    uint64_t trigger_uptime_us;
+} __attribute__((packed));
+
+struct scope_entry
+{
+    int32_t offset_us; // relative to the trigger
+    uint16_t voltage_mv[INA3221_BUS_NUMBER];
+    int16_t current_ma[INA3221_BUS_NUMBER];
+} __attribute__((packed));
+
+/**
+ * @brief Starts a new capture, discarding the previous one.
+ *
+ * @return ESP_ERR_INVALID_ARG if pre + post exceed SCOPE_BUFFER_SIZE, ESP_ERR_INVALID_STATE while the previous
+ *         capture is being downloaded.
+ */
+esp_err_t scope_arm(const struct scope_trigger* trigger);
+void scope_disarm(void);
+enum scope_state scope_get_state(void);
+
+/**
+ * @brief True while a capture wants conversions at the hardware rate (armed or collecting post-trigger).
+ */
+bool scope_is_sampling(void);
+
+/**
+ * @brief Feeds one conversion, called from the acquisition task.
+ *
+ * @return true when this conversion completed the capture.
+ */
+bool scope_feed(int64_t uptime_us, const int32_t voltage_uv[INA3221_BUS_NUMBER],
+                const int32_t current_ua[INA3221_BUS_NUMBER]);
+
+/**
+ * @brief Reports a load switch change, used by the SCOPE_SOURCE_SWITCH trigger.
+ */
+void scope_notify_switch(void);
+
+#endif // ODROID_POWER_MATE_SCOPE_H
@@ -0,0 +1,121 @@
+#include "sensor.h"
+
+#include "esp_timer.h"
+
+#define INA3221_REG_SHUNT(ch) (0x01 + (ch) * 2)
+#define INA3221_REG_BUS(ch) (0x02 + (ch) * 2)
+#define INA3221_REG_CRITICAL(ch) (0x07 + (ch) * 2)
+#define INA3221_REG_WARNING(ch) (0x08 + (ch) * 2)
+#define INA3221_REG_MASK 0x0F
+
+#define INA3221_SHUNT_RAW_MAX 0x0FFF
+
+static inline esp_err_t read_reg_16(ina3221_t* dev, uint8_t reg, uint16_t* val)
+{
+    uint8_t buf[2];
+    esp_err_t err = i2c_dev_read_reg(&dev->i2c_dev, reg, buf, sizeof(buf));
+    *val = (uint16_t)(buf[0] << 8) | buf[1];
+    return err;
+}
+
+static inline esp_err_t write_reg_16(ina3221_t* dev, uint8_t reg, uint16_t val)
+{
+    uint8_t buf[2] = {val >> 8, val & 0xFF};
+    return i2c_dev_write_reg(&dev->i2c_dev, reg, buf, sizeof(buf));
+}
+
+// Caller holds the i2c_dev mutex
+static esp_err_t read_raw_locked(ina3221_t* dev, struct sensor_raw* raw)
+{
+    uint16_t val;
+
+    for (uint8_t ch = 0; ch < INA3221_BUS_NUMBER; ch++)
+    {
+        esp_err_t err = read_reg_16(dev, INA3221_REG_SHUNT(ch), &val);
+        if (err != ESP_OK)
+            return err;
+        raw->shunt[ch] = (int16_t)val >> 3;
+
+        err = read_reg_16(dev, INA3221_REG_BUS(ch), &val);
+        if (err != ESP_OK)
+            return err;
+        raw->bus[ch] = (int16_t)val >> 3;
+    }
+    return ESP_OK;
+}
+
+esp_err_t sensor_read_raw(ina3221_t* dev, struct sensor_raw* raw)
+{
+    I2C_DEV_TAKE_MUTEX(&dev->i2c_dev);
+    I2C_DEV_CHECK(&dev->i2c_dev, read_raw_locked(dev, raw));
+    I2C_DEV_GIVE_MUTEX(&dev->i2c_dev);
+
+    return ESP_OK;
+}
+
+esp_err_t sensor_read_mask(ina3221_t* dev, ina3221_mask_t* mask)
+{
+    uint16_t val;
+
+    I2C_DEV_TAKE_MUTEX(&dev->i2c_dev);
+    I2C_DEV_CHECK(&dev->i2c_dev, read_reg_16(dev, INA3221_REG_MASK, &val));
+    I2C_DEV_GIVE_MUTEX(&dev->i2c_dev);
+
+    mask->mask_register = val;
+    return ESP_OK;
+}
+
+static esp_err_t set_alert_limit_ma(ina3221_t* dev, uint8_t reg, ina3221_channel_t channel, uint32_t milliamps)
+{
+    if (channel >= INA3221_BUS_NUMBER)
+        return ESP_ERR_INVALID_ARG;
+
+    // mA * mOhm = uV
+    uint32_t raw = milliamps * dev->shunt[channel] / INA3221_SHUNT_LSB_UV;
+    if (raw > INA3221_SHUNT_RAW_MAX)
+        raw = INA3221_SHUNT_RAW_MAX;
+
+    I2C_DEV_TAKE_MUTEX(&dev->i2c_dev);
+    I2C_DEV_CHECK(&dev->i2c_dev, write_reg_16(dev, reg, (uint16_t)(raw << 3)));
+    I2C_DEV_GIVE_MUTEX(&dev->i2c_dev);
+
+    return ESP_OK;
+}
+
+esp_err_t sensor_set_critical_alert_ma(ina3221_t* dev, ina3221_channel_t channel, uint32_t milliamps)
+{
+    return set_alert_limit_ma(dev, INA3221_REG_CRITICAL(channel), channel, milliamps);
+}
+
+esp_err_t sensor_set_warning_alert_ma(ina3221_t* dev, ina3221_channel_t channel, uint32_t milliamps)
+{
+    return set_alert_limit_ma(dev, INA3221_REG_WARNING(channel), channel, milliamps);
+}
+
+esp_err_t sensor_set_bus_clock(ina3221_t* dev, uint32_t clk_hz)
+{
+    I2C_DEV_TAKE_MUTEX(&dev->i2c_dev);
+    dev->i2c_dev.cfg.master.clk_speed = clk_hz;
+    I2C_DEV_GIVE_MUTEX(&dev->i2c_dev);
+
+    return ESP_OK;
+}
+
+esp_err_t sensor_bench_read(ina3221_t* dev, uint32_t clk_hz, int64_t* elapsed_us)
+{
+    struct sensor_raw raw;
+
+    // no other read may see the benchmark clock, and the timing must not include a wait for the lock
+    I2C_DEV_TAKE_MUTEX(&dev->i2c_dev);
+    uint32_t saved_clk = dev->i2c_dev.cfg.master.clk_speed;
+    dev->i2c_dev.cfg.master.clk_speed = clk_hz;
+
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = read_raw_locked(dev, &raw);
+    *elapsed_us = esp_timer_get_time() - start;
+
+    dev->i2c_dev.cfg.master.clk_speed = saved_clk;
+    I2C_DEV_GIVE_MUTEX(&dev->i2c_dev);
+
+    return err;
+}
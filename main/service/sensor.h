@@ -0,0 +1,71 @@
+#ifndef ODROID_POWER_MATE_SENSOR_H
+#define ODROID_POWER_MATE_SENSOR_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "ina3221.h"
+
+#define INA3221_SHUNT_LSB_UV 40 // shunt voltage register LSB, 40uV
+#define INA3221_BUS_LSB_MV 8 // bus voltage register LSB, 8mV
+
+/**
+ * Raw result registers of all three channels, already shifted down to counts.
+ * Index order follows ina3221_channel_t.
+ */
+struct sensor_raw
+{
+    int16_t shunt[INA3221_BUS_NUMBER];
+    int16_t bus[INA3221_BUS_NUMBER];
+};
+
+struct sensor_bench_result
+{
+    uint32_t clk_hz;
+    uint32_t iterations;
+    uint32_t errors;
+    int64_t min_us;
+    int64_t max_us;
+    int64_t avg_us;
+};
+
+/**
+ * @brief Reads the shunt and bus registers of every channel while holding the device mutex once.
+ *
+ * The INA3221 does not auto-increment its register pointer, so each register needs its own pointer write,
+ * and i2cdev still takes and releases the port lock around each of the six reads. Holding the device mutex
+ * only keeps other users of this descriptor out between them; the values stay raw, without float conversion.
+ *
+ * The sensor_ prefix keeps these project functions apart from the esp-idf-lib ina3221 driver.
+ */
+esp_err_t sensor_read_raw(ina3221_t* dev, struct sensor_raw* raw);
+
+/**
+ * @brief Reads the mask/enable register. Reading it clears CVRF and the latched alert flags.
+ */
+esp_err_t sensor_read_mask(ina3221_t* dev, ina3221_mask_t* mask);
+
+/**
+ * @brief Sets the critical alert limit of a channel from an integer current, without going through float.
+ *
+ * Limits above the 13-bit shunt register range are clamped to its maximum.
+ */
+esp_err_t sensor_set_critical_alert_ma(ina3221_t* dev, ina3221_channel_t channel, uint32_t milliamps);
+
+/**
+ * @brief Same as sensor_set_critical_alert_ma() for the warning limit, which is compared against the averaged
+ * measurement and drives the warning pin.
+ */
+esp_err_t sensor_set_warning_alert_ma(ina3221_t* dev, ina3221_channel_t channel, uint32_t milliamps);
+
+/**
+ * @brief Changes the I2C clock used for this device from its next transaction on.
+ */
+esp_err_t sensor_set_bus_clock(ina3221_t* dev, uint32_t clk_hz);
+
+/**
+ * @brief Times one sensor_read_raw() at the given I2C clock and restores the previous clock afterwards.
+ */
+esp_err_t sensor_bench_read(ina3221_t* dev, uint32_t clk_hz, int64_t* elapsed_us);
+
+#endif // ODROID_POWER_MATE_SENSOR_H
@@ -0,0 +1,771 @@
+#include "sequence.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "auth.h"
+#include "cJSON.h"
+#include "climit.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "event.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "monitor.h"
+#include "nconfig.h"
+#include "pattern.h"
+#include "sw.h"
+#include "webserver.h"
+
+#define SEQUENCE_TASK_PRIORITY 13 // above the web server and the UART poller, below the acquisition task
+#define SEQUENCE_MAX_MS 600000 // longest wait, hold or timeout a step may ask for
+#define SEQUENCE_BODY_MAX 2048
+#define SEQUENCE_MUTEX_TIMEOUT (pdMS_TO_TICKS(100))
+
+static const char* TAG = "sequence";
+
+static const char* const op_names[SEQ_OP_MAX] = {"switch", "wait", "settle", "power_button", "reset_button", "uart"};
+static const char* const rail_names[] = {"main", "usb", "both"}; // index + 1 is the LOAD_SW_* mask
+static const char* const channel_names[] = {"usb", "main", "vin"}; // ina3221_channel_t order
+static const int32_t channel_max_ma[] = {USB_CURRENT_LIMIT_MAX * 1000, MAIN_CURRENT_LIMIT_MAX * 1000,
+                                         VIN_CURRENT_LIMIT_MAX * 1000};
+
+static const struct sequence builtin_sequences[] = {
+    {
+        .name = "power_cycle",
+        .count = 3,
+        .steps =
+            {
+                {.op = SEQ_OP_SWITCH, .target = LOAD_SW_MAIN, .on = false},
+                {.op = SEQ_OP_WAIT, .ms = 2000},
+                {.op = SEQ_OP_SWITCH, .target = LOAD_SW_MAIN, .on = true},
+            },
+    },
+    {
+        .name = "boot",
+        .count = 3,
+        .steps =
+            {
+                {.op = SEQ_OP_SWITCH, .target = LOAD_SW_MAIN, .on = true},
+                {.op = SEQ_OP_WAIT, .ms = 500},
+                {.op = SEQ_OP_POWER_BUTTON},
+            },
+    },
+};
+#define BUILTIN_COUNT (sizeof(builtin_sequences) / sizeof(builtin_sequences[0]))
+
+static const enum nconfig_type slot_keys[SEQUENCE_SLOTS] = {SEQUENCE_1, SEQUENCE_2, SEQUENCE_3, SEQUENCE_4};
+
+// User sequences, an empty name marks a free slot
+static struct sequence slots[SEQUENCE_SLOTS];
+static SemaphoreHandle_t slots_mutex;
+
+// Copy of the sequence being run, owned by the task while busy is set
+static struct sequence running;
+static volatile bool busy;
+static volatile bool abort_requested;
+static volatile int current_step = -1;
+static portMUX_TYPE run_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static TaskHandle_t sequence_task_handle;
+static esp_timer_handle_t wake_timer;
+
+// Console pattern matcher, armed by a SEQ_OP_UART step and fed by the UART polling task
+static SemaphoreHandle_t uart_match_mutex;
+static volatile bool uart_armed;
+static volatile bool uart_matched;
+static struct pattern_matcher uart_matcher;
+
+static void wake_timer_callback(void* arg) { xTaskNotifyGive(sequence_task_handle); }
+
+// Blocks until the esp_timer time `deadline` or any other notification (abort, UART match), whichever is first
+static void wait_notify(int64_t deadline)
+{
+    int64_t remaining = deadline - esp_timer_get_time();
+    if (remaining <= 0)
+        return;
+
+    esp_timer_start_once(wake_timer, remaining);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    esp_timer_stop(wake_timer);
+}
+
+// Sleeps until the esp_timer time `deadline`, returns false if the sequence was aborted meanwhile
+static bool sleep_until(int64_t deadline)
+{
+    while (!abort_requested)
+    {
+        if (esp_timer_get_time() >= deadline)
+            return true;
+        wait_notify(deadline);
+    }
+    return false;
+}
+
+static void uart_arm(const char* pattern)
+{
+    xSemaphoreTake(uart_match_mutex, portMAX_DELAY);
+    pattern_init(&uart_matcher, pattern);
+    uart_matched = false;
+    uart_armed = true;
+    xSemaphoreGive(uart_match_mutex);
+}
+
+static void uart_disarm(void)
+{
+    xSemaphoreTake(uart_match_mutex, portMAX_DELAY);
+    uart_armed = false;
+    xSemaphoreGive(uart_match_mutex);
+}
+
+void sequence_uart_feed(const uint8_t* data, size_t len)
+{
+    if (!uart_armed)
+        return;
+
+    xSemaphoreTake(uart_match_mutex, portMAX_DELAY);
+    if (uart_armed && pattern_feed(&uart_matcher, data, len))
+    {
+        uart_matched = true;
+        uart_armed = false;
+        xTaskNotifyGive(sequence_task_handle);
+    }
+    xSemaphoreGive(uart_match_mutex);
+}
+
+static esp_err_t press_button(uint8_t which, uint32_t hold_ms)
+{
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = set_buttons(which, true);
+    if (err != ESP_OK)
+        return err;
+
+    bool completed = sleep_until(start + (int64_t)hold_ms * 1000);
+    // a held button is always released, aborted or not
+    err = set_buttons(which, false);
+    if (!completed)
+        return ESP_ERR_INVALID_STATE;
+    return err;
+}
+
+static esp_err_t wait_settle(const struct sequence_step* step, int64_t start)
+{
+    int64_t deadline = start + (int64_t)step->timeout_ms * 1000;
+    int64_t hold_us = (int64_t)step->ms * 1000;
+    int32_t limit_ua = step->limit_ma * 1000;
+    int64_t below_since = 0;
+    int64_t last_seen = 0;
+    int32_t current_ua[INA3221_BUS_NUMBER];
+
+    while (1)
+    {
+        int64_t acquired_us = monitor_get_last_current(current_ua);
+        if (acquired_us > last_seen && acquired_us >= start)
+        {
+            last_seen = acquired_us;
+            if (current_ua[step->target] < limit_ua)
+            {
+                if (below_since == 0)
+                    below_since = acquired_us;
+                if (acquired_us - below_since >= hold_us)
+                    return ESP_OK;
+            }
+            else
+            {
+                below_since = 0;
+            }
+        }
+
+        int64_t now = esp_timer_get_time();
+        if (now >= deadline)
+            return ESP_ERR_TIMEOUT;
+        int64_t next = now + SEQUENCE_SETTLE_POLL_MS * 1000;
+        if (!sleep_until(next < deadline ? next : deadline))
+            return ESP_ERR_INVALID_STATE;
+    }
+}
+
+static esp_err_t wait_uart(const struct sequence_step* step, int64_t start)
+{
+    int64_t deadline = start + (int64_t)step->timeout_ms * 1000;
+
+    uart_arm(step->pattern);
+    // a match wakes the task early through the same notification as the timer
+    while (!uart_matched && !abort_requested && esp_timer_get_time() < deadline)
+        wait_notify(deadline);
+    uart_disarm();
+
+    if (uart_matched)
+        return ESP_OK;
+    return abort_requested ? ESP_ERR_INVALID_STATE : ESP_ERR_TIMEOUT;
+}
+
+static esp_err_t run_step(const struct sequence_step* step, int64_t start)
+{
+    switch (step->op)
+    {
+    case SEQ_OP_SWITCH:
+        return set_load_switches(step->target, step->on, step->on);
+    case SEQ_OP_WAIT:
+        return sleep_until(start + (int64_t)step->ms * 1000) ? ESP_OK : ESP_ERR_INVALID_STATE;
+    case SEQ_OP_SETTLE:
+        return wait_settle(step, start);
+    case SEQ_OP_POWER_BUTTON:
+        return press_button(SW_BUTTON_POWER, step->ms ? step->ms : CONFIG_TRIGGER_POWER_DELAY_MS);
+    case SEQ_OP_RESET_BUTTON:
+        return press_button(SW_BUTTON_RESET, step->ms ? step->ms : CONFIG_TRIGGER_RESET_DELAY_MS);
+    case SEQ_OP_UART:
+        return wait_uart(step, start);
+    default:
+        return ESP_ERR_INVALID_ARG;
+    }
+}
+
+static void run_sequence(void)
+{
+    int64_t begin = esp_timer_get_time();
+    push_eventf(EV_INFO, "sequence %s started", running.name);
+
+    for (uint8_t i = 0; i < running.count; i++)
+    {
+        const struct sequence_step* step = &running.steps[i];
+        current_step = i;
+
+        int64_t start = esp_timer_get_time();
+        esp_err_t err = run_step(step, start);
+        int64_t end = esp_timer_get_time();
+
+        if (err == ESP_ERR_INVALID_STATE && abort_requested)
+        {
+            push_eventf(EV_WARNING, "sequence %s aborted in step %d %s after %" PRId64 "us", running.name, i + 1,
+                        op_names[step->op], end - start);
+            return;
+        }
+        if (err != ESP_OK)
+        {
+            push_eventf(EV_WARNING, "sequence %s step %d %s failed after %" PRId64 "us: %s", running.name, i + 1,
+                        op_names[step->op], end - start, esp_err_to_name(err));
+            return;
+        }
+        push_eventf(EV_INFO, "sequence %s step %d %s: %" PRId64 "us (t+%" PRId64 "us)", running.name, i + 1,
+                    op_names[step->op], end - start, end - begin);
+    }
+
+    push_eventf(EV_INFO, "sequence %s done in %" PRId64 "us", running.name, esp_timer_get_time() - begin);
+}
+
+static void sequence_task(void* pvParameters)
+{
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (!busy)
+            continue; // a late abort or UART match of a finished sequence
+
+        run_sequence();
+
+        portENTER_CRITICAL(&run_lock);
+        current_step = -1;
+        busy = false;
+        portEXIT_CRITICAL(&run_lock);
+    }
+}
+
+// Looks up a sequence by name, built-in ones first. Called with slots_mutex held.
+static const struct sequence* find_sequence(const char* name)
+{
+    for (int i = 0; i < BUILTIN_COUNT; i++)
+    {
+        if (strcmp(builtin_sequences[i].name, name) == 0)
+            return &builtin_sequences[i];
+    }
+    for (int i = 0; i < SEQUENCE_SLOTS; i++)
+    {
+        if (slots[i].name[0] != '\0' && strcmp(slots[i].name, name) == 0)
+            return &slots[i];
+    }
+    return NULL;
+}
+
+esp_err_t sequence_run(const char* name)
+{
+    if (xSemaphoreTake(slots_mutex, SEQUENCE_MUTEX_TIMEOUT) == pdFALSE)
+        return ESP_ERR_TIMEOUT;
+
+    const struct sequence* sequence = find_sequence(name);
+    if (sequence == NULL)
+    {
+        xSemaphoreGive(slots_mutex);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // running is only published as busy once it holds the whole sequence
+    portENTER_CRITICAL(&run_lock);
+    bool was_busy = busy;
+    if (!was_busy)
+    {
+        running = *sequence;
+        abort_requested = false;
+        busy = true;
+    }
+    portEXIT_CRITICAL(&run_lock);
+    xSemaphoreGive(slots_mutex);
+    if (was_busy)
+        return ESP_ERR_INVALID_STATE;
+
+    xTaskNotifyGive(sequence_task_handle);
+    return ESP_OK;
+}
+
+void sequence_abort(void)
+{
+    if (!busy)
+        return;
+    abort_requested = true;
+    xTaskNotifyGive(sequence_task_handle);
+}
+
+static int lookup_name(const cJSON* item, const char* const* names, int count)
+{
+    if (!cJSON_IsString(item))
+        return -1;
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(item->valuestring, names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// Reads a positive millisecond value no larger than SEQUENCE_MAX_MS, `def` if the item is missing
+static bool parse_ms(const cJSON* object, const char* key, uint32_t def, uint32_t* out)
+{
+    const cJSON* item = cJSON_GetObjectItem(object, key);
+    if (item == NULL)
+    {
+        *out = def;
+        return true;
+    }
+    if (!cJSON_IsNumber(item) || item->valuedouble < 0 || item->valuedouble > SEQUENCE_MAX_MS)
+        return false;
+    *out = (uint32_t)item->valueint;
+    return true;
+}
+
+static const char* parse_step(const cJSON* item, struct sequence_step* step)
+{
+    memset(step, 0, sizeof(*step));
+
+    int op = lookup_name(cJSON_GetObjectItem(item, "op"), op_names, SEQ_OP_MAX);
+    if (op < 0)
+        return "Unknown step op";
+    step->op = op;
+
+    switch (op)
+    {
+    case SEQ_OP_SWITCH:
+    {
+        int rail = lookup_name(cJSON_GetObjectItem(item, "rail"), rail_names, 3);
+        const cJSON* on = cJSON_GetObjectItem(item, "on");
+        if (rail < 0 || !cJSON_IsBool(on))
+            return "switch needs rail (main|usb|both) and on";
+        step->target = rail + 1;
+        step->on = cJSON_IsTrue(on);
+        break;
+    }
+    case SEQ_OP_WAIT:
+        if (!parse_ms(item, "ms", 0, &step->ms) || step->ms == 0)
+            return "wait needs ms";
+        break;
+    case SEQ_OP_SETTLE:
+    {
+        int channel = lookup_name(cJSON_GetObjectItem(item, "channel"), channel_names, INA3221_BUS_NUMBER);
+        const cJSON* below = cJSON_GetObjectItem(item, "below_ma");
+        if (channel < 0 || !cJSON_IsNumber(below))
+            return "settle needs channel (vin|main|usb) and below_ma";
+        if (below->valuedouble < 1 || below->valuedouble > channel_max_ma[channel])
+            return "settle below_ma out of range for the channel";
+        if (!parse_ms(item, "hold_ms", 100, &step->ms) || !parse_ms(item, "timeout_ms", 10000, &step->timeout_ms) ||
+            step->timeout_ms == 0)
+            return "settle hold_ms/timeout_ms out of range";
+        step->target = channel;
+        step->limit_ma = below->valueint;
+        break;
+    }
+    case SEQ_OP_POWER_BUTTON:
+    case SEQ_OP_RESET_BUTTON:
+        if (!parse_ms(item, "ms", 0, &step->ms))
+            return "button ms out of range";
+        break;
+    case SEQ_OP_UART:
+    {
+        const cJSON* pattern = cJSON_GetObjectItem(item, "pattern");
+        if (!cJSON_IsString(pattern) || pattern->valuestring[0] == '\0' ||
+            strlen(pattern->valuestring) >= SEQUENCE_PATTERN_LEN)
+            return "uart needs a pattern of 1 to 31 characters";
+        if (!parse_ms(item, "timeout_ms", 30000, &step->timeout_ms) || step->timeout_ms == 0)
+            return "uart timeout_ms out of range";
+        strncpy(step->pattern, pattern->valuestring, sizeof(step->pattern) - 1);
+        break;
+    }
+    }
+    return NULL;
+}
+
+// Returns NULL on success or a message for the client
+static const char* parse_sequence(const cJSON* root, struct sequence* sequence)
+{
+    const cJSON* name = cJSON_GetObjectItem(root, "name");
+    const cJSON* steps = cJSON_GetObjectItem(root, "steps");
+
+    if (!cJSON_IsString(name) || name->valuestring[0] == '\0' || strlen(name->valuestring) >= SEQUENCE_NAME_LEN)
+        return "name must be 1 to 15 characters";
+    if (!cJSON_IsArray(steps) || cJSON_GetArraySize(steps) == 0 || cJSON_GetArraySize(steps) > SEQUENCE_MAX_STEPS)
+        return "steps must hold 1 to 16 steps";
+
+    memset(sequence, 0, sizeof(*sequence));
+    strncpy(sequence->name, name->valuestring, sizeof(sequence->name) - 1);
+
+    const cJSON* item;
+    cJSON_ArrayForEach(item, steps)
+    {
+        const char* error = parse_step(item, &sequence->steps[sequence->count]);
+        if (error != NULL)
+            return error;
+        sequence->count++;
+    }
+    return NULL;
+}
+
+static cJSON* sequence_to_json(const struct sequence* sequence)
+{
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "name", sequence->name);
+    cJSON* steps = cJSON_AddArrayToObject(root, "steps");
+
+    for (uint8_t i = 0; i < sequence->count; i++)
+    {
+        const struct sequence_step* step = &sequence->steps[i];
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "op", op_names[step->op]);
+
+        switch (step->op)
+        {
+        case SEQ_OP_SWITCH:
+            cJSON_AddStringToObject(item, "rail", rail_names[step->target - 1]);
+            cJSON_AddBoolToObject(item, "on", step->on);
+            break;
+        case SEQ_OP_WAIT:
+        case SEQ_OP_POWER_BUTTON:
+        case SEQ_OP_RESET_BUTTON:
+            cJSON_AddNumberToObject(item, "ms", step->ms);
+            break;
+        case SEQ_OP_SETTLE:
+            cJSON_AddStringToObject(item, "channel", channel_names[step->target]);
+            cJSON_AddNumberToObject(item, "below_ma", step->limit_ma);
+            cJSON_AddNumberToObject(item, "hold_ms", step->ms);
+            cJSON_AddNumberToObject(item, "timeout_ms", step->timeout_ms);
+            break;
+        case SEQ_OP_UART:
+            cJSON_AddStringToObject(item, "pattern", step->pattern);
+            cJSON_AddNumberToObject(item, "timeout_ms", step->timeout_ms);
+            break;
+        }
+        cJSON_AddItemToArray(steps, item);
+    }
+    return root;
+}
+
+static esp_err_t sequence_save(const struct sequence* sequence)
+{
+    for (int i = 0; i < BUILTIN_COUNT; i++)
+    {
+        if (strcmp(builtin_sequences[i].name, sequence->name) == 0)
+            return ESP_ERR_INVALID_ARG;
+    }
+
+    if (xSemaphoreTake(slots_mutex, SEQUENCE_MUTEX_TIMEOUT) == pdFALSE)
+        return ESP_ERR_TIMEOUT;
+
+    // replace a sequence of the same name, otherwise take the first free slot
+    int slot = -1;
+    for (int i = 0; i < SEQUENCE_SLOTS; i++)
+    {
+        if (strcmp(slots[i].name, sequence->name) == 0)
+        {
+            slot = i;
+            break;
+        }
+        if (slot < 0 && slots[i].name[0] == '\0')
+            slot = i;
+    }
+    if (slot < 0)
+    {
+        xSemaphoreGive(slots_mutex);
+        return ESP_ERR_NO_MEM;
+    }
+
+    cJSON* json = sequence_to_json(sequence);
+    char* str = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    esp_err_t err = str ? nconfig_write(slot_keys[slot], str) : ESP_ERR_NO_MEM;
+    free(str);
+    if (err == ESP_OK)
+        slots[slot] = *sequence;
+
+    xSemaphoreGive(slots_mutex);
+    return err;
+}
+
+static esp_err_t sequence_delete(const char* name)
+{
+    if (xSemaphoreTake(slots_mutex, SEQUENCE_MUTEX_TIMEOUT) == pdFALSE)
+        return ESP_ERR_TIMEOUT;
+
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    for (int i = 0; i < SEQUENCE_SLOTS; i++)
+    {
+        if (slots[i].name[0] != '\0' && strcmp(slots[i].name, name) == 0)
+        {
+            err = nconfig_delete(slot_keys[i]);
+            if (err == ESP_OK)
+                memset(&slots[i], 0, sizeof(slots[i]));
+            break;
+        }
+    }
+
+    xSemaphoreGive(slots_mutex);
+    return err;
+}
+
+static void load_slots(void)
+{
+    for (int i = 0; i < SEQUENCE_SLOTS; i++)
+    {
+        size_t len;
+        if (nconfig_get_str_len(slot_keys[i], &len) != ESP_OK || len == 0)
+            continue;
+
+        char* buf = malloc(len);
+        if (buf == NULL)
+            continue;
+        if (nconfig_read(slot_keys[i], buf, len) == ESP_OK)
+        {
+            cJSON* root = cJSON_Parse(buf);
+            const char* error = root ? parse_sequence(root, &slots[i]) : "invalid JSON";
+            if (error != NULL)
+            {
+                ESP_LOGW(TAG, "Ignoring stored sequence %d: %s", i + 1, error);
+                memset(&slots[i], 0, sizeof(slots[i]));
+            }
+            cJSON_Delete(root);
+        }
+        free(buf);
+    }
+}
+
+/*
+ * GET /api/sequence
+ * The running sequence and step, and every built-in and stored sequence.
+ */
+static esp_err_t sequence_get_handler(httpd_req_t* req)
+{
+    esp_err_t err = api_auth_check(req);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    cJSON* root = cJSON_CreateObject();
+
+    portENTER_CRITICAL(&run_lock);
+    bool is_busy = busy;
+    int step = current_step;
+    portEXIT_CRITICAL(&run_lock);
+    if (is_busy)
+    {
+        cJSON_AddStringToObject(root, "running", running.name);
+        cJSON_AddNumberToObject(root, "step", step + 1);
+    }
+    else
+    {
+        cJSON_AddNullToObject(root, "running");
+    }
+
+    cJSON* list = cJSON_AddArrayToObject(root, "sequences");
+    for (int i = 0; i < BUILTIN_COUNT; i++)
+    {
+        cJSON* item = sequence_to_json(&builtin_sequences[i]);
+        cJSON_AddBoolToObject(item, "builtin", true);
+        cJSON_AddItemToArray(list, item);
+    }
+    if (xSemaphoreTake(slots_mutex, SEQUENCE_MUTEX_TIMEOUT) == pdTRUE)
+    {
+        for (int i = 0; i < SEQUENCE_SLOTS; i++)
+        {
+            if (slots[i].name[0] == '\0')
+                continue;
+            cJSON* item = sequence_to_json(&slots[i]);
+            cJSON_AddBoolToObject(item, "builtin", false);
+            cJSON_AddItemToArray(list, item);
+        }
+        xSemaphoreGive(slots_mutex);
+    }
+
+    char* json_string = cJSON_Print(root);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_string, strlen(json_string));
+
+    free(json_string);
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+static esp_err_t send_result(httpd_req_t* req, esp_err_t err)
+{
+    switch (err)
+    {
+    case ESP_OK:
+        httpd_resp_sendstr(req, "{\"status\":\"ok\"}");
+        return ESP_OK;
+    case ESP_ERR_NOT_FOUND:
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No such sequence");
+        break;
+    case ESP_ERR_INVALID_STATE:
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "A sequence is already running");
+        break;
+    case ESP_ERR_INVALID_ARG:
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Built-in sequences cannot be changed");
+        break;
+    case ESP_ERR_NO_MEM:
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "No free sequence slot");
+        break;
+    default:
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, esp_err_to_name(err));
+        break;
+    }
+    return ESP_FAIL;
+}
+
+/*
+ * POST /api/sequence
+ * {"run": "<name>"} starts a sequence, {"abort": true} stops the running one,
+ * {"save": {"name": "<name>", "steps": [...]}} stores a sequence and {"delete": "<name>"} removes it.
+ * Steps: {"op": "switch", "rail": "main|usb|both", "on": bool}, {"op": "wait", "ms": n},
+ * {"op": "settle", "channel": "vin|main|usb", "below_ma": n, "hold_ms": n, "timeout_ms": n},
+ * {"op": "power_button|reset_button", "ms": n}, {"op": "uart", "pattern": "...", "timeout_ms": n}
+ */
+static esp_err_t sequence_post_handler(httpd_req_t* req)
+{
+    esp_err_t err = api_auth_check(req);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    int ret, remaining = req->content_len;
+
+    if (remaining >= SEQUENCE_BODY_MAX)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Request content too long");
+        return ESP_FAIL;
+    }
+
+    char* buf = malloc(remaining + 1);
+    if (buf == NULL)
+    {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    ret = httpd_req_recv(req, buf, remaining);
+    if (ret <= 0)
+    {
+        free(buf);
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+        {
+            httpd_resp_send_408(req);
+        }
+        return ESP_FAIL;
+    }
+    buf[ret] = '\0';
+
+    cJSON* root = cJSON_Parse(buf);
+    free(buf);
+    if (root == NULL)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON format");
+        return ESP_FAIL;
+    }
+
+    cJSON* run_item = cJSON_GetObjectItem(root, "run");
+    cJSON* save_item = cJSON_GetObjectItem(root, "save");
+    cJSON* delete_item = cJSON_GetObjectItem(root, "delete");
+
+    if (cJSON_IsTrue(cJSON_GetObjectItem(root, "abort")))
+    {
+        sequence_abort();
+        err = ESP_OK;
+    }
+    else if (cJSON_IsString(run_item))
+    {
+        err = sequence_run(run_item->valuestring);
+    }
+    else if (cJSON_IsString(delete_item))
+    {
+        err = sequence_delete(delete_item->valuestring);
+    }
+    else if (cJSON_IsObject(save_item))
+    {
+        struct sequence* sequence = malloc(sizeof(struct sequence));
+        const char* error = sequence ? parse_sequence(save_item, sequence) : "Out of memory";
+        if (error != NULL)
+        {
+            free(sequence);
+            cJSON_Delete(root);
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, error);
+            return ESP_FAIL;
+        }
+        err = sequence_save(sequence);
+        free(sequence);
+    }
+    else
+    {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected run, abort, save or delete");
+        return ESP_FAIL;
+    }
+
+    cJSON_Delete(root);
+    return send_result(req, err);
+}
+
+void register_sequence_endpoint(httpd_handle_t server)
+{
+    httpd_uri_t get_uri = {
+        .uri = "/api/sequence", .method = HTTP_GET, .handler = sequence_get_handler, .user_ctx = NULL};
+    httpd_register_uri_handler(server, &get_uri);
+
+    httpd_uri_t post_uri = {
+        .uri = "/api/sequence", .method = HTTP_POST, .handler = sequence_post_handler, .user_ctx = NULL};
+    httpd_register_uri_handler(server, &post_uri);
+}
+
+void init_sequencer(void)
+{
+    slots_mutex = xSemaphoreCreateMutex();
+    uart_match_mutex = xSemaphoreCreateMutex();
+    load_slots();
+
+    const esp_timer_create_args_t wake_timer_args = {
+        .callback = &wake_timer_callback,
+        .name = "sequence_wake",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&wake_timer_args, &wake_timer));
+
+    xTaskCreate(sequence_task, "sequence_task", 1024 * 4, NULL, SEQUENCE_TASK_PRIORITY, &sequence_task_handle);
+}
@@ -0,0 +1,68 @@
+#ifndef ODROID_POWER_MATE_SEQUENCE_H
+#define ODROID_POWER_MATE_SEQUENCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "pattern.h"
+
+#define SEQUENCE_MAX_STEPS 16
+#define SEQUENCE_NAME_LEN 16
+#define SEQUENCE_PATTERN_LEN PATTERN_MAX_LEN
+#define SEQUENCE_SLOTS 4 // user defined sequences kept in nconfig, on top of the built-in ones
+#define SEQUENCE_SETTLE_POLL_MS 5
+
+enum sequence_op
+{
+    SEQ_OP_SWITCH, // set the rails in `target` (LOAD_SW_*) to `on` in one expander write
+    SEQ_OP_WAIT, // sleep `ms`
+    SEQ_OP_SETTLE, // wait until channel `target` stays below `limit_ma` for `ms`, fail after `timeout_ms`
+    SEQ_OP_POWER_BUTTON, // hold the power button for `ms`, 0 = CONFIG_TRIGGER_POWER_DELAY_MS
+    SEQ_OP_RESET_BUTTON, // hold the reset button for `ms`, 0 = CONFIG_TRIGGER_RESET_DELAY_MS
+    SEQ_OP_UART, // wait until `pattern` shows up on the console UART, fail after `timeout_ms`
+    SEQ_OP_MAX,
+};
+
+struct sequence_step
+{
+    uint8_t op;
+    uint8_t target;
+    bool on;
+    uint32_t ms;
+    uint32_t timeout_ms;
+    int32_t limit_ma;
+    char pattern[SEQUENCE_PATTERN_LEN];
+};
+
+struct sequence
+{
+    char name[SEQUENCE_NAME_LEN];
+    uint8_t count;
+    struct sequence_step steps[SEQUENCE_MAX_STEPS];
+};
+
+/**
+ * @brief Loads the stored sequences and starts the sequencer task.
+ */
+void init_sequencer(void);
+
+/**
+ * @brief Starts a sequence by name on the sequencer task.
+ *
+ * @return ESP_ERR_NOT_FOUND for an unknown name, ESP_ERR_INVALID_STATE while another sequence runs.
+ */
+esp_err_t sequence_run(const char* name);
+
+/**
+ * @brief Stops the running sequence, interrupting the step in progress; a held button is released.
+ */
+void sequence_abort(void);
+
+/**
+ * @brief Feeds console UART output to a waiting SEQ_OP_UART step, called from the UART polling task.
+ */
+void sequence_uart_feed(const uint8_t* data, size_t len);
+
+#endif // ODROID_POWER_MATE_SEQUENCE_H
@@ -1,3 +1,4 @@
+#include <inttypes.h>
 #include <stdlib.h>
 #include "auth.h"
 #include "cJSON.h"
@@ -52,6 +53,16 @@ static esp_err_t setting_get_handler(httpd_req_t* req)
     {
         cJSON_AddStringToObject(root, "period", buf);
     }
+    cJSON_AddBoolToObject(root, "capture", monitor_get_capture_mode());
+    int adaptive_threshold_ma;
+    cJSON_AddBoolToObject(root, "adaptive", monitor_get_adaptive(&adaptive_threshold_ma));
+    cJSON_AddNumberToObject(root, "adaptive_threshold", adaptive_threshold_ma);
+    struct conversion_setting conversion;
+    monitor_get_conversion(&conversion);
+    cJSON_AddNumberToObject(root, "averaging", conversion.averaging);
+    cJSON_AddNumberToObject(root, "bus_ct", conversion.bus_ct_us);
+    cJSON_AddNumberToObject(root, "shunt_ct", conversion.shunt_ct_us);
+    cJSON_AddNumberToObject(root, "sample_rate", monitor_get_max_sample_rate_mhz() / 1000.0);
 
     // Add current limits to the response
     if (nconfig_read(VIN_CURRENT_LIMIT, buf, sizeof(buf)) == ESP_OK)
@@ -66,6 +77,31 @@ static esp_err_t setting_get_handler(httpd_req_t* req)
     {
         cJSON_AddNumberToObject(root, "usb_current_limit", atof(buf));
     }
+    if (nconfig_read(VIN_WARNING_LIMIT, buf, sizeof(buf)) == ESP_OK)
+    {
+        cJSON_AddNumberToObject(root, "vin_warning_limit", atof(buf));
+    }
+    if (nconfig_read(MAIN_WARNING_LIMIT, buf, sizeof(buf)) == ESP_OK)
+    {
+        cJSON_AddNumberToObject(root, "main_warning_limit", atof(buf));
+    }
+    if (nconfig_read(USB_WARNING_LIMIT, buf, sizeof(buf)) == ESP_OK)
+    {
+        cJSON_AddNumberToObject(root, "usb_warning_limit", atof(buf));
+    }
+    if (nconfig_read(VIN_TRIP_LIMIT, buf, sizeof(buf)) == ESP_OK)
+    {
+        cJSON_AddNumberToObject(root, "vin_trip_limit", atof(buf));
+    }
+    if (nconfig_read(MAIN_TRIP_LIMIT, buf, sizeof(buf)) == ESP_OK)
+    {
+        cJSON_AddNumberToObject(root, "main_trip_limit", atof(buf));
+    }
+    if (nconfig_read(USB_TRIP_LIMIT, buf, sizeof(buf)) == ESP_OK)
+    {
+        cJSON_AddNumberToObject(root, "usb_trip_limit", atof(buf));
+    }
+    cJSON_AddNumberToObject(root, "trip_samples", climit_get_trip_samples());
 
     if (wifi_get_current_ap_info(&ap_info) == ESP_OK)
     {
@@ -150,6 +186,103 @@ static esp_err_t wifi_scan(httpd_req_t* req)
     return ESP_OK;
 }
 
+#define VIN_LIMIT_MAX_MA ((uint32_t)(VIN_CURRENT_LIMIT_MAX * 1000))
+#define MAIN_LIMIT_MAX_MA ((uint32_t)(MAIN_CURRENT_LIMIT_MAX * 1000))
+#define USB_LIMIT_MAX_MA ((uint32_t)(USB_CURRENT_LIMIT_MAX * 1000))
+
+// A current, warning or trip limit is given in A; returns false if item is not a number in 0..max_ma
+static bool parse_limit_ma(const cJSON* item, uint32_t max_ma, uint32_t* milliamps)
+{
+    if (!cJSON_IsNumber(item) || item->valuedouble < 0 || item->valuedouble > max_ma / 1000.0)
+        return false;
+    *milliamps = (uint32_t)(item->valuedouble * 1000 + 0.5);
+    return true;
+}
+
+// Stores a limit as "A.mmm", the format parse_limit_ma() in monitor.c reads back at boot, and applies it
+static void apply_limit(const cJSON* item, uint32_t max_ma, enum nconfig_type key, esp_err_t (*set)(uint32_t))
+{
+    uint32_t milliamps;
+    if (item == NULL || !parse_limit_ma(item, max_ma, &milliamps))
+        return;
+
+    char num_buf[12];
+    snprintf(num_buf, sizeof(num_buf), "%" PRIu32 ".%03" PRIu32, milliamps / 1000, milliamps % 1000);
+    nconfig_write(key, num_buf);
+    set(milliamps);
+}
+
+// Answers with an error status and frees both JSON trees
+static esp_err_t reject_setting(httpd_req_t* req, cJSON* root, cJSON* resp_root, httpd_err_code_t code,
+                                const char* message)
+{
+    httpd_resp_send_err(req, code, message);
+    cJSON_Delete(resp_root);
+    cJSON_Delete(root);
+    return ESP_FAIL;
+}
+
+/*
+ * Checks every value of a POST /api/setting before anything is applied, so a rejected request changes nothing.
+ * Returns NULL when the request is valid, otherwise the message for the 400 response.
+ */
+static const char* validate_setting(const cJSON* root, int* threshold_ma, struct conversion_setting* conversion)
+{
+    const cJSON* period_item = cJSON_GetObjectItem(root, "period");
+    if (cJSON_IsString(period_item))
+    {
+        long period = strtol(period_item->valuestring, NULL, 10);
+        if (period < SENSOR_PERIOD_MIN_MS || period > SENSOR_PERIOD_MAX_MS)
+            return "period out of range";
+    }
+
+    const cJSON* threshold_item = cJSON_GetObjectItem(root, "adaptive_threshold");
+    if (cJSON_IsBool(cJSON_GetObjectItem(root, "adaptive")) && threshold_item)
+    {
+        if (!cJSON_IsNumber(threshold_item) || threshold_item->valuedouble < ADAPTIVE_THRESHOLD_MIN_MA ||
+            threshold_item->valuedouble > ADAPTIVE_THRESHOLD_MAX_MA)
+            return "Invalid adaptive threshold";
+        *threshold_ma = threshold_item->valueint;
+    }
+
+    static const char* const conversion_keys[] = {"averaging", "bus_ct", "shunt_ct"};
+    uint16_t* values[] = {&conversion->averaging, &conversion->bus_ct_us, &conversion->shunt_ct_us};
+    bool conversion_given = false;
+    for (int i = 0; i < 3; i++)
+    {
+        const cJSON* item = cJSON_GetObjectItem(root, conversion_keys[i]);
+        if (item == NULL)
+            continue;
+        // checked before narrowing, so e.g. 65540 can not wrap around to a valid 4
+        if (!cJSON_IsNumber(item) || item->valueint < 0 || item->valueint > UINT16_MAX)
+            return "Invalid conversion setting";
+        *values[i] = item->valueint;
+        conversion_given = true;
+    }
+    if (conversion_given && monitor_check_conversion(conversion) != ESP_OK)
+        return "Invalid conversion setting";
+
+    static const char* const limit_keys[] = {"vin_current_limit", "main_current_limit", "usb_current_limit",
+                                             "vin_warning_limit", "main_warning_limit", "usb_warning_limit",
+                                             "vin_trip_limit",    "main_trip_limit",    "usb_trip_limit"};
+    static const uint32_t limit_max_ma[] = {VIN_LIMIT_MAX_MA, MAIN_LIMIT_MAX_MA, USB_LIMIT_MAX_MA};
+    for (int i = 0; i < 9; i++)
+    {
+        const cJSON* item = cJSON_GetObjectItem(root, limit_keys[i]);
+        uint32_t milliamps;
+        if (item && !parse_limit_ma(item, limit_max_ma[i % 3], &milliamps))
+            return "Current limit out of range";
+    }
+
+    // checked before narrowing to uint8_t
+    const cJSON* trip_samples_item = cJSON_GetObjectItem(root, "trip_samples");
+    if (trip_samples_item && (!cJSON_IsNumber(trip_samples_item) || trip_samples_item->valueint < 1 ||
+                              trip_samples_item->valueint > TRIP_SAMPLES_MAX))
+        return "trip_samples out of range";
+
+    return NULL;
+}
+
 static esp_err_t setting_post_handler(httpd_req_t* req)
 {
     esp_err_t err = api_auth_check(req);
@@ -181,12 +314,32 @@ static esp_err_t setting_post_handler(httpd_req_t* req)
     cJSON* ssid_item = cJSON_GetObjectItem(root, "ssid");
     cJSON* baud_item = cJSON_GetObjectItem(root, "baudrate");
     cJSON* period_item = cJSON_GetObjectItem(root, "period");
+    cJSON* capture_item = cJSON_GetObjectItem(root, "capture");
+    cJSON* adaptive_item = cJSON_GetObjectItem(root, "adaptive");
+    cJSON* averaging_item = cJSON_GetObjectItem(root, "averaging");
+    cJSON* bus_ct_item = cJSON_GetObjectItem(root, "bus_ct");
+    cJSON* shunt_ct_item = cJSON_GetObjectItem(root, "shunt_ct");
     cJSON* vin_climit_item = cJSON_GetObjectItem(root, "vin_current_limit");
     cJSON* main_climit_item = cJSON_GetObjectItem(root, "main_current_limit");
     cJSON* usb_climit_item = cJSON_GetObjectItem(root, "usb_current_limit");
+    cJSON* vin_wlimit_item = cJSON_GetObjectItem(root, "vin_warning_limit");
+    cJSON* main_wlimit_item = cJSON_GetObjectItem(root, "main_warning_limit");
+    cJSON* usb_wlimit_item = cJSON_GetObjectItem(root, "usb_warning_limit");
+    cJSON* vin_tlimit_item = cJSON_GetObjectItem(root, "vin_trip_limit");
+    cJSON* main_tlimit_item = cJSON_GetObjectItem(root, "main_trip_limit");
+    cJSON* usb_tlimit_item = cJSON_GetObjectItem(root, "usb_trip_limit");
+    cJSON* trip_samples_item = cJSON_GetObjectItem(root, "trip_samples");
     cJSON* new_username_item = cJSON_GetObjectItem(root, "new_username");
     cJSON* new_password_item = cJSON_GetObjectItem(root, "new_password");
 
+    int threshold_ma;
+    monitor_get_adaptive(&threshold_ma);
+    struct conversion_setting conversion;
+    monitor_get_conversion(&conversion);
+    const char* invalid = validate_setting(root, &threshold_ma, &conversion);
+    if (invalid)
+        return reject_setting(req, root, NULL, HTTPD_400_BAD_REQUEST, invalid);
+
     bool action_taken = false;
 
     cJSON* resp_root = cJSON_CreateObject();
@@ -294,45 +447,71 @@ static esp_err_t setting_post_handler(httpd_req_t* req)
     {
         const char* period_str = period_item->valuestring;
         ESP_LOGI(TAG, "Received period set request: %s", period_str);
-        update_sensor_period(strtol(period_str, NULL, 10));
+        if (update_sensor_period(strtol(period_str, NULL, 10)) != ESP_OK)
+            return reject_setting(req, root, resp_root, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to store period");
         cJSON_AddStringToObject(resp_root, "period_status", "updated");
         action_taken = true;
     }
 
+    if (capture_item && cJSON_IsBool(capture_item))
+    {
+        ESP_LOGI(TAG, "Received capture mode request: %d", cJSON_IsTrue(capture_item));
+        monitor_set_capture_mode(cJSON_IsTrue(capture_item));
+        cJSON_AddStringToObject(resp_root, "capture_status", "updated");
+        action_taken = true;
+    }
+
+    if (adaptive_item && cJSON_IsBool(adaptive_item))
+    {
+        ESP_LOGI(TAG, "Received adaptive rate request: %d, threshold %dmA", cJSON_IsTrue(adaptive_item), threshold_ma);
+        if (monitor_set_adaptive(cJSON_IsTrue(adaptive_item), threshold_ma) != ESP_OK)
+            return reject_setting(req, root, resp_root, HTTPD_500_INTERNAL_SERVER_ERROR,
+                                  "Failed to store adaptive setting");
+        cJSON_AddStringToObject(resp_root, "adaptive_status", "updated");
+        action_taken = true;
+    }
+
+    if (averaging_item || bus_ct_item || shunt_ct_item)
+    {
+        ESP_LOGI(TAG, "Received conversion setting: avg %u, bus %uus, shunt %uus", conversion.averaging,
+                 conversion.bus_ct_us, conversion.shunt_ct_us);
+        if (monitor_set_conversion(&conversion) != ESP_OK)
+            return reject_setting(req, root, resp_root, HTTPD_500_INTERNAL_SERVER_ERROR,
+                                  "Failed to store conversion setting");
+        cJSON_AddStringToObject(resp_root, "conversion_status", "updated");
+        action_taken = true;
+    }
+
     if (vin_climit_item || main_climit_item || usb_climit_item)
     {
-        char num_buf[10];
-        if (vin_climit_item && cJSON_IsNumber(vin_climit_item))
-        {
-            double val = vin_climit_item->valuedouble;
-            if (val >= 0.0 && val <= VIN_CURRENT_LIMIT_MAX)
-            {
-                snprintf(num_buf, sizeof(num_buf), "%.2f", val);
-                nconfig_write(VIN_CURRENT_LIMIT, num_buf);
-                climit_set_vin(val);
-            }
-        }
-        if (main_climit_item && cJSON_IsNumber(main_climit_item))
-        {
-            double val = main_climit_item->valuedouble;
-            if (val >= 0.0 && val <= MAIN_CURRENT_LIMIT_MAX)
-            {
-                snprintf(num_buf, sizeof(num_buf), "%.2f", val);
-                nconfig_write(MAIN_CURRENT_LIMIT, num_buf);
-                climit_set_main(val);
-            }
-        }
-        if (usb_climit_item && cJSON_IsNumber(usb_climit_item))
+        apply_limit(vin_climit_item, VIN_LIMIT_MAX_MA, VIN_CURRENT_LIMIT, climit_set_vin);
+        apply_limit(main_climit_item, MAIN_LIMIT_MAX_MA, MAIN_CURRENT_LIMIT, climit_set_main);
+        apply_limit(usb_climit_item, USB_LIMIT_MAX_MA, USB_CURRENT_LIMIT, climit_set_usb);
+        cJSON_AddStringToObject(resp_root, "climit_status", "updated");
+        action_taken = true;
+    }
+
+    if (vin_wlimit_item || main_wlimit_item || usb_wlimit_item)
+    {
+        apply_limit(vin_wlimit_item, VIN_LIMIT_MAX_MA, VIN_WARNING_LIMIT, climit_set_vin_warning);
+        apply_limit(main_wlimit_item, MAIN_LIMIT_MAX_MA, MAIN_WARNING_LIMIT, climit_set_main_warning);
+        apply_limit(usb_wlimit_item, USB_LIMIT_MAX_MA, USB_WARNING_LIMIT, climit_set_usb_warning);
+        cJSON_AddStringToObject(resp_root, "wlimit_status", "updated");
+        action_taken = true;
+    }
+
+    if (vin_tlimit_item || main_tlimit_item || usb_tlimit_item || trip_samples_item)
+    {
+        apply_limit(vin_tlimit_item, VIN_LIMIT_MAX_MA, VIN_TRIP_LIMIT, climit_set_vin_trip);
+        apply_limit(main_tlimit_item, MAIN_LIMIT_MAX_MA, MAIN_TRIP_LIMIT, climit_set_main_trip);
+        apply_limit(usb_tlimit_item, USB_LIMIT_MAX_MA, USB_TRIP_LIMIT, climit_set_usb_trip);
+        if (trip_samples_item && climit_set_trip_samples(trip_samples_item->valueint) == ESP_OK)
         {
-            double val = usb_climit_item->valuedouble;
-            if (val >= 0.0 && val <= USB_CURRENT_LIMIT_MAX)
-            {
-                snprintf(num_buf, sizeof(num_buf), "%.2f", val);
-                nconfig_write(USB_CURRENT_LIMIT, num_buf);
-                climit_set_usb(val);
-            }
+            char num_buf[10];
+            snprintf(num_buf, sizeof(num_buf), "%d", trip_samples_item->valueint);
+            nconfig_write(TRIP_SAMPLES, num_buf);
         }
-        cJSON_AddStringToObject(resp_root, "climit_status", "updated");
+        cJSON_AddStringToObject(resp_root, "tlimit_status", "updated");
         action_taken = true;
     }
 
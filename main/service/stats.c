@@ -0,0 +1,457 @@
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "auth.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "pb_encode.h"
+#include "status.pb.h"
+#include "webserver.h"
+
+#define STATS_WINDOW_COUNT 2
+#define EWMA_SHIFT 8 // EWMA state is kept in 1/256 uA (uW) so slow updates do not round away
+
+static const char* TAG = "stats";
+
+static const uint32_t window_lengths_ms[STATS_WINDOW_COUNT] = {60 * 1000, 60 * 60 * 1000};
+
+struct stats_series
+{
+    int64_t sum;
+    int32_t min;
+    int32_t max;
+    uint32_t histogram[STATS_HISTOGRAM_BINS]; // mA or mW, see bin_of()
+};
+
+// One slice of a window, length / STATS_WINDOW_BUCKETS long
+struct stats_bucket
+{
+    int64_t start_us;
+    uint32_t count;
+    struct stats_series current[INA3221_BUS_NUMBER];
+    struct stats_series power[INA3221_BUS_NUMBER];
+};
+
+// Rolling window: a ring of buckets, the oldest one is dropped whenever a new one starts
+struct stats_window
+{
+    uint8_t newest; // bucket being filled
+    uint8_t used; // buckets holding data, the window is complete once all are in use
+    struct stats_bucket buckets[STATS_WINDOW_BUCKETS];
+};
+
+// A window with its buckets merged, as reported by GET /api/stats
+struct stats_merged
+{
+    int64_t start_us;
+    uint32_t count;
+    bool complete;
+    struct stats_series current[INA3221_BUS_NUMBER];
+    struct stats_series power[INA3221_BUS_NUMBER];
+};
+
+// Time-based EWMA, updated once per STATS_EWMA_STEP_MS with the mean of the conversions in between
+struct stats_ewma
+{
+    bool valid;
+    int64_t batch_start_us;
+    uint32_t batch_count;
+    int64_t batch_current[INA3221_BUS_NUMBER];
+    int64_t batch_power[INA3221_BUS_NUMBER];
+    int64_t current[INA3221_BUS_NUMBER]; // << EWMA_SHIFT
+    int64_t power[INA3221_BUS_NUMBER];
+};
+
+struct stats_snapshot
+{
+    int64_t now_us;
+    struct stats_merged windows[STATS_WINDOW_COUNT];
+    int32_t ewma_current[INA3221_BUS_NUMBER];
+    int32_t ewma_power[INA3221_BUS_NUMBER];
+};
+
+static struct stats_window windows[STATS_WINDOW_COUNT];
+static struct stats_ewma ewma;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Log-spaced bin of a non-negative value: exact below 8, then 8 bins per power of two
+static uint32_t bin_of(int32_t value)
+{
+    if (value < (1 << STATS_HISTOGRAM_SUB_BITS))
+        return value > 0 ? value : 0;
+
+    uint32_t msb = 31 - __builtin_clz((uint32_t)value);
+    uint32_t shift = msb - STATS_HISTOGRAM_SUB_BITS;
+    uint32_t bin = (shift << STATS_HISTOGRAM_SUB_BITS) + ((uint32_t)value >> shift);
+    return bin < STATS_HISTOGRAM_BINS ? bin : STATS_HISTOGRAM_BINS - 1;
+}
+
+// Middle of a bin, in the histogram unit
+static int32_t bin_middle(uint32_t bin)
+{
+    if (bin < (1 << STATS_HISTOGRAM_SUB_BITS))
+        return bin;
+
+    uint32_t shift = (bin >> STATS_HISTOGRAM_SUB_BITS) - 1;
+    uint32_t mantissa = (1 << STATS_HISTOGRAM_SUB_BITS) + (bin & ((1 << STATS_HISTOGRAM_SUB_BITS) - 1));
+    return (int32_t)((mantissa << shift) + ((1u << shift) >> 1));
+}
+
+static void series_add(struct stats_series* series, uint32_t count, int32_t value)
+{
+    if (count == 0 || value < series->min)
+        series->min = value;
+    if (count == 0 || value > series->max)
+        series->max = value;
+    series->sum += value;
+    series->histogram[bin_of(value / 1000)]++;
+}
+
+static int32_t series_percentile(const struct stats_series* series, uint32_t count, uint32_t percent)
+{
+    uint32_t target = (count * (uint64_t)percent + 99) / 100;
+    uint32_t seen = 0;
+
+    for (uint32_t bin = 0; bin < STATS_HISTOGRAM_BINS; bin++)
+    {
+        seen += series->histogram[bin];
+        if (seen >= target)
+        {
+            // the bin middle can lie outside what was actually measured
+            int32_t value = bin_middle(bin) * 1000;
+            if (value < series->min)
+                return series->min;
+            if (value > series->max)
+                return series->max;
+            return value;
+        }
+    }
+    return series->max;
+}
+
+static void summarize(const struct stats_series* series, uint32_t count, int32_t ewma_value, StatsSummary* out)
+{
+    if (count == 0)
+    {
+        *out = (StatsSummary)StatsSummary_init_zero;
+        return;
+    }
+    out->min = series->min;
+    out->max = series->max;
+    out->mean = (int32_t)(series->sum / count);
+    out->ewma = ewma_value;
+    out->p50 = series_percentile(series, count, 50);
+    out->p95 = series_percentile(series, count, 95);
+    out->p99 = series_percentile(series, count, 99);
+}
+
+static void ewma_add(int64_t uptime_us, const int32_t current_ua[INA3221_BUS_NUMBER],
+                     const int32_t power_uw[INA3221_BUS_NUMBER])
+{
+    if (ewma.batch_count == 0)
+        ewma.batch_start_us = uptime_us;
+    for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+    {
+        ewma.batch_current[i] += current_ua[i];
+        ewma.batch_power[i] += power_uw[i];
+    }
+    ewma.batch_count++;
+
+    int64_t dt_us = uptime_us - ewma.batch_start_us;
+    if (dt_us < STATS_EWMA_STEP_MS * 1000LL)
+        return;
+    if (dt_us > STATS_EWMA_TAU_MS * 1000LL)
+        dt_us = STATS_EWMA_TAU_MS * 1000LL;
+
+    for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+    {
+        int64_t current = (ewma.batch_current[i] / ewma.batch_count) << EWMA_SHIFT;
+        int64_t power = (ewma.batch_power[i] / ewma.batch_count) << EWMA_SHIFT;
+
+        if (!ewma.valid)
+        {
+            ewma.current[i] = current;
+            ewma.power[i] = power;
+        }
+        else
+        {
+            ewma.current[i] += (current - ewma.current[i]) * dt_us / (STATS_EWMA_TAU_MS * 1000LL);
+            ewma.power[i] += (power - ewma.power[i]) * dt_us / (STATS_EWMA_TAU_MS * 1000LL);
+        }
+        ewma.batch_current[i] = 0;
+        ewma.batch_power[i] = 0;
+    }
+    ewma.valid = true;
+    ewma.batch_count = 0;
+}
+
+// Returns the bucket uptime_us belongs to, starting new buckets (and dropping the oldest) as time passes
+static struct stats_bucket* window_bucket(struct stats_window* w, int64_t bucket_us, int64_t uptime_us)
+{
+    struct stats_bucket* bucket = &w->buckets[w->newest];
+
+    if (w->used == 0)
+    {
+        memset(bucket, 0, sizeof(*bucket));
+        bucket->start_us = uptime_us;
+        w->used = 1;
+        return bucket;
+    }
+
+    int64_t steps = (uptime_us - bucket->start_us) / bucket_us;
+    if (steps <= 0)
+        return bucket;
+
+    if (steps >= STATS_WINDOW_BUCKETS)
+    {
+        // nothing recent enough is left, start over aligned to the old bucket grid
+        int64_t start_us = bucket->start_us + steps * bucket_us;
+        w->newest = 0;
+        w->used = 1;
+        bucket = &w->buckets[0];
+        memset(bucket, 0, sizeof(*bucket));
+        bucket->start_us = start_us;
+        return bucket;
+    }
+
+    for (int64_t i = 0; i < steps; i++)
+    {
+        int64_t start_us = w->buckets[w->newest].start_us + bucket_us;
+        w->newest = (w->newest + 1) % STATS_WINDOW_BUCKETS;
+        bucket = &w->buckets[w->newest];
+        memset(bucket, 0, sizeof(*bucket));
+        bucket->start_us = start_us;
+        if (w->used < STATS_WINDOW_BUCKETS)
+            w->used++;
+    }
+    return bucket;
+}
+
+static void series_merge(struct stats_series* total, uint32_t total_count, const struct stats_series* part,
+                         uint32_t part_count)
+{
+    if (part_count == 0)
+        return;
+    if (total_count == 0 || part->min < total->min)
+        total->min = part->min;
+    if (total_count == 0 || part->max > total->max)
+        total->max = part->max;
+    total->sum += part->sum;
+    for (uint32_t bin = 0; bin < STATS_HISTOGRAM_BINS; bin++)
+        total->histogram[bin] += part->histogram[bin];
+}
+
+// Must be called with stats_lock held
+static void window_merge(const struct stats_window* w, struct stats_merged* out)
+{
+    memset(out, 0, sizeof(*out));
+    out->complete = w->used == STATS_WINDOW_BUCKETS;
+
+    for (uint8_t n = 0; n < w->used; n++)
+    {
+        // oldest first
+        const struct stats_bucket* bucket =
+            &w->buckets[(w->newest + STATS_WINDOW_BUCKETS - (w->used - 1) + n) % STATS_WINDOW_BUCKETS];
+        if (n == 0)
+            out->start_us = bucket->start_us;
+
+        for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+        {
+            series_merge(&out->current[i], out->count, &bucket->current[i], bucket->count);
+            series_merge(&out->power[i], out->count, &bucket->power[i], bucket->count);
+        }
+        out->count += bucket->count;
+    }
+}
+
+void stats_add(int64_t uptime_us, const int32_t voltage_uv[INA3221_BUS_NUMBER],
+               const int32_t current_ua[INA3221_BUS_NUMBER])
+{
+    int32_t power_uw[INA3221_BUS_NUMBER];
+    for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+        power_uw[i] = (int32_t)((int64_t)voltage_uv[i] * current_ua[i] / 1000000);
+
+    portENTER_CRITICAL(&stats_lock);
+    ewma_add(uptime_us, current_ua, power_uw);
+
+    for (int w = 0; w < STATS_WINDOW_COUNT; w++)
+    {
+        int64_t bucket_us = window_lengths_ms[w] * 1000LL / STATS_WINDOW_BUCKETS;
+        struct stats_bucket* bucket = window_bucket(&windows[w], bucket_us, uptime_us);
+
+        for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+        {
+            series_add(&bucket->current[i], bucket->count, current_ua[i]);
+            series_add(&bucket->power[i], bucket->count, power_uw[i]);
+        }
+        bucket->count++;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void stats_reset(void)
+{
+    portENTER_CRITICAL(&stats_lock);
+    memset(windows, 0, sizeof(windows));
+    memset(&ewma, 0, sizeof(ewma));
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+static bool encode_histogram(pb_ostream_t* stream, const pb_field_t* field, void* const* arg)
+{
+    const uint32_t* bins = (const uint32_t*)(*arg);
+    uint32_t used = STATS_HISTOGRAM_BINS;
+
+    // trailing empty bins are left out
+    while (used > 0 && bins[used - 1] == 0)
+        used--;
+    if (used == 0)
+        return true;
+
+    pb_ostream_t sizing = PB_OSTREAM_SIZING;
+    for (uint32_t i = 0; i < used; i++)
+        pb_encode_varint(&sizing, bins[i]);
+
+    if (!pb_encode_tag(stream, PB_WT_STRING, field->tag) || !pb_encode_varint(stream, sizing.bytes_written))
+        return false;
+    for (uint32_t i = 0; i < used; i++)
+    {
+        if (!pb_encode_varint(stream, bins[i]))
+            return false;
+    }
+    return true;
+}
+
+static bool encode_windows(pb_ostream_t* stream, const pb_field_t* field, void* const* arg)
+{
+    const struct stats_snapshot* snapshot = (const struct stats_snapshot*)(*arg);
+
+    for (int w = 0; w < STATS_WINDOW_COUNT; w++)
+    {
+        const struct stats_merged* window = &snapshot->windows[w];
+
+        StatsWindow msg = StatsWindow_init_zero;
+        ChannelStats* channels[] = {&msg.usb, &msg.main, &msg.vin};
+        msg.length_s = window_lengths_ms[w] / 1000;
+        msg.complete = window->complete;
+        msg.elapsed_ms = window->count ? (uint32_t)((snapshot->now_us - window->start_us) / 1000) : 0;
+        msg.sample_count = window->count;
+        msg.has_usb = msg.has_main = msg.has_vin = true;
+
+        for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+        {
+            channels[i]->has_current = channels[i]->has_power = true;
+            summarize(&window->current[i], window->count, snapshot->ewma_current[i], &channels[i]->current);
+            summarize(&window->power[i], window->count, snapshot->ewma_power[i], &channels[i]->power);
+            channels[i]->current_histogram.funcs.encode = &encode_histogram;
+            channels[i]->current_histogram.arg = (void*)window->current[i].histogram;
+            channels[i]->power_histogram.funcs.encode = &encode_histogram;
+            channels[i]->power_histogram.arg = (void*)window->power[i].histogram;
+        }
+
+        if (!pb_encode_tag_for_field(stream, field) || !pb_encode_submessage(stream, StatsWindow_fields, &msg))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * GET /api/stats
+ * Returns a SensorStats protobuf with one rolling window per window length.
+ */
+static esp_err_t stats_get_handler(httpd_req_t* req)
+{
+    esp_err_t err = api_auth_check(req);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    struct stats_snapshot* snapshot = malloc(sizeof(struct stats_snapshot));
+    if (snapshot == NULL)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+
+    // one window at a time keeps each critical section short
+    for (int w = 0; w < STATS_WINDOW_COUNT; w++)
+    {
+        portENTER_CRITICAL(&stats_lock);
+        window_merge(&windows[w], &snapshot->windows[w]);
+        portEXIT_CRITICAL(&stats_lock);
+    }
+    portENTER_CRITICAL(&stats_lock);
+    for (uint8_t i = 0; i < INA3221_BUS_NUMBER; i++)
+    {
+        snapshot->ewma_current[i] = (int32_t)(ewma.current[i] >> EWMA_SHIFT);
+        snapshot->ewma_power[i] = (int32_t)(ewma.power[i] >> EWMA_SHIFT);
+    }
+    portEXIT_CRITICAL(&stats_lock);
+    snapshot->now_us = esp_timer_get_time();
+
+    SensorStats message = SensorStats_init_zero;
+    message.uptime_ms = (uint64_t)snapshot->now_us / 1000;
+    message.ewma_tau_ms = STATS_EWMA_TAU_MS;
+    message.windows.funcs.encode = &encode_windows;
+    message.windows.arg = snapshot;
+
+    size_t size;
+    uint8_t* buffer = NULL;
+    if (pb_get_encoded_size(&size, SensorStats_fields, &message))
+        buffer = malloc(size);
+    if (buffer == NULL)
+    {
+        free(snapshot);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+
+    pb_ostream_t stream = pb_ostream_from_buffer(buffer, size);
+    bool ok = pb_encode(&stream, SensorStats_fields, &message);
+    free(snapshot);
+
+    if (!ok)
+    {
+        ESP_LOGE(TAG, "Failed to encode stats: %s", PB_GET_ERROR(&stream));
+        free(buffer);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/x-protobuf");
+    err = httpd_resp_send(req, (const char*)buffer, stream.bytes_written);
+    free(buffer);
+    return err;
+}
+
+/*
+ * POST /api/stats
+ * Clears all windows and the EWMA.
+ */
+static esp_err_t stats_post_handler(httpd_req_t* req)
+{
+    esp_err_t err = api_auth_check(req);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    stats_reset();
+    ESP_LOGI(TAG, "Statistics reset");
+    httpd_resp_sendstr(req, "{\"status\":\"ok\"}");
+    return ESP_OK;
+}
+
+void register_stats_endpoint(httpd_handle_t server)
+{
+    httpd_uri_t get_uri = {.uri = "/api/stats", .method = HTTP_GET, .handler = stats_get_handler, .user_ctx = NULL};
+    httpd_register_uri_handler(server, &get_uri);
+
+    httpd_uri_t post_uri = {.uri = "/api/stats", .method = HTTP_POST, .handler = stats_post_handler, .user_ctx = NULL};
+    httpd_register_uri_handler(server, &post_uri);
+}
@@ -0,0 +1,28 @@
+#ifndef ODROID_POWER_MATE_STATS_H
+#define ODROID_POWER_MATE_STATS_H
+
+#include <stdint.h>
+
+#include "ina3221.h"
+
+#define STATS_HISTOGRAM_SUB_BITS 3 // 8 bins per power of two, about 6% error on a percentile
+#define STATS_HISTOGRAM_BINS 128 // covers up to 262A / 262W
+#define STATS_EWMA_TAU_MS 10000
+#define STATS_EWMA_STEP_MS 100 // conversions are averaged this long before each EWMA update
+#define STATS_WINDOW_BUCKETS 4 // a window rolls forward a quarter of its length at a time
+
+/**
+ * @brief Folds one conversion into the running statistics of every window, called from the publisher task.
+ *
+ * Memory use is constant: per window bucket and channel a sum, min, max and a log-spaced histogram of current
+ * and power. A window covers the last 3/4 to 4/4 of its length, depending on how far the newest bucket is.
+ */
+void stats_add(int64_t uptime_us, const int32_t voltage_uv[INA3221_BUS_NUMBER],
+               const int32_t current_ua[INA3221_BUS_NUMBER]);
+
+/**
+ * @brief Drops everything collected so far and restarts all windows.
+ */
+void stats_reset(void);
+
+#endif // ODROID_POWER_MATE_STATS_H
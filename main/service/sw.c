@@ -12,12 +12,16 @@
 #include <string.h>
 
 #include "driver/gpio.h"
+#include "esp_check.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "event.h"
+#include "i2cbus.h"
 #include "pb.h"
 #include "pb_encode.h"
 #include "pca9557.h"
+#include "profile.h"
+#include "scope.h"
 #include "status.pb.h"
 #include "webserver.h"
 
@@ -30,11 +34,14 @@
 #define GPIO_PWR CONFIG_EXPANDER_GPIO_TRIGGER_POWER
 #define GPIO_RST CONFIG_EXPANDER_GPIO_TRIGGER_RESET
 
+#define EXPANDER_OUTPUT_PINS (BIT(GPIO_MAIN) | BIT(GPIO_USB) | BIT(GPIO_PWR) | BIT(GPIO_RST))
+
+#define PCA9557_REG_OUTPUT 0x01
+#define PCA9557_REG_CONFIG 0x03 // 1 = input
+
 #define POWER_DELAY (CONFIG_TRIGGER_POWER_DELAY_MS * 1000)
 #define RESET_DELAY (CONFIG_TRIGGER_RESET_DELAY_MS * 1000)
 
-#define PB_BUFFER_SIZE 256
-
 static const char* TAG = "control";
 
 static bool load_switch_12v_status = false;
@@ -48,7 +55,81 @@ static i2c_dev_t pca = {0};
 static esp_timer_handle_t power_trigger_timer;
 static esp_timer_handle_t reset_trigger_timer;
 
-static void send_sw_status_message()
+// Shadow copies of the expander registers. Every change is computed here and written as a whole register in
+// one transaction, so the library's per-pin read-modify-write never runs and several pins change at once.
+static uint8_t shadow_output;
+static uint8_t shadow_config = 0xFF; // power-on default: every pin an input
+
+struct register_update
+{
+    uint8_t mask;
+    uint8_t bits;
+};
+
+static esp_err_t write_reg(uint8_t reg, uint8_t val)
+{
+    I2C_DEV_TAKE_MUTEX(&pca);
+    I2C_DEV_CHECK(&pca, i2c_dev_write_reg(&pca, reg, &val, 1));
+    I2C_DEV_GIVE_MUTEX(&pca);
+    return ESP_OK;
+}
+
+static esp_err_t read_reg(uint8_t reg, uint8_t* val)
+{
+    I2C_DEV_TAKE_MUTEX(&pca);
+    I2C_DEV_CHECK(&pca, i2c_dev_read_reg(&pca, reg, val, 1));
+    I2C_DEV_GIVE_MUTEX(&pca);
+    return ESP_OK;
+}
+
+// PCA9557 transactions, run on the I2C scheduler task ahead of sensor sampling
+static esp_err_t bus_update_output(void* arg)
+{
+    const struct register_update* update = arg;
+    uint8_t output = (shadow_output & ~update->mask) | (update->bits & update->mask);
+
+    if (output == shadow_output)
+        return ESP_OK;
+    esp_err_t err = write_reg(PCA9557_REG_OUTPUT, output);
+    if (err == ESP_OK)
+        shadow_output = output;
+    return err;
+}
+
+/*
+ * Reloads the shadow registers from the chip, which may just have been reset, and makes the
+ * switch and trigger pins outputs. The output register is written before the direction so the
+ * trigger pins come up released instead of glitching low.
+ */
+static esp_err_t bus_config_expander(void* arg)
+{
+    uint8_t output, config;
+
+    ESP_RETURN_ON_ERROR(read_reg(PCA9557_REG_OUTPUT, &output), TAG, "read output");
+    ESP_RETURN_ON_ERROR(read_reg(PCA9557_REG_CONFIG, &config), TAG, "read config");
+
+    output |= BIT(GPIO_PWR) | BIT(GPIO_RST);
+    ESP_RETURN_ON_ERROR(write_reg(PCA9557_REG_OUTPUT, output), TAG, "write output");
+    shadow_output = output;
+
+    if (config & EXPANDER_OUTPUT_PINS)
+        ESP_RETURN_ON_ERROR(write_reg(PCA9557_REG_CONFIG, config & ~EXPANDER_OUTPUT_PINS), TAG, "write config");
+    shadow_config = config & ~EXPANDER_OUTPUT_PINS;
+
+    load_switch_12v_status = (output & BIT(GPIO_MAIN)) != 0;
+    load_switch_5v_status = (output & BIT(GPIO_USB)) != 0;
+
+    return ESP_OK;
+}
+
+// Drives the masked output pins to bits in a single register write, callers hold expander_mutex
+static esp_err_t update_output(uint8_t mask, uint8_t bits)
+{
+    struct register_update update = {.mask = mask, .bits = bits};
+    return i2c_bus_run(I2C_BUS_PCA9557, I2C_BUS_PRIO_SWITCH, bus_update_output, &update);
+}
+
+void send_sw_status_message()
 {
     StatusMessage message = StatusMessage_init_zero;
     message.which_payload = StatusMessage_sw_status_tag;
@@ -57,16 +138,7 @@ static void send_sw_status_message()
     sw_status->main = load_switch_12v_status;
     sw_status->usb = load_switch_5v_status;
 
-    uint8_t buffer[PB_BUFFER_SIZE];
-    pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
-
-    if (!pb_encode(&stream, StatusMessage_fields, &message))
-    {
-        ESP_LOGE(TAG, "Failed to encode protobuf message: %s", PB_GET_ERROR(&stream));
-        return;
-    }
-
-    push_data_to_ws(buffer, stream.bytes_written);
+    send_status_message(&message);
 }
 
 
@@ -79,25 +151,15 @@ static void trigger_off_callback(void* arg)
     }
 
     uint32_t gpio_pin = (int)arg;
-    pca9557_set_level(&pca, gpio_pin, 1);
+    update_output(BIT(gpio_pin), BIT(gpio_pin));
     xSemaphoreGive(expander_mutex);
 }
 
 void config_sw()
 {
-    ESP_ERROR_CHECK(pca9557_set_mode(&pca, GPIO_MAIN, PCA9557_MODE_OUTPUT));
-    ESP_ERROR_CHECK(pca9557_set_mode(&pca, GPIO_USB, PCA9557_MODE_OUTPUT));
-    ESP_ERROR_CHECK(pca9557_set_mode(&pca, GPIO_PWR, PCA9557_MODE_OUTPUT));
-    ESP_ERROR_CHECK(pca9557_set_mode(&pca, GPIO_RST, PCA9557_MODE_OUTPUT));
-
-    ESP_ERROR_CHECK(pca9557_set_level(&pca, GPIO_PWR, 1));
-    ESP_ERROR_CHECK(pca9557_set_level(&pca, GPIO_RST, 1));
-
-    uint32_t val = 0;
-    ESP_ERROR_CHECK(pca9557_get_level(&pca, CONFIG_EXPANDER_GPIO_SW_12V, &val));
-    load_switch_12v_status = val != 0 ? true : false;
-    ESP_ERROR_CHECK(pca9557_get_level(&pca, CONFIG_EXPANDER_GPIO_SW_5V, &val));
-    load_switch_5v_status = val != 0 ? true : false;
+    ESP_ERROR_CHECK(i2c_bus_run(I2C_BUS_PCA9557, I2C_BUS_PRIO_SWITCH, bus_config_expander, NULL));
+    if (!load_switch_12v_status)
+        profile_cancel();
 
     send_sw_status_message();
 }
@@ -127,8 +189,10 @@ void trig_power()
         ESP_LOGW(TAG, "Control error");
         return;
     }
-    pca9557_set_level(&pca, GPIO_PWR, 0);
+    update_output(BIT(GPIO_PWR), 0);
     xSemaphoreGive(expander_mutex);
+    if (load_switch_12v_status)
+        profile_start(PROFILE_TRIGGER_POWER_BUTTON);
     push_event(EV_INFO, "power triggered");
     esp_timer_stop(power_trigger_timer);
     esp_timer_start_once(power_trigger_timer, POWER_DELAY);
@@ -142,45 +206,111 @@ void trig_reset()
         ESP_LOGW(TAG, "Control error");
         return;
     }
-    pca9557_set_level(&pca, GPIO_RST, 0);
+    update_output(BIT(GPIO_RST), 0);
     xSemaphoreGive(expander_mutex);
     push_event(EV_INFO, "reset triggered");
     esp_timer_stop(reset_trigger_timer);
     esp_timer_start_once(reset_trigger_timer, RESET_DELAY);
 }
 
-void set_main_load_switch(bool on)
+esp_err_t set_load_switches(uint8_t which, bool main_on, bool usb_on)
 {
-    ESP_LOGI(TAG, "Set main load switch to %s", on ? "on" : "off");
-    if (load_switch_12v_status == on)
-        return;
+    uint8_t mask = 0;
+    uint8_t bits = (main_on ? BIT(GPIO_MAIN) : 0) | (usb_on ? BIT(GPIO_USB) : 0);
+
+    if ((which & LOAD_SW_MAIN) && load_switch_12v_status != main_on)
+        mask |= BIT(GPIO_MAIN);
+    if ((which & LOAD_SW_USB) && load_switch_5v_status != usb_on)
+        mask |= BIT(GPIO_USB);
+    if (mask == 0)
+        return ESP_OK;
+
     if (xSemaphoreTake(expander_mutex, MUTEX_TIMEOUT) == pdFALSE)
     {
         ESP_LOGW(TAG, "Control error");
-        return;
+        return ESP_ERR_TIMEOUT;
+    }
+    esp_err_t err = update_output(mask, bits);
+    if (err == ESP_OK)
+    {
+        load_switch_12v_status = (shadow_output & BIT(GPIO_MAIN)) != 0;
+        load_switch_5v_status = (shadow_output & BIT(GPIO_USB)) != 0;
     }
-    pca9557_set_level(&pca, GPIO_MAIN, on);
-    load_switch_12v_status = on;
     xSemaphoreGive(expander_mutex);
-    push_eventf(EV_INFO, "main load switch set: %s", on ? "on" : "off");
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Load switch write failed: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    scope_notify_switch();
+    if ((mask & BIT(GPIO_MAIN)) && main_on)
+        profile_start(PROFILE_TRIGGER_MAIN_ON);
+    else if (mask & BIT(GPIO_MAIN))
+        profile_cancel();
+    if (mask & BIT(GPIO_MAIN))
+        push_eventf(EV_INFO, "main load switch set: %s", main_on ? "on" : "off");
+    if (mask & BIT(GPIO_USB))
+        push_eventf(EV_INFO, "usb load switch set: %s", usb_on ? "on" : "off");
     send_sw_status_message();
+    return ESP_OK;
 }
 
-void set_usb_load_switch(bool on)
+esp_err_t trip_load_switches(uint8_t which)
 {
-    ESP_LOGI(TAG, "Set usb load switch to %s", on ? "on" : "off");
-    if (load_switch_5v_status == on)
-        return;
+    uint8_t mask = 0;
+
+    if ((which & LOAD_SW_MAIN) && load_switch_12v_status)
+        mask |= BIT(GPIO_MAIN);
+    if ((which & LOAD_SW_USB) && load_switch_5v_status)
+        mask |= BIT(GPIO_USB);
+    if (mask == 0)
+        return ESP_ERR_INVALID_STATE;
+
+    if (xSemaphoreTake(expander_mutex, MUTEX_TIMEOUT) == pdFALSE)
+        return ESP_ERR_TIMEOUT;
+    esp_err_t err = update_output(mask, 0);
+    if (err == ESP_OK)
+    {
+        load_switch_12v_status = (shadow_output & BIT(GPIO_MAIN)) != 0;
+        load_switch_5v_status = (shadow_output & BIT(GPIO_USB)) != 0;
+    }
+    xSemaphoreGive(expander_mutex);
+
+    if (err == ESP_OK)
+        scope_notify_switch();
+    if (err == ESP_OK && (mask & BIT(GPIO_MAIN)))
+        profile_cancel();
+    return err;
+}
+
+esp_err_t set_buttons(uint8_t which, bool pressed)
+{
+    uint8_t mask = ((which & SW_BUTTON_POWER) ? BIT(GPIO_PWR) : 0) | ((which & SW_BUTTON_RESET) ? BIT(GPIO_RST) : 0);
+
     if (xSemaphoreTake(expander_mutex, MUTEX_TIMEOUT) == pdFALSE)
     {
         ESP_LOGW(TAG, "Control error");
-        return;
+        return ESP_ERR_TIMEOUT;
     }
-    pca9557_set_level(&pca, GPIO_USB, on);
-    load_switch_5v_status = on;
+    esp_err_t err = update_output(mask, pressed ? 0 : mask);
     xSemaphoreGive(expander_mutex);
-    push_eventf(EV_INFO, "usb load switch set: %s", on ? "on" : "off");
-    send_sw_status_message();
+    if (err == ESP_OK && pressed && (which & SW_BUTTON_POWER) && load_switch_12v_status)
+        profile_start(PROFILE_TRIGGER_POWER_BUTTON);
+    return err;
+}
+
+void set_main_load_switch(bool on)
+{
+    ESP_LOGI(TAG, "Set main load switch to %s", on ? "on" : "off");
+    set_load_switches(LOAD_SW_MAIN, on, false);
+}
+
+void set_usb_load_switch(bool on)
+{
+    ESP_LOGI(TAG, "Set usb load switch to %s", on ? "on" : "off");
+    set_load_switches(LOAD_SW_USB, false, on);
 }
 
 bool get_main_load_switch() { return load_switch_12v_status; }
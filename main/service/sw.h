@@ -5,6 +5,15 @@
 #ifndef ODROID_POWER_MATE_SW_H
 #define ODROID_POWER_MATE_SW_H
 #include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define LOAD_SW_MAIN 0x01
+#define LOAD_SW_USB 0x02
+
+#define SW_BUTTON_POWER 0x01
+#define SW_BUTTON_RESET 0x02
 
 void init_sw();
 void config_sw();
@@ -12,6 +21,27 @@ void trig_power();
 void trig_reset();
 void set_main_load_switch(bool on);
 void set_usb_load_switch(bool on);
+
+/**
+ * @brief Sets the load switches selected by `which` (LOAD_SW_MAIN | LOAD_SW_USB) in one expander write, so
+ * both rails change in the same bus cycle. Switches not selected keep their state.
+ */
+esp_err_t set_load_switches(uint8_t which, bool main_on, bool usb_on);
+
+/**
+ * @brief Presses (drives low) or releases the trigger pins in `which` (SW_BUTTON_*) in one expander write.
+ * Unlike trig_power()/trig_reset() nothing releases them automatically.
+ */
+esp_err_t set_buttons(uint8_t which, bool pressed);
+
+/**
+ * @brief Opens the load switches in `which` with one expander write and nothing else, for the overcurrent
+ * fast-trip in the acquisition task. The caller reports the change with send_sw_status_message() later.
+ *
+ * @return ESP_ERR_INVALID_STATE if all of them were already off.
+ */
+esp_err_t trip_load_switches(uint8_t which);
+void send_sw_status_message();
 bool get_main_load_switch();
 bool get_usb_load_switch();
 
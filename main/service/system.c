@@ -8,6 +8,7 @@
 #include <esp_timer.h>
 #include <string.h>
 #include "auth.h"
+#include "energy.h"
 #include "esp_http_server.h"
 #include "esp_system.h"
 
@@ -61,6 +62,7 @@ static esp_err_t reboot_post_handler(httpd_req_t* req)
     const char* resp_str = "{\"status\": \"reboot timer started\"}";
     httpd_resp_send(req, resp_str, strlen(resp_str));
 
+    energy_checkpoint(true); // don't lose up to a checkpoint interval of energy to a requested reboot
     start_reboot_timer(3);
 
     return ESP_OK;
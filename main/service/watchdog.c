@@ -0,0 +1,420 @@
+#include "watchdog.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "auth.h"
+#include "cJSON.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "event.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "nconfig.h"
+#include "sw.h"
+#include "webserver.h"
+
+#define WATCHDOG_CHANNEL INA3221_CHANNEL_2 // MAIN
+#define WATCHDOG_BAND_MAX_MA 5000
+#define WATCHDOG_TASK_PRIORITY 6
+
+static const char* TAG = "watchdog";
+
+static struct watchdog_config config = {
+    .silence_s = 300, .flat_band_ma = 10, .grace_s = 120, .backoff_s = 60, .backoff_max_s = 3600};
+static SemaphoreHandle_t config_mutex;
+
+// Console side, written by the UART polling task
+static volatile uint32_t last_output_ms;
+static volatile bool pattern_enabled;
+static volatile bool pattern_hit;
+static struct pattern_matcher matcher;
+static SemaphoreHandle_t matcher_mutex;
+
+// Current side, the band state is only touched by the acquisition task
+static volatile int32_t flat_band_ua; // 0 = flat detection off
+static volatile bool flat_reset = true;
+static volatile uint32_t flat_since_ms;
+static int32_t flat_min_ua;
+static int32_t flat_max_ua;
+
+// Checker state, reported by watchdog_get_status()
+static volatile bool armed;
+static volatile uint32_t cycles;
+static volatile uint32_t total_cycles;
+static const char* volatile last_reason;
+static volatile uint32_t armed_at_ms;
+
+static uint32_t now_ms(void) { return (uint32_t)(esp_timer_get_time() / 1000); }
+
+// Milliseconds from `since` to `now`, 0 if `since` is later (the counters wrap after 49 days)
+static uint32_t elapsed_ms(uint32_t now, uint32_t since) { return (int32_t)(now - since) > 0 ? now - since : 0; }
+
+void watchdog_uart_feed(const uint8_t* data, size_t len)
+{
+    last_output_ms = now_ms();
+    if (!pattern_enabled)
+        return;
+
+    xSemaphoreTake(matcher_mutex, portMAX_DELAY);
+    if (pattern_feed(&matcher, data, len))
+        pattern_hit = true;
+    xSemaphoreGive(matcher_mutex);
+}
+
+void watchdog_sample(int64_t acquired_us, const int32_t current_ua[INA3221_BUS_NUMBER])
+{
+    int32_t band = flat_band_ua;
+    if (band == 0)
+        return;
+
+    int32_t current = current_ua[WATCHDOG_CHANNEL];
+    if (flat_reset || current < flat_max_ua - band || current > flat_min_ua + band)
+    {
+        // out of the band, the flat stretch starts over at this conversion
+        flat_reset = false;
+        flat_min_ua = current;
+        flat_max_ua = current;
+        flat_since_ms = (uint32_t)(acquired_us / 1000);
+        return;
+    }
+    if (current < flat_min_ua)
+        flat_min_ua = current;
+    if (current > flat_max_ua)
+        flat_max_ua = current;
+}
+
+static uint32_t backoff_s(const struct watchdog_config* c, uint32_t n)
+{
+    if (n == 0)
+        return 0;
+    uint32_t shift = n - 1 < 16 ? n - 1 : 16;
+    uint64_t s = (uint64_t)c->backoff_s << shift;
+    return s < c->backoff_max_s ? (uint32_t)s : c->backoff_max_s;
+}
+
+// Which hang signature matches, NULL while the SBC looks alive
+static const char* detect(const struct watchdog_config* c, uint32_t now)
+{
+    if (pattern_hit)
+        return "console pattern";
+
+    uint32_t since = armed_at_ms;
+    if (c->silence_s && elapsed_ms(now, last_output_ms) >= c->silence_s * 1000 &&
+        elapsed_ms(now, since) >= c->silence_s * 1000)
+        return "console silent";
+    if (c->flat_s && elapsed_ms(now, flat_since_ms) >= c->flat_s * 1000 &&
+        elapsed_ms(now, since) >= c->flat_s * 1000)
+        return "current flat";
+    return NULL;
+}
+
+static void power_cycle(void)
+{
+    if (set_load_switches(LOAD_SW_MAIN, false, false) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to turn MAIN off");
+        return;
+    }
+    vTaskDelay(pdMS_TO_TICKS(WATCHDOG_OFF_MS));
+    if (set_load_switches(LOAD_SW_MAIN, true, false) != ESP_OK)
+        ESP_LOGE(TAG, "Failed to turn MAIN back on");
+}
+
+// Restarts every signature, checks begin `delay_s` from now
+static void rearm(uint32_t delay_s)
+{
+    armed = false;
+    armed_at_ms = now_ms() + delay_s * 1000;
+    pattern_hit = false;
+    flat_reset = true;
+}
+
+static void watchdog_task(void* pvParameters)
+{
+    bool main_was_on = false;
+    uint32_t healthy_since_ms = 0;
+    struct watchdog_config c;
+
+    while (1)
+    {
+        vTaskDelay(pdMS_TO_TICKS(WATCHDOG_CHECK_PERIOD_MS));
+
+        xSemaphoreTake(config_mutex, portMAX_DELAY);
+        c = config;
+        xSemaphoreGive(config_mutex);
+
+        bool main_on = get_main_load_switch();
+        if (!c.enabled || !main_on)
+        {
+            main_was_on = main_on;
+            armed = false;
+            continue;
+        }
+        if (!main_was_on)
+        {
+            // MAIN came up, by us or anyone else
+            main_was_on = true;
+            rearm(c.grace_s + backoff_s(&c, cycles));
+            continue;
+        }
+
+        uint32_t now = now_ms();
+        if ((int32_t)(now - armed_at_ms) < 0)
+            continue;
+        if (!armed)
+        {
+            armed = true;
+            healthy_since_ms = now;
+        }
+
+        const char* reason = detect(&c, now);
+        if (reason == NULL)
+        {
+            if (cycles > 0 && elapsed_ms(now, healthy_since_ms) >= c.backoff_max_s * 1000)
+            {
+                push_eventf(EV_INFO, "watchdog: SBC healthy again after %" PRIu32 " power cycles", cycles);
+                cycles = 0;
+            }
+            continue;
+        }
+
+        cycles++;
+        total_cycles++;
+        last_reason = reason;
+        uint32_t delay_s = c.grace_s + backoff_s(&c, cycles);
+        push_eventf(EV_WARNING, "watchdog: %s, power cycling the SBC (%" PRIu32 " in a row, next check in %" PRIu32 "s)",
+                    reason, cycles, delay_s);
+        ESP_LOGW(TAG, "Hang detected (%s), power cycling", reason);
+
+        power_cycle();
+        rearm(delay_s);
+    }
+}
+
+static void apply_config(const struct watchdog_config* c)
+{
+    xSemaphoreTake(matcher_mutex, portMAX_DELAY);
+    pattern_init(&matcher, c->pattern);
+    pattern_enabled = c->enabled && c->pattern[0] != '\0';
+    pattern_hit = false;
+    xSemaphoreGive(matcher_mutex);
+
+    flat_band_ua = c->enabled && c->flat_s ? (int32_t)c->flat_band_ma * 1000 : 0;
+    flat_reset = true;
+}
+
+esp_err_t watchdog_set_config(const struct watchdog_config* c)
+{
+    if (c->silence_s > WATCHDOG_LIMIT_S || c->flat_s > WATCHDOG_LIMIT_S || c->grace_s > WATCHDOG_LIMIT_S ||
+        c->backoff_s > WATCHDOG_LIMIT_S || c->backoff_max_s > WATCHDOG_LIMIT_S || c->backoff_max_s < c->backoff_s ||
+        c->flat_band_ma == 0 || c->flat_band_ma > WATCHDOG_BAND_MAX_MA ||
+        strnlen(c->pattern, PATTERN_MAX_LEN) >= PATTERN_MAX_LEN)
+        return ESP_ERR_INVALID_ARG;
+
+    char buf[80];
+    snprintf(buf, sizeof(buf), "%d,%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32, c->enabled,
+             c->silence_s, c->flat_s, c->flat_band_ma, c->grace_s, c->backoff_s, c->backoff_max_s);
+    esp_err_t err = nconfig_write(WATCHDOG_CONFIG, buf);
+    if (err == ESP_OK)
+        err = nconfig_write(WATCHDOG_PATTERN, c->pattern);
+    if (err != ESP_OK)
+        return err;
+
+    xSemaphoreTake(config_mutex, portMAX_DELAY);
+    config = *c;
+    xSemaphoreGive(config_mutex);
+    apply_config(c);
+
+    ESP_LOGI(TAG, "Watchdog %s: silence %" PRIu32 "s, flat %" PRIu32 "s/%" PRIu32 "mA, pattern \"%s\"",
+             c->enabled ? "enabled" : "disabled", c->silence_s, c->flat_s, c->flat_band_ma, c->pattern);
+    return ESP_OK;
+}
+
+void watchdog_get_config(struct watchdog_config* c)
+{
+    xSemaphoreTake(config_mutex, portMAX_DELAY);
+    *c = config;
+    xSemaphoreGive(config_mutex);
+}
+
+void watchdog_get_status(struct watchdog_status* status)
+{
+    uint32_t now = now_ms();
+    bool is_armed = armed;
+
+    status->armed = is_armed;
+    status->cycles = cycles;
+    status->total_cycles = total_cycles;
+    status->silent_s = is_armed ? elapsed_ms(now, last_output_ms) / 1000 : 0;
+    status->flat_s = is_armed && flat_band_ua ? elapsed_ms(now, flat_since_ms) / 1000 : 0;
+    status->last_reason = last_reason;
+}
+
+static void load_config(void)
+{
+    char buf[80];
+    struct watchdog_config c = config;
+
+    if (nconfig_read(WATCHDOG_CONFIG, buf, sizeof(buf)) == ESP_OK)
+    {
+        unsigned enabled;
+        if (sscanf(buf, "%u,%" SCNu32 ",%" SCNu32 ",%" SCNu32 ",%" SCNu32 ",%" SCNu32 ",%" SCNu32, &enabled,
+                   &c.silence_s, &c.flat_s, &c.flat_band_ma, &c.grace_s, &c.backoff_s, &c.backoff_max_s) == 7)
+            c.enabled = enabled != 0;
+        else
+            c = config;
+    }
+    if (nconfig_read(WATCHDOG_PATTERN, c.pattern, sizeof(c.pattern)) != ESP_OK)
+        c.pattern[0] = '\0';
+
+    config = c;
+    apply_config(&config);
+}
+
+static esp_err_t watchdog_get_handler(httpd_req_t* req)
+{
+    esp_err_t err = api_auth_check(req);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    struct watchdog_config c;
+    struct watchdog_status status;
+    watchdog_get_config(&c);
+    watchdog_get_status(&status);
+
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "enabled", c.enabled);
+    cJSON_AddNumberToObject(root, "silence_s", c.silence_s);
+    cJSON_AddNumberToObject(root, "flat_s", c.flat_s);
+    cJSON_AddNumberToObject(root, "flat_band_ma", c.flat_band_ma);
+    cJSON_AddStringToObject(root, "pattern", c.pattern);
+    cJSON_AddNumberToObject(root, "grace_s", c.grace_s);
+    cJSON_AddNumberToObject(root, "backoff_s", c.backoff_s);
+    cJSON_AddNumberToObject(root, "backoff_max_s", c.backoff_max_s);
+
+    cJSON* state = cJSON_AddObjectToObject(root, "status");
+    cJSON_AddBoolToObject(state, "armed", status.armed);
+    cJSON_AddNumberToObject(state, "cycles", status.cycles);
+    cJSON_AddNumberToObject(state, "total_cycles", status.total_cycles);
+    cJSON_AddNumberToObject(state, "silent_s", status.silent_s);
+    cJSON_AddNumberToObject(state, "flat_s", status.flat_s);
+    if (status.last_reason)
+        cJSON_AddStringToObject(state, "last_reason", status.last_reason);
+
+    char* json_string = cJSON_Print(root);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_string, strlen(json_string));
+
+    free(json_string);
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+static void read_seconds(const cJSON* root, const char* key, uint32_t* out)
+{
+    const cJSON* item = cJSON_GetObjectItem(root, key);
+    if (cJSON_IsNumber(item) && item->valuedouble >= 0)
+        *out = item->valuedouble > UINT32_MAX ? UINT32_MAX : (uint32_t)item->valuedouble;
+}
+
+/*
+ * POST /api/watchdog
+ * Any subset of {"enabled", "silence_s", "flat_s", "flat_band_ma", "pattern", "grace_s", "backoff_s",
+ * "backoff_max_s"}; fields left out keep their value.
+ */
+static esp_err_t watchdog_post_handler(httpd_req_t* req)
+{
+    esp_err_t err = api_auth_check(req);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    char buf[384];
+    int ret, remaining = req->content_len;
+
+    if (remaining >= sizeof(buf))
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Request content too long");
+        return ESP_FAIL;
+    }
+
+    ret = httpd_req_recv(req, buf, remaining);
+    if (ret <= 0)
+    {
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+        {
+            httpd_resp_send_408(req);
+        }
+        return ESP_FAIL;
+    }
+    buf[ret] = '\0';
+
+    cJSON* root = cJSON_Parse(buf);
+    if (root == NULL)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON format");
+        return ESP_FAIL;
+    }
+
+    struct watchdog_config c;
+    watchdog_get_config(&c);
+
+    cJSON* enabled = cJSON_GetObjectItem(root, "enabled");
+    if (cJSON_IsBool(enabled))
+        c.enabled = cJSON_IsTrue(enabled);
+    read_seconds(root, "silence_s", &c.silence_s);
+    read_seconds(root, "flat_s", &c.flat_s);
+    read_seconds(root, "flat_band_ma", &c.flat_band_ma);
+    read_seconds(root, "grace_s", &c.grace_s);
+    read_seconds(root, "backoff_s", &c.backoff_s);
+    read_seconds(root, "backoff_max_s", &c.backoff_max_s);
+
+    cJSON* pattern = cJSON_GetObjectItem(root, "pattern");
+    bool pattern_ok = true;
+    if (cJSON_IsString(pattern))
+    {
+        pattern_ok = strlen(pattern->valuestring) < sizeof(c.pattern);
+        if (pattern_ok)
+            strcpy(c.pattern, pattern->valuestring);
+    }
+    cJSON_Delete(root);
+
+    if (!pattern_ok || watchdog_set_config(&c) != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid watchdog setting");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_sendstr(req, "{\"status\":\"ok\"}");
+    return ESP_OK;
+}
+
+void register_watchdog_endpoint(httpd_handle_t server)
+{
+    httpd_uri_t get_uri = {
+        .uri = "/api/watchdog", .method = HTTP_GET, .handler = watchdog_get_handler, .user_ctx = NULL};
+    httpd_register_uri_handler(server, &get_uri);
+
+    httpd_uri_t post_uri = {
+        .uri = "/api/watchdog", .method = HTTP_POST, .handler = watchdog_post_handler, .user_ctx = NULL};
+    httpd_register_uri_handler(server, &post_uri);
+}
+
+void init_watchdog(void)
+{
+    config_mutex = xSemaphoreCreateMutex();
+    matcher_mutex = xSemaphoreCreateMutex();
+    load_config();
+    last_output_ms = now_ms();
+
+    xTaskCreate(watchdog_task, "watchdog_task", 1024 * 3, NULL, WATCHDOG_TASK_PRIORITY, NULL);
+}
@@ -0,0 +1,59 @@
+#ifndef ODROID_POWER_MATE_WATCHDOG_H
+#define ODROID_POWER_MATE_WATCHDOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "ina3221.h"
+#include "pattern.h"
+
+#define WATCHDOG_CHECK_PERIOD_MS 1000
+#define WATCHDOG_OFF_MS 2000 // MAIN stays off this long in a power cycle
+#define WATCHDOG_LIMIT_S 86400 // upper bound of every configured time
+
+/**
+ * Hang signatures of the SBC on the MAIN rail. A signature with 0 (or an empty pattern) is disabled.
+ * Nothing is checked until grace_s after MAIN came up, and after each power cycle the SBC gets
+ * backoff_s << (cycles - 1) seconds more, capped at backoff_max_s.
+ */
+struct watchdog_config
+{
+    bool enabled;
+    uint32_t silence_s; // no console output for this long
+    uint32_t flat_s; // MAIN current stayed within flat_band_ma for this long
+    uint32_t flat_band_ma;
+    char pattern[PATTERN_MAX_LEN]; // console output that means the SBC is gone, e.g. "Kernel panic"
+    uint32_t grace_s;
+    uint32_t backoff_s;
+    uint32_t backoff_max_s;
+};
+
+struct watchdog_status
+{
+    bool armed; // MAIN is on and the grace period has passed
+    uint32_t cycles; // consecutive power cycles, reset once the SBC stays healthy for backoff_max_s
+    uint32_t total_cycles;
+    uint32_t silent_s;
+    uint32_t flat_s;
+    const char* last_reason; // NULL before the first power cycle
+};
+
+void init_watchdog(void);
+
+esp_err_t watchdog_set_config(const struct watchdog_config* config);
+void watchdog_get_config(struct watchdog_config* config);
+void watchdog_get_status(struct watchdog_status* status);
+
+/**
+ * @brief Feeds console output, called from the UART polling task for every read.
+ */
+void watchdog_uart_feed(const uint8_t* data, size_t len);
+
+/**
+ * @brief Feeds one conversion, called from the acquisition task.
+ */
+void watchdog_sample(int64_t acquired_us, const int32_t current_ua[INA3221_BUS_NUMBER]);
+
+#endif // ODROID_POWER_MATE_WATCHDOG_H
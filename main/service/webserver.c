@@ -9,11 +9,14 @@
 #include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "i2cbus.h"
 #include "lwip/err.h"
 #include "lwip/sys.h"
 #include "monitor.h"
 #include "nconfig.h"
+#include "sequence.h"
 #include "system.h"
+#include "watchdog.h"
 
 static const char* TAG = "WEBSERVER";
 
@@ -166,11 +169,12 @@ static esp_err_t login_handler(httpd_req_t* req)
 void start_webserver(void)
 {
     auth_init();
+    ESP_ERROR_CHECK(i2c_bus_init()); // before anything below touches the INA3221 or the PCA9557
 
     httpd_handle_t server = NULL;
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.stack_size = 1024 * 8;
-    config.max_uri_handlers = 10;
+    config.max_uri_handlers = 23;
     config.task_priority = 12;
     config.max_open_sockets = 7;
 
@@ -192,8 +196,17 @@ void start_webserver(void)
     register_control_endpoint(server);
     register_reboot_endpoint(server);
     register_version_endpoint(server);
+    register_history_endpoint(server);
+    register_scope_endpoint(server);
+    register_stats_endpoint(server);
+    register_energy_endpoint(server);
+    register_sequence_endpoint(server);
+    register_profile_endpoint(server);
+    register_watchdog_endpoint(server);
 
     init_status_monitor();
+    init_sequencer();
+    init_watchdog();
 
     initialize_dbg_console();
 }
@@ -8,13 +8,65 @@
 #include <stddef.h>
 #include <stdint.h>
 #include "esp_http_server.h"
+#include "wspool.h"
 
 void register_wifi_endpoint(httpd_handle_t server);
 void register_ws_endpoint(httpd_handle_t server);
 void register_control_endpoint(httpd_handle_t server);
-void push_data_to_ws(const uint8_t* data, size_t len);
+// Websocket send queues, the sender only takes a bulk frame while the control lane is empty
+enum ws_lane
+{
+    WS_LANE_CONTROL, // sensor data, events, switch and Wi-Fi status
+    WS_LANE_BULK, // console output and capture-mode sensor batches
+    WS_LANE_COUNT
+};
+
+// State messages kept as a single pending frame each, a newer one replaces the one not yet sent
+enum ws_state_slot
+{
+    WS_STATE_SENSOR,
+    WS_STATE_WIFI,
+    WS_STATE_SWITCH,
+    WS_STATE_COUNT
+};
+
+struct ws_lane_stats
+{
+    uint32_t sent; // messages handed to the clients
+    uint32_t dropped; // messages lost to a full queue or an empty buffer pool
+    uint32_t superseded; // state frames replaced by a newer one before they were sent, control lane only
+};
+
+/**
+ * @brief Takes a pool buffer for a frame, counted as dropped on the lane when the pool is exhausted.
+ */
+struct ws_buffer* ws_alloc_frame(size_t size, enum ws_lane lane);
+/**
+ * @brief Queues an encoded frame for all websocket clients. Takes ownership of buf, also on failure.
+ */
+void ws_send_frame(struct ws_buffer* buf, enum ws_lane lane);
+/**
+ * @brief Puts an encoded state frame into its slot, sent with control lane priority. Takes ownership of buf.
+ */
+void ws_send_state(struct ws_buffer* buf, enum ws_state_slot slot);
+/**
+ * @brief Control lane frames dropped or superseded since boot, reported in SensorData.
+ */
+uint32_t ws_get_dropped_frames(void);
+void ws_get_lane_stats(struct ws_lane_stats stats[WS_LANE_COUNT]);
+/**
+ * @brief Websocket frames sent since boot, each packs one or more length-delimited StatusMessages.
+ */
+uint32_t ws_get_sent_frames(void);
 void register_reboot_endpoint(httpd_handle_t server);
 esp_err_t change_baud_rate(int baud_rate);
 void register_version_endpoint(httpd_handle_t server);
+void register_history_endpoint(httpd_handle_t server);
+void register_scope_endpoint(httpd_handle_t server);
+void register_stats_endpoint(httpd_handle_t server);
+void register_energy_endpoint(httpd_handle_t server);
+void register_sequence_endpoint(httpd_handle_t server);
+void register_profile_endpoint(httpd_handle_t server);
+void register_watchdog_endpoint(httpd_handle_t server);
 
 #endif // ODROID_REMOTE_HTTP_WEBSERVER_H
@@ -12,9 +12,12 @@
 #include "nconfig.h"
 #include "pb.h"
 #include "pb_encode.h"
+#include "sequence.h"
 #include "status.pb.h"
 #include "string.h" // Added for strlen and strncmp
+#include "watchdog.h"
 #include "webserver.h"
+#include "wspool.h"
 
 #define UART_NUM UART_NUM_1
 #define BUF_SIZE (2048)
@@ -22,20 +25,15 @@
 #define UART_RX_PIN CONFIG_GPIO_UART_RX
 #define CHUNK_SIZE (2048)
 #define PB_UART_BUFFER_SIZE (CHUNK_SIZE + 64)
+#define WS_FRAME_TARGET 1400 // with the websocket header this still fits one TCP segment on a 1500 byte MTU
+#define WS_FRAME_SIZE (CONFIG_WS_POOL_LARGE_SIZE + 5) // a single message of any size plus its length prefix
 
 static const char* TAG = "ws-uart";
 
-enum ws_message_type
-{
-    WS_MSG_STATUS,
-    WS_MSG_UART
-};
-
 struct ws_message
 {
-    enum ws_message_type type;
-    uint8_t* data;
-    size_t len;
+    enum ws_lane lane;
+    struct ws_buffer* buf;
 };
 
 struct bytes_arg
@@ -45,9 +43,47 @@ struct bytes_arg
 };
 
 #define MAX_CLIENT 7
-static QueueHandle_t ws_queue;
+static const uint8_t lane_depth[WS_LANE_COUNT] = {16, 8};
+static const char* const lane_names[WS_LANE_COUNT] = {"control", "bulk"};
+static QueueHandle_t ws_queues[WS_LANE_COUNT];
+static TaskHandle_t sender_task_handle;
 static QueueHandle_t uart_event_queue;
 static int client_fds[MAX_CLIENT];
+static struct ws_lane_stats lane_stats[WS_LANE_COUNT];
+static uint32_t frames_sent; // websocket frames, each carrying one or more messages
+static portMUX_TYPE lane_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct ws_buffer* state_slots[WS_STATE_COUNT]; // newest unsent state frame of each kind
+static portMUX_TYPE state_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void count_dropped(enum ws_lane lane)
+{
+    portENTER_CRITICAL(&lane_stats_lock);
+    lane_stats[lane].dropped++;
+    portEXIT_CRITICAL(&lane_stats_lock);
+}
+
+static size_t varint_size(size_t value)
+{
+    size_t size = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static size_t put_varint(uint8_t* out, size_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80)
+    {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
 
 static bool encode_bytes_callback(pb_ostream_t* stream, const pb_field_t* field, void* const* arg)
 {
@@ -59,57 +95,118 @@ static bool encode_bytes_callback(pb_ostream_t* stream, const pb_field_t* field,
     return pb_encode_string(stream, (uint8_t*)br->data, br->len);
 }
 
+static bool take_state_frame(struct ws_message* msg)
+{
+    bool found = false;
+
+    portENTER_CRITICAL(&state_lock);
+    for (int slot = 0; slot < WS_STATE_COUNT && !found; slot++)
+    {
+        if (state_slots[slot])
+        {
+            msg->lane = WS_LANE_CONTROL;
+            msg->buf = state_slots[slot];
+            state_slots[slot] = NULL;
+            found = true;
+        }
+    }
+    portEXIT_CRITICAL(&state_lock);
+    return found;
+}
+
+// Strict priority: control queue, then the state slots, and the bulk lane only when both are empty
+static bool receive_frame(struct ws_message* msg)
+{
+    if (xQueueReceive(ws_queues[WS_LANE_CONTROL], msg, 0) == pdPASS)
+        return true;
+    if (take_state_frame(msg))
+        return true;
+    return xQueueReceive(ws_queues[WS_LANE_BULK], msg, 0) == pdPASS;
+}
+
+// Sends one frame to every websocket client, returns false when nobody is connected
+static bool send_to_clients(httpd_handle_t server, uint8_t* data, size_t len)
+{
+    size_t clients = MAX_CLIENT;
+    if (httpd_get_client_list(server, &clients, client_fds) != ESP_OK || clients == 0)
+        return false;
+
+    httpd_ws_frame_t ws_pkt = {0};
+    ws_pkt.payload = data;
+    ws_pkt.len = len;
+    ws_pkt.type = HTTPD_WS_TYPE_BINARY;
+
+    for (size_t i = 0; i < clients; ++i)
+    {
+        int fd = client_fds[i];
+        if (httpd_ws_get_fd_info(server, fd) == HTTPD_WS_CLIENT_WEBSOCKET)
+        {
+            esp_err_t err = httpd_ws_send_frame_async(server, fd, &ws_pkt);
+            if (err != ESP_OK)
+            {
+                ESP_LOGW(TAG, "unified_ws_sender_task: async send failed for fd %d, error: %s", fd,
+                         esp_err_to_name(err));
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Everything queued is packed into as few websocket frames as possible, each message prefixed with its
+ * length as a protobuf varint. A frame is closed once it reaches WS_FRAME_TARGET or the next message
+ * would push it past that, a larger message (a UART chunk) goes out in a frame of its own.
+ */
 static void unified_ws_sender_task(void* arg)
 {
+    static uint8_t frame[WS_FRAME_SIZE];
     httpd_handle_t server = (httpd_handle_t)arg;
     struct ws_message msg;
+    bool held = false; // msg did not fit into the previous frame
 
     while (1)
     {
-        if (xQueueReceive(ws_queue, &msg, portMAX_DELAY))
+        // producers notify after every queued frame, so nothing queued before the wait is missed
+        if (!held && !receive_frame(&msg))
         {
-            size_t clients = MAX_CLIENT;
-            if (httpd_get_client_list(server, &clients, client_fds) != ESP_OK)
-            {
-                free(msg.data);
-                continue;
-            }
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        held = false;
 
-            if (clients == 0)
+        size_t len = 0;
+        uint32_t packed[WS_LANE_COUNT] = {0};
+        do
+        {
+            size_t need = varint_size(msg.buf->len) + msg.buf->len;
+            if (len > 0 && len + need > WS_FRAME_TARGET)
             {
-                free(msg.data);
-                continue;
+                held = true;
+                break;
             }
 
-            httpd_ws_frame_t ws_pkt = {0};
-            ws_pkt.payload = msg.data;
-            ws_pkt.len = msg.len;
-            ws_pkt.type = HTTPD_WS_TYPE_BINARY;
+            len += put_varint(frame + len, msg.buf->len);
+            memcpy(frame + len, msg.buf->data, msg.buf->len);
+            len += msg.buf->len;
+            packed[msg.lane]++;
+            ws_buffer_free(msg.buf);
+        } while (len < WS_FRAME_TARGET && receive_frame(&msg));
 
-            for (size_t i = 0; i < clients; ++i)
-            {
-                int fd = client_fds[i];
-                if (httpd_ws_get_fd_info(server, fd) == HTTPD_WS_CLIENT_WEBSOCKET)
-                {
-                    esp_err_t err = httpd_ws_send_frame_async(server, fd, &ws_pkt);
-                    if (err != ESP_OK)
-                    {
-                        ESP_LOGW(TAG, "unified_ws_sender_task: async send failed for fd %d, error: %s", fd,
-                                 esp_err_to_name(err));
-                    }
-                }
-            }
-            free(msg.data);
+        if (send_to_clients(server, frame, len))
+        {
+            portENTER_CRITICAL(&lane_stats_lock);
+            for (int lane = 0; lane < WS_LANE_COUNT; lane++)
+                lane_stats[lane].sent += packed[lane];
+            frames_sent++;
+            portEXIT_CRITICAL(&lane_stats_lock);
         }
     }
-    free(client_fds);
     vTaskDelete(NULL);
 }
 
 static void uart_polling_task(void* arg)
 {
     static uint8_t data_buf[BUF_SIZE];
-    static uint8_t pb_buffer[PB_UART_BUFFER_SIZE];
 
     while (1)
     {
@@ -127,6 +224,9 @@ static void uart_polling_task(void* arg)
 
         if (bytes_read > 0)
         {
+            sequence_uart_feed(data_buf, bytes_read);
+            watchdog_uart_feed(data_buf, bytes_read);
+
             size_t offset = 0;
             while (offset < bytes_read)
             {
@@ -138,33 +238,23 @@ static void uart_polling_task(void* arg)
                 message.payload.uart_data.data.funcs.encode = &encode_bytes_callback;
                 message.payload.uart_data.data.arg = &a;
 
-                pb_ostream_t stream = pb_ostream_from_buffer(pb_buffer, sizeof(pb_buffer));
-                if (!pb_encode(&stream, StatusMessage_fields, &message))
+                struct ws_buffer* buf = ws_alloc_frame(PB_UART_BUFFER_SIZE, WS_LANE_BULK);
+                if (!buf)
                 {
-                    ESP_LOGE(TAG, "Failed to encode uart data: %s", PB_GET_ERROR(&stream));
                     offset += chunk_size;
                     continue;
                 }
 
-                struct ws_message msg;
-                msg.type = WS_MSG_UART;
-                msg.len = stream.bytes_written;
-                msg.data = malloc(msg.len);
-
-                if (!msg.data)
+                pb_ostream_t stream = pb_ostream_from_buffer(buf->data, buf->size);
+                if (!pb_encode(&stream, StatusMessage_fields, &message))
                 {
-                    ESP_LOGE(TAG, "Failed to allocate memory for uart ws msg");
+                    ESP_LOGE(TAG, "Failed to encode uart data: %s", PB_GET_ERROR(&stream));
+                    ws_buffer_free(buf);
                     offset += chunk_size;
                     continue;
                 }
-
-                memcpy(msg.data, pb_buffer, msg.len);
-
-                if (xQueueSend(ws_queue, &msg, pdMS_TO_TICKS(10)) != pdPASS)
-                {
-                    ESP_LOGW(TAG, "ws sender queue full, dropping %zu bytes", chunk_size);
-                    free(msg.data);
-                }
+                buf->len = stream.bytes_written;
+                ws_send_frame(buf, WS_LANE_BULK);
 
                 offset += chunk_size;
             }
@@ -326,31 +416,79 @@ void register_ws_endpoint(httpd_handle_t server)
     httpd_uri_t ws = {.uri = "/ws", .method = HTTP_GET, .handler = ws_handler, .user_ctx = NULL, .is_websocket = true};
     httpd_register_uri_handler(server, &ws);
 
-    ws_queue = xQueueCreate(10, sizeof(struct ws_message));
+    for (int lane = 0; lane < WS_LANE_COUNT; lane++)
+        ws_queues[lane] = xQueueCreate(lane_depth[lane], sizeof(struct ws_message));
 
+    xTaskCreate(unified_ws_sender_task, "ws_sender_task", 1024 * 6, server, 9, &sender_task_handle);
     xTaskCreate(uart_polling_task, "uart_polling_task", 1024 * 4, NULL, 8, NULL);
-    xTaskCreate(unified_ws_sender_task, "ws_sender_task", 1024 * 6, server, 9, NULL);
     xTaskCreate(uart_event_task, "uart_event_task", 1024 * 2, NULL, 10, NULL);
 }
 
-void push_data_to_ws(const uint8_t* data, size_t len)
+struct ws_buffer* ws_alloc_frame(size_t size, enum ws_lane lane)
 {
-    struct ws_message msg;
-    msg.type = WS_MSG_STATUS;
-    msg.data = malloc(len);
-    if (!msg.data)
+    struct ws_buffer* buf = ws_buffer_alloc(size);
+    if (!buf)
+    {
+        ESP_LOGW(TAG, "WS buffer pool empty, dropping %s frame", lane_names[lane]);
+        count_dropped(lane);
+    }
+    return buf;
+}
+
+void ws_send_frame(struct ws_buffer* buf, enum ws_lane lane)
+{
+    struct ws_message msg = {.lane = lane, .buf = buf};
+
+    if (xQueueSend(ws_queues[lane], &msg, pdMS_TO_TICKS(10)) != pdPASS)
     {
-        ESP_LOGE(TAG, "Failed to allocate memory for status ws msg");
+        ESP_LOGW(TAG, "WS %s queue full, dropping %zu bytes", lane_names[lane], buf->len);
+        ws_buffer_free(buf);
+        count_dropped(lane);
         return;
     }
-    memcpy(msg.data, data, len);
-    msg.len = len;
+    if (sender_task_handle)
+        xTaskNotifyGive(sender_task_handle);
+}
+
+void ws_send_state(struct ws_buffer* buf, enum ws_state_slot slot)
+{
+    portENTER_CRITICAL(&state_lock);
+    struct ws_buffer* stale = state_slots[slot];
+    state_slots[slot] = buf;
+    portEXIT_CRITICAL(&state_lock);
 
-    if (xQueueSend(ws_queue, &msg, pdMS_TO_TICKS(10)) != pdPASS)
+    if (stale)
     {
-        ESP_LOGW(TAG, "WS queue full, dropping status message");
-        free(msg.data);
+        ws_buffer_free(stale);
+        portENTER_CRITICAL(&lane_stats_lock);
+        lane_stats[WS_LANE_CONTROL].superseded++;
+        portEXIT_CRITICAL(&lane_stats_lock);
     }
+    if (sender_task_handle)
+        xTaskNotifyGive(sender_task_handle);
+}
+
+uint32_t ws_get_dropped_frames(void)
+{
+    portENTER_CRITICAL(&lane_stats_lock);
+    uint32_t count = lane_stats[WS_LANE_CONTROL].dropped + lane_stats[WS_LANE_CONTROL].superseded;
+    portEXIT_CRITICAL(&lane_stats_lock);
+    return count;
+}
+
+void ws_get_lane_stats(struct ws_lane_stats stats[WS_LANE_COUNT])
+{
+    portENTER_CRITICAL(&lane_stats_lock);
+    memcpy(stats, lane_stats, sizeof(lane_stats));
+    portEXIT_CRITICAL(&lane_stats_lock);
+}
+
+uint32_t ws_get_sent_frames(void)
+{
+    portENTER_CRITICAL(&lane_stats_lock);
+    uint32_t count = frames_sent;
+    portEXIT_CRITICAL(&lane_stats_lock);
+    return count;
 }
 
 esp_err_t change_baud_rate(int baud_rate) { return uart_set_baudrate(UART_NUM, baud_rate); }
\ No newline at end of file
@@ -0,0 +1,111 @@
+#include "wspool.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+#define SMALL_COUNT CONFIG_WS_POOL_SMALL_COUNT
+#define SMALL_SIZE CONFIG_WS_POOL_SMALL_SIZE
+#define LARGE_COUNT CONFIG_WS_POOL_LARGE_COUNT
+#define LARGE_SIZE CONFIG_WS_POOL_LARGE_SIZE
+
+// Statically reserved so a UART flood can not fragment the heap
+static uint8_t small_storage[SMALL_COUNT][SMALL_SIZE];
+static uint8_t large_storage[LARGE_COUNT][LARGE_SIZE];
+static struct ws_buffer small_buffers[SMALL_COUNT];
+static struct ws_buffer large_buffers[LARGE_COUNT];
+
+// Free buffers of a class are kept as a stack of indices
+struct pool_class
+{
+    struct ws_buffer* buffers;
+    uint8_t* free_stack;
+    uint8_t free_count;
+    struct ws_pool_class_stats stats;
+};
+
+static uint8_t small_free[SMALL_COUNT];
+static uint8_t large_free[LARGE_COUNT];
+static struct pool_class classes[WS_POOL_CLASSES];
+static bool initialized;
+static portMUX_TYPE pool_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void init_class(struct pool_class* cls, uint8_t id, struct ws_buffer* buffers, uint8_t* free_stack,
+                       uint8_t* storage, size_t size, uint8_t count)
+{
+    cls->buffers = buffers;
+    cls->free_stack = free_stack;
+    cls->free_count = count;
+    memset(&cls->stats, 0, sizeof(cls->stats));
+    cls->stats.size = size;
+    cls->stats.count = count;
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        buffers[i] = (struct ws_buffer){.data = storage + (size_t)i * size, .size = size, .pool_class = id, .index = i};
+        free_stack[i] = count - 1 - i;
+    }
+}
+
+// Must be called with pool_lock held
+static void init_pool()
+{
+    init_class(&classes[0], 0, small_buffers, small_free, &small_storage[0][0], SMALL_SIZE, SMALL_COUNT);
+    init_class(&classes[1], 1, large_buffers, large_free, &large_storage[0][0], LARGE_SIZE, LARGE_COUNT);
+    initialized = true;
+}
+
+struct ws_buffer* ws_buffer_alloc(size_t size)
+{
+    struct ws_buffer* buf = NULL;
+
+    portENTER_CRITICAL(&pool_lock);
+    if (!initialized)
+        init_pool();
+
+    struct pool_class* home = NULL; // smallest class the request fits in
+    for (uint8_t c = 0; c < WS_POOL_CLASSES && !buf; c++)
+    {
+        struct pool_class* cls = &classes[c];
+        if (cls->stats.size < size)
+            continue;
+        if (!home)
+            home = cls;
+        if (cls->free_count == 0)
+            continue;
+
+        buf = &cls->buffers[cls->free_stack[--cls->free_count]];
+        buf->len = 0;
+        cls->stats.in_use++;
+        if (cls->stats.in_use > cls->stats.high_water)
+            cls->stats.high_water = cls->stats.in_use;
+    }
+    if (!buf && home)
+        home->stats.alloc_failures++;
+    portEXIT_CRITICAL(&pool_lock);
+
+    return buf;
+}
+
+void ws_buffer_free(struct ws_buffer* buf)
+{
+    if (!buf)
+        return;
+
+    portENTER_CRITICAL(&pool_lock);
+    struct pool_class* cls = &classes[buf->pool_class];
+    cls->free_stack[cls->free_count++] = buf->index;
+    cls->stats.in_use--;
+    portEXIT_CRITICAL(&pool_lock);
+}
+
+void ws_pool_get_stats(struct ws_pool_stats* stats)
+{
+    portENTER_CRITICAL(&pool_lock);
+    if (!initialized)
+        init_pool();
+    for (uint8_t c = 0; c < WS_POOL_CLASSES; c++)
+        stats->classes[c] = classes[c].stats;
+    portEXIT_CRITICAL(&pool_lock);
+}
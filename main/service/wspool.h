@@ -0,0 +1,48 @@
+#ifndef ODROID_POWER_MATE_WSPOOL_H
+#define ODROID_POWER_MATE_WSPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WS_POOL_CLASSES 2 // small: status messages, large: UART chunks and sensor batches
+
+/**
+ * A websocket frame buffer from the fixed pool. Producers encode straight into data and hand the
+ * buffer to the websocket sender, which returns it to the pool once every client has been served.
+ */
+struct ws_buffer
+{
+    uint8_t* data;
+    size_t size; // capacity of data
+    size_t len; // bytes in use
+    uint8_t pool_class;
+    uint8_t index;
+};
+
+struct ws_pool_class_stats
+{
+    size_t size;
+    uint8_t count;
+    uint8_t in_use;
+    uint8_t high_water; // most buffers in use at once since boot
+    uint32_t alloc_failures; // requests for this class that found the whole pool in use
+};
+
+struct ws_pool_stats
+{
+    struct ws_pool_class_stats classes[WS_POOL_CLASSES];
+};
+
+/**
+ * @brief Takes a buffer of at least size bytes, from the large class when the small one is used up.
+ *        Safe to call from any task, never blocks.
+ *
+ * @return The buffer with len = 0, or NULL when no buffer of that size is free.
+ */
+struct ws_buffer* ws_buffer_alloc(size_t size);
+
+void ws_buffer_free(struct ws_buffer* buf);
+
+void ws_pool_get_stats(struct ws_pool_stats* stats);
+
+#endif // ODROID_POWER_MATE_WSPOOL_H
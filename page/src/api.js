@@ -134,6 +134,60 @@ export async function postPeriodSetting(period) {
     return await handleResponse(response);
 }
 
+/**
+ * Enables or disables the high-rate capture mode.
+ * @param {boolean} capture Whether the sensor should sample at its hardware limit.
+ * @returns {Promise<Response>} A promise that resolves to the raw fetch response.
+ */
+export async function postCaptureSetting(capture) {
+    const response = await fetch('/api/setting', {
+        method: 'POST',
+        headers: {
+            'Content-Type': 'application/json',
+            ...getAuthHeaders(),
+        },
+        body: JSON.stringify({ capture }),
+    });
+    return await handleResponse(response);
+}
+
+/**
+ * Configures the adaptive sensor rate.
+ * @param {boolean} adaptive Whether the publish rate should follow signal activity.
+ * @param {number} threshold Per-channel current change in mA that counts as activity.
+ * @returns {Promise<Response>} A promise that resolves to the raw fetch response.
+ */
+export async function postAdaptiveSetting(adaptive, threshold) {
+    const response = await fetch('/api/setting', {
+        method: 'POST',
+        headers: {
+            'Content-Type': 'application/json',
+            ...getAuthHeaders(),
+        },
+        body: JSON.stringify({ adaptive, adaptive_threshold: threshold }),
+    });
+    return await handleResponse(response);
+}
+
+/**
+ * Sets the sensor averaging and conversion times.
+ * @param {number} averaging Samples averaged per conversion.
+ * @param {number} busCt Bus voltage conversion time in microseconds.
+ * @param {number} shuntCt Shunt voltage conversion time in microseconds.
+ * @returns {Promise<Response>} A promise that resolves to the raw fetch response.
+ */
+export async function postConversionSetting(averaging, busCt, shuntCt) {
+    const response = await fetch('/api/setting', {
+        method: 'POST',
+        headers: {
+            'Content-Type': 'application/json',
+            ...getAuthHeaders(),
+        },
+        body: JSON.stringify({ averaging, bus_ct: busCt, shunt_ct: shuntCt }),
+    });
+    return await handleResponse(response);
+}
+
 /**
  * Fetches the current network settings and Wi-Fi status from the server.
  * @returns {Promise<Object>} A promise that resolves to an object containing the current settings.
@@ -176,6 +230,32 @@ export async function postControlCommand(command) {
     return await handleResponse(response);
 }
 
+/**
+ * Zeroes the device's charge and energy counters of every channel.
+ * @returns {Promise<Response>} A promise that resolves to the raw fetch response.
+ * @throws {Error} Throws an error if the request fails.
+ */
+export async function resetEnergy() {
+    const response = await fetch('/api/energy', {
+        method: 'POST',
+        headers: getAuthHeaders(),
+    });
+    return await handleResponse(response);
+}
+
+/**
+ * Fetches the most recent samples kept in the device's history buffer.
+ * @param {number} count The maximum number of samples to return (newest first are kept).
+ * @returns {Promise<ArrayBuffer>} A promise that resolves to an encoded SensorHistory protobuf message.
+ * @throws {Error} Throws an error if the network request fails.
+ */
+export async function fetchHistory(count) {
+    const response = await fetch(`/api/history?count=${count}`, {
+        headers: getAuthHeaders(),
+    });
+    return await handleResponse(response).then(res => res.arrayBuffer());
+}
+
 /**
  * Fetches the firmware version from the server.
  * @returns {Promise<Object>} A promise that resolves to an object containing the version.
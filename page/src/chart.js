@@ -25,7 +25,7 @@ const scaleConfig = {
 };
 
 const channelKeys = ['USB', 'MAIN', 'VIN'];
-const CHART_DATA_POINTS = 30; // Number of data points to display on the chart
+export const CHART_DATA_POINTS = 30; // Number of data points to display on the chart
 
 /**
  * Creates an array of empty labels for initial chart rendering.
@@ -223,6 +223,21 @@ export function updateCharts(data) {
     updateSingleChart(charts.current, 'current', data, timeLabel);
 }
 
+/**
+ * Replaces the chart contents with historical samples, e.g. the on-device history fetched after a reconnect.
+ * @param {Array<Object>} samples - Sensor data objects (oldest first) in the shape updateCharts() expects.
+ */
+export function backfillCharts(samples) {
+    Object.values(charts).forEach(chart => {
+        if (!chart) return;
+        chart.data.labels = initialLabels();
+        chart.data.datasets.forEach(dataset => {
+            dataset.data = initialData();
+        });
+    });
+    samples.slice(-CHART_DATA_POINTS).forEach(updateCharts);
+}
+
 /**
  * Resizes all chart canvases. This is typically called on window resize events.
  */
@@ -16,7 +16,10 @@ export const resetButton = document.getElementById('reset-button');
 export const powerActionButton = document.getElementById('power-action-button');
 export const voltageDisplay = document.getElementById('voltage-display');
 export const currentDisplay = document.getElementById('current-display');
+export const currentPeakDisplay = document.getElementById('current-peak-display');
 export const powerDisplay = document.getElementById('power-display');
+export const energyDisplay = document.getElementById('energy-display');
+export const energyResetButton = document.getElementById('energy-reset-button');
 export const uptimeDisplay = document.getElementById('uptime-display');
 
 // --- Terminal Elements ---
@@ -83,6 +86,15 @@ export const baudRateApplyButton = document.getElementById('baud-rate-apply-butt
 export const periodSlider = document.getElementById('period-slider');
 export const periodValue = document.getElementById('period-value');
 export const periodApplyButton = document.getElementById('period-apply-button');
+export const captureToggle = document.getElementById('capture-toggle');
+export const adaptiveToggle = document.getElementById('adaptive-toggle');
+export const adaptiveThresholdInput = document.getElementById('adaptive-threshold-input');
+export const adaptiveApplyButton = document.getElementById('adaptive-apply-button');
+export const averagingSelect = document.getElementById('averaging-select');
+export const busCtSelect = document.getElementById('bus-ct-select');
+export const shuntCtSelect = document.getElementById('shunt-ct-select');
+export const sampleRateValue = document.getElementById('sample-rate-value');
+export const conversionApplyButton = document.getElementById('conversion-apply-button');
 export const rebootButton = document.getElementById('reboot-button');
 
 // --- Current Limit Settings Elements ---
@@ -92,6 +104,19 @@ export const mainSlider = document.getElementById('main-current-limit-slider');
 export const mainValueSpan = document.getElementById('main-current-limit-value');
 export const usbSlider = document.getElementById('usb-current-limit-slider');
 export const usbValueSpan = document.getElementById('usb-current-limit-value');
+export const vinWarningSlider = document.getElementById('vin-warning-limit-slider');
+export const vinWarningValueSpan = document.getElementById('vin-warning-limit-value');
+export const mainWarningSlider = document.getElementById('main-warning-limit-slider');
+export const mainWarningValueSpan = document.getElementById('main-warning-limit-value');
+export const usbWarningSlider = document.getElementById('usb-warning-limit-slider');
+export const usbWarningValueSpan = document.getElementById('usb-warning-limit-value');
+export const vinTripSlider = document.getElementById('vin-trip-limit-slider');
+export const vinTripValueSpan = document.getElementById('vin-trip-limit-value');
+export const mainTripSlider = document.getElementById('main-trip-limit-slider');
+export const mainTripValueSpan = document.getElementById('main-trip-limit-value');
+export const usbTripSlider = document.getElementById('usb-trip-limit-slider');
+export const usbTripValueSpan = document.getElementById('usb-trip-limit-value');
+export const tripSamplesInput = document.getElementById('trip-samples-input');
 export const currentLimitApplyButton = document.getElementById('current-limit-apply-button');
 
 // --- Footer ---
@@ -47,6 +47,33 @@ function loadCurrentLimitSettings() {
                 dom.usbSlider.value = data.usb_current_limit;
                 updateSliderValue(dom.usbSlider, dom.usbValueSpan);
             }
+            if (data.vin_warning_limit !== undefined) {
+                dom.vinWarningSlider.value = data.vin_warning_limit;
+                updateSliderValue(dom.vinWarningSlider, dom.vinWarningValueSpan);
+            }
+            if (data.main_warning_limit !== undefined) {
+                dom.mainWarningSlider.value = data.main_warning_limit;
+                updateSliderValue(dom.mainWarningSlider, dom.mainWarningValueSpan);
+            }
+            if (data.usb_warning_limit !== undefined) {
+                dom.usbWarningSlider.value = data.usb_warning_limit;
+                updateSliderValue(dom.usbWarningSlider, dom.usbWarningValueSpan);
+            }
+            if (data.vin_trip_limit !== undefined) {
+                dom.vinTripSlider.value = data.vin_trip_limit;
+                updateSliderValue(dom.vinTripSlider, dom.vinTripValueSpan);
+            }
+            if (data.main_trip_limit !== undefined) {
+                dom.mainTripSlider.value = data.main_trip_limit;
+                updateSliderValue(dom.mainTripSlider, dom.mainTripValueSpan);
+            }
+            if (data.usb_trip_limit !== undefined) {
+                dom.usbTripSlider.value = data.usb_trip_limit;
+                updateSliderValue(dom.usbTripSlider, dom.usbTripValueSpan);
+            }
+            if (data.trip_samples !== undefined) {
+                dom.tripSamplesInput.value = data.trip_samples;
+            }
         })
         .catch(error => console.error('Error fetching current limit settings:', error));
 }
@@ -70,6 +97,11 @@ export function setupEventListeners() {
     dom.usbPowerToggle.addEventListener('change', () => api.postControlCommand({'load_5v_on': dom.usbPowerToggle.checked}).then(ui.updateControlStatus));
     dom.resetButton.addEventListener('click', () => api.postControlCommand({'reset_trigger': true}));
     dom.powerActionButton.addEventListener('click', () => api.postControlCommand({'power_trigger': true}));
+    dom.energyResetButton.addEventListener('click', () => {
+        if (confirm('Reset the energy counters of all channels?')) {
+            api.resetEnergy().catch(error => console.error('Error resetting energy counters:', error));
+        }
+    });
 
     // --- Settings Modal Controls ---
     dom.scanWifiButton.addEventListener('click', ui.scanForWifi);
@@ -78,6 +110,11 @@ export function setupEventListeners() {
     dom.apModeApplyButton.addEventListener('click', ui.applyApModeSettings);
     dom.baudRateApplyButton.addEventListener('click', ui.applyBaudRateSettings);
     dom.periodApplyButton.addEventListener('click', ui.applyPeriodSettings);
+    dom.captureToggle.addEventListener('change', ui.applyCaptureSetting);
+    dom.adaptiveApplyButton.addEventListener('click', ui.applyAdaptiveSettings);
+    dom.conversionApplyButton.addEventListener('click', ui.applyConversionSettings);
+    [dom.averagingSelect, dom.busCtSelect, dom.shuntCtSelect].forEach(select =>
+        select.addEventListener('change', ui.updateSampleRate));
 
     // --- Device Settings (Reboot & Period Slider) ---
     if (dom.rebootButton) {
@@ -112,12 +149,25 @@ export function setupEventListeners() {
     dom.vinSlider.addEventListener('input', () => updateSliderValue(dom.vinSlider, dom.vinValueSpan));
     dom.mainSlider.addEventListener('input', () => updateSliderValue(dom.mainSlider, dom.mainValueSpan));
     dom.usbSlider.addEventListener('input', () => updateSliderValue(dom.usbSlider, dom.usbValueSpan));
+    dom.vinWarningSlider.addEventListener('input', () => updateSliderValue(dom.vinWarningSlider, dom.vinWarningValueSpan));
+    dom.mainWarningSlider.addEventListener('input', () => updateSliderValue(dom.mainWarningSlider, dom.mainWarningValueSpan));
+    dom.usbWarningSlider.addEventListener('input', () => updateSliderValue(dom.usbWarningSlider, dom.usbWarningValueSpan));
+    dom.vinTripSlider.addEventListener('input', () => updateSliderValue(dom.vinTripSlider, dom.vinTripValueSpan));
+    dom.mainTripSlider.addEventListener('input', () => updateSliderValue(dom.mainTripSlider, dom.mainTripValueSpan));
+    dom.usbTripSlider.addEventListener('input', () => updateSliderValue(dom.usbTripSlider, dom.usbTripValueSpan));
 
     dom.currentLimitApplyButton.addEventListener('click', () => {
         const settings = {
             vin_current_limit: parseFloat(dom.vinSlider.value),
             main_current_limit: parseFloat(dom.mainSlider.value),
-            usb_current_limit: parseFloat(dom.usbSlider.value)
+            usb_current_limit: parseFloat(dom.usbSlider.value),
+            vin_warning_limit: parseFloat(dom.vinWarningSlider.value),
+            main_warning_limit: parseFloat(dom.mainWarningSlider.value),
+            usb_warning_limit: parseFloat(dom.usbWarningSlider.value),
+            vin_trip_limit: parseFloat(dom.vinTripSlider.value),
+            main_trip_limit: parseFloat(dom.mainTripSlider.value),
+            usb_trip_limit: parseFloat(dom.usbTripSlider.value),
+            trip_samples: parseInt(dom.tripSamplesInput.value, 10)
         };
 
         fetch('/api/setting', {
@@ -11,7 +11,7 @@ import 'bootstrap-icons/font/bootstrap-icons.css';
 import './style.css';
 
 // --- Module Imports -- -
-import {StatusMessage} from './proto.js';
+import {SensorChannelFixed, SensorHistory, StatusMessage} from './proto.js';
 import * as api from './api.js';
 import {initWebSocket} from './websocket.js';
 import {setupTerminal, term} from './terminal.js';
@@ -28,12 +28,16 @@ import {
     updateWifiStatusUI
 } from './ui.js';
 import {setupEventListeners} from './events.js';
+import {backfillCharts, CHART_DATA_POINTS} from './chart.js';
 
 // --- Globals ---
 // StatusMessage is imported directly from the generated proto.js file.
 let isRecording = false;
 let recordedData = [];
 let recordedEvents = [];
+let recordedSamples = []; // individual conversions from SensorBatch messages, only sent in capture mode
+let lastSequence = null; // sequence of the last live SensorData, for gap detection
+let nextBatchSequence = null; // sequence the next SensorBatch should start with
 
 // --- DOM Elements ---
 const loginContainer = document.getElementById('login-container');
@@ -66,25 +70,166 @@ const downloadEventsCsvButton = document.getElementById('download-events-csv-but
 function onWsOpen() {
     updateWebsocketStatus(true);
     console.log('Connected to WebSocket Server');
+    backfillHistory();
+}
+
+/**
+ * Converts a SensorChannelFixed message from micro-units into volts, amps, watts, amp-hours and watt-hours.
+ * A missing channel reads as all zeros.
+ * @param {Object} [channel] - The decoded SensorChannelFixed message.
+ * @returns {Object} The channel values as floats.
+ */
+function fromFixedChannel(channel) {
+    if (!channel) {
+        channel = SensorChannelFixed.create();
+    }
+    return {
+        voltage: channel.voltageUv / 1e6,
+        current: channel.currentUa / 1e6,
+        power: channel.powerUw / 1e6,
+        voltageMin: channel.voltageMinUv / 1e6,
+        voltageMax: channel.voltageMaxUv / 1e6,
+        currentMin: channel.currentMinUa / 1e6,
+        currentMax: channel.currentMaxUa / 1e6,
+        currentRms: channel.currentRmsUa / 1e6,
+        powerMax: channel.powerMaxUw / 1e6,
+        chargeAh: Number(channel.chargeUah) / 1e6,
+        energyWh: Number(channel.energyUwh) / 1e6
+    };
+}
+
+/**
+ * Converts a decoded SensorData message into the payload used by the sensor UI and the recorder.
+ * @param {Object} sensorData - The decoded SensorData message.
+ * @returns {Object} The sensor payload.
+ */
+function toSensorPayload(sensorData) {
+    return {
+        USB: fromFixedChannel(sensorData.usbFixed),
+        MAIN: fromFixedChannel(sensorData.mainFixed),
+        VIN: fromFixedChannel(sensorData.vinFixed),
+        timestamp: sensorData.timestampMs,
+        uptime: sensorData.uptimeMs,
+        sampleCount: sensorData.sampleCount,
+        sequence: sensorData.sequence,
+        acquiredUs: sensorData.acquiredUs,
+        missed: 0
+    };
+}
+
+/**
+ * Refills the charts from the device's sample history so they are not empty after a (re)connect.
+ */
+async function backfillHistory() {
+    try {
+        const buffer = await api.fetchHistory(CHART_DATA_POINTS);
+        const history = SensorHistory.decode(new Uint8Array(buffer));
+        backfillCharts(history.samples.map(toSensorPayload));
+    } catch (error) {
+        console.error('Error fetching sensor history:', error);
+    }
+}
+
+/**
+ * Counts the conversions missing between the previous live message and this one, using the
+ * device's sample sequence number. Frames dropped by the device or lost in transit show up here.
+ * @param {Object} sensorData - The decoded SensorData message.
+ * @returns {number} Conversions missing before this message.
+ */
+function checkSequenceGap(sensorData) {
+    const sequence = sensorData.sequence >>> 0;
+    if (!sequence) {
+        return 0;
+    }
+
+    let missed = 0;
+    if (lastSequence !== null) {
+        missed = (sequence - lastSequence - sensorData.sampleCount) >>> 0;
+        if (missed > 0x7fffffff) {
+            missed = 0; // sequence restarted, the device rebooted
+        } else if (missed) {
+            console.warn(`Sensor gap: ${missed} conversions missing before #${sequence} ` +
+                `(device dropped ${sensorData.droppedFrames} frames, ${sensorData.droppedSamples} samples so far)`);
+        }
+    }
+    lastSequence = sequence;
+    return missed;
+}
+
+/**
+ * Expands a SensorBatch message into one sample per conversion. Each channel carries its first
+ * value in full and the rest as differences to the previous conversion, in mV and mA.
+ * @param {Object} batch - The decoded SensorBatch message.
+ * @returns {Object[]} The conversions with volts, amps and watts per channel.
+ */
+function expandSensorBatch(batch) {
+    const channels = { USB: batch.usb, MAIN: batch.main, VIN: batch.vin };
+    const running = {};
+    for (const [name, channel] of Object.entries(channels)) {
+        running[name] = { mv: channel ? channel.voltageMv : 0, ma: channel ? channel.currentMa : 0 };
+    }
+
+    const baseUs = Number(batch.baseUs);
+    const timestampMs = Number(batch.timestampMs);
+    const samples = [];
+    let offsetUs = 0;
+    for (let i = 0; i < batch.count; i++) {
+        if (i > 0) {
+            offsetUs += batch.timeDeltaUs[i - 1] || 0;
+            for (const [name, channel] of Object.entries(channels)) {
+                if (channel) {
+                    running[name].mv += channel.voltageDeltaMv[i - 1] || 0;
+                    running[name].ma += channel.currentDeltaMa[i - 1] || 0;
+                }
+            }
+        }
+
+        const sample = {
+            timestamp: timestampMs + Math.round(offsetUs / 1000),
+            acquiredUs: baseUs + offsetUs,
+            sequence: (batch.baseSequence + i) >>> 0
+        };
+        for (const [name, value] of Object.entries(running)) {
+            sample[name] = { voltage: value.mv / 1e3, current: value.ma / 1e3, power: value.mv * value.ma / 1e6 };
+        }
+        samples.push(sample);
+    }
+    return samples;
+}
+
+/**
+ * Counts the conversions missing between the previous SensorBatch and this one.
+ * @param {Object} batch - The decoded SensorBatch message.
+ * @returns {number} Conversions missing before this batch.
+ */
+function checkBatchGap(batch) {
+    const base = batch.baseSequence >>> 0;
+    let missed = 0;
+    if (nextBatchSequence !== null) {
+        missed = (base - nextBatchSequence) >>> 0;
+        if (missed > 0x7fffffff) {
+            missed = 0; // sequence restarted, the device rebooted
+        } else if (missed) {
+            console.warn(`Capture gap: ${missed} conversions missing before #${base}`);
+        }
+    }
+    nextBatchSequence = (base + batch.count) >>> 0;
+    return missed;
 }
 
 function onWsClose() {
     updateWebsocketStatus(false);
+    lastSequence = null;
+    nextBatchSequence = null;
     console.warn('Connection closed. Reconnecting...');
     setTimeout(connect, 2000);
 }
 
 /**
- * Callback for when a message is received from the WebSocket server.
- * @param {MessageEvent} event - The WebSocket message event.
+ * Callback for each StatusMessage received from the WebSocket server.
+ * @param {Uint8Array} buffer - One encoded StatusMessage, already split out of its frame.
  */
-function onWsMessage(event) {
-    if (!(event.data instanceof ArrayBuffer)) {
-        console.warn('Message is not an ArrayBuffer, skipping protobuf decoding.');
-        return;
-    }
-
-    const buffer = new Uint8Array(event.data);
+function onWsMessage(buffer) {
     try {
         const decodedMessage = StatusMessage.decode(buffer);
         const payloadType = decodedMessage.payload;
@@ -94,13 +239,8 @@ function onWsMessage(event) {
                 const sensorData = decodedMessage.sensorData;
                 if (sensorData) {
                     // Create a payload for the sensor UI (charts and header)
-                    const sensorPayload = {
-                        USB: sensorData.usb,
-                        MAIN: sensorData.main,
-                        VIN: sensorData.vin,
-                        timestamp: sensorData.timestampMs,
-                        uptime: sensorData.uptimeMs
-                    };
+                    const sensorPayload = toSensorPayload(sensorData);
+                    sensorPayload.missed = checkSequenceGap(sensorData);
                     updateSensorUI(sensorPayload);
 
                     if (isRecording) {
@@ -115,6 +255,19 @@ function onWsMessage(event) {
                 break;
             }
 
+            case 'sensorBatch': {
+                const batch = decodedMessage.sensorBatch;
+                if (batch && batch.count) {
+                    const missed = checkBatchGap(batch);
+                    if (isRecording) {
+                        const samples = expandSensorBatch(batch);
+                        samples[0].missed = missed;
+                        recordedSamples.push(...samples);
+                    }
+                }
+                break;
+            }
+
             case 'wifiStatus':
                 updateWifiStatusUI(decodedMessage.wifiStatus);
                 break;
@@ -284,6 +437,7 @@ function setupThemeToggles() {
 function startRecording() {
     isRecording = true;
     recordedData = [];
+    recordedSamples = [];
     recordButton.style.display = 'none';
     stopButton.style.display = 'inline-block';
     downloadCsvButton.style.display = 'none';
@@ -294,25 +448,84 @@ function stopRecording() {
     isRecording = false;
     recordButton.style.display = 'inline-block';
     stopButton.style.display = 'none';
-    if (recordedData.length > 0) {
+    if (recordedData.length > 0 || recordedSamples.length > 0) {
         downloadCsvButton.style.display = 'inline-block';
     }
-    console.log('Recording stopped. Data points captured:', recordedData.length);
+    console.log('Recording stopped. Data points captured:', recordedData.length,
+        'capture mode conversions:', recordedSamples.length);
+}
+
+/**
+ * Offers CSV rows as a file download named `${prefix}_<date>_<time>.csv`.
+ * @param {string} prefix - The file name prefix.
+ * @param {string[]} csvRows - The header and data rows.
+ */
+function saveCSV(prefix, csvRows) {
+    const blob = new Blob([csvRows.join('\n')], { type: 'text/csv;charset=utf-8;' });
+    const link = document.createElement('a');
+    const url = URL.createObjectURL(blob);
+
+    const now = new Date();
+    const pad = (num) => num.toString().padStart(2, '0');
+    const datePart = `${now.getFullYear().toString().slice(-2)}-${pad(now.getMonth() + 1)}-${pad(now.getDate())}`;
+    const timePart = `${pad(now.getHours())}-${pad(now.getMinutes())}`;
+
+    link.setAttribute('href', url);
+    link.setAttribute('download', `${prefix}_${datePart}_${timePart}.csv`);
+    link.style.visibility = 'hidden';
+    document.body.appendChild(link);
+    link.click();
+    document.body.removeChild(link);
+}
+
+/**
+ * Saves the conversions recorded in capture mode, one row per conversion.
+ */
+function downloadSamplesCSV() {
+    const headers = [
+        'timestamp', 'acquired_us', 'sequence', 'missed_samples',
+        'vin_voltage', 'vin_current', 'vin_power',
+        'main_voltage', 'main_current', 'main_power',
+        'usb_voltage', 'usb_current', 'usb_power'
+    ];
+    const csvRows = [headers.join(',')];
+    const values = (ch) => [ch.voltage, ch.current, ch.power].map(v => v.toFixed(3));
+
+    recordedSamples.forEach(data => {
+        csvRows.push([
+            new Date(data.timestamp).toISOString(), data.acquiredUs, data.sequence, data.missed || 0,
+            ...values(data.VIN), ...values(data.MAIN), ...values(data.USB)
+        ].join(','));
+    });
+
+    saveCSV('powermate_samples', csvRows);
 }
 
 function downloadCSV() {
-    if (recordedData.length === 0) {
+    if (recordedData.length === 0 && recordedSamples.length === 0) {
         alert('No data to download.');
         return;
     }
+    if (recordedSamples.length > 0) {
+        downloadSamplesCSV();
+    }
+    if (recordedData.length === 0) {
+        return;
+    }
 
     const headers = [
         'timestamp', 'uptime_ms',
         'vin_voltage', 'vin_current', 'vin_power',
         'main_voltage', 'main_current', 'main_power',
-        'usb_voltage', 'usb_current', 'usb_power'
+        'usb_voltage', 'usb_current', 'usb_power',
+        'samples',
+        'vin_current_min', 'vin_current_max', 'vin_current_rms', 'vin_power_max',
+        'main_current_min', 'main_current_max', 'main_current_rms', 'main_power_max',
+        'usb_current_min', 'usb_current_max', 'usb_current_rms', 'usb_power_max',
+        'sequence', 'acquired_us', 'missed_samples'
     ];
     const csvRows = [headers.join(',')];
+    const peaks = (ch) => [ch.currentMin, ch.currentMax, ch.currentRms, ch.powerMax].map(v => Number(v).toFixed(3));
 
     recordedData.forEach(data => {
         const timestamp = new Date(data.timestamp).toISOString();
@@ -321,27 +534,15 @@ function downloadCSV() {
             data.uptime,
             Number(data.VIN.voltage).toFixed(3), Number(data.VIN.current).toFixed(3), Number(data.VIN.power).toFixed(3),
             Number(data.MAIN.voltage).toFixed(3), Number(data.MAIN.current).toFixed(3), Number(data.MAIN.power).toFixed(3),
-            Number(data.USB.voltage).toFixed(3), Number(data.USB.current).toFixed(3), Number(data.USB.power).toFixed(3)
+            Number(data.USB.voltage).toFixed(3), Number(data.USB.current).toFixed(3), Number(data.USB.power).toFixed(3),
+            data.sampleCount,
+            ...peaks(data.VIN), ...peaks(data.MAIN), ...peaks(data.USB),
+            data.sequence, data.acquiredUs, data.missed
         ];
         csvRows.push(row.join(','));
     });
 
-    const blob = new Blob([csvRows.join('\n')], { type: 'text/csv;charset=utf-8;' });
-    const link = document.createElement('a');
-    const url = URL.createObjectURL(blob);
-    
-    const now = new Date();
-    const pad = (num) => num.toString().padStart(2, '0');
-    const datePart = `${now.getFullYear().toString().slice(-2)}-${pad(now.getMonth() + 1)}-${pad(now.getDate())}`;
-    const timePart = `${pad(now.getHours())}-${pad(now.getMinutes())}`;
-    const filename = `powermate_${datePart}_${timePart}.csv`;
-
-    link.setAttribute('href', url);
-    link.setAttribute('download', filename);
-    link.style.visibility = 'hidden';
-    document.body.appendChild(link);
-    link.click();
-    document.body.removeChild(link);
+    saveCSV('powermate', csvRows);
 }
 
 function downloadEventsCSV() {
@@ -371,22 +572,7 @@ function downloadEventsCSV() {
         csvRows.push([timestamp, uptime, levelText, safeMsg].join(','));
     });
 
-    const blob = new Blob([csvRows.join('\n')], { type: 'text/csv;charset=utf-8;' });
-    const link = document.createElement('a');
-    const url = URL.createObjectURL(blob);
-
-    const now = new Date();
-    const pad = (num) => num.toString().padStart(2, '0');
-    const datePart = `${now.getFullYear().toString().slice(-2)}-${pad(now.getMonth() + 1)}-${pad(now.getDate())}`;
-    const timePart = `${pad(now.getHours())}-${pad(now.getMinutes())}`;
-    const filename = `powermate_events_${datePart}_${timePart}.csv`;
-
-    link.setAttribute('href', url);
-    link.setAttribute('download', filename);
-    link.style.visibility = 'hidden';
-    document.body.appendChild(link);
-    link.click();
-    document.body.removeChild(link);
+    saveCSV('powermate_events', csvRows);
 }
 
 // --- Application Initialization ---
@@ -45,6 +45,9 @@ export function updateSensorUI(data) {
         dom.voltageDisplay.textContent = `${data.VIN.voltage.toFixed(2)} V`;
         dom.currentDisplay.textContent = `${data.VIN.current.toFixed(2)} A`;
         dom.powerDisplay.textContent = `${data.VIN.power.toFixed(2)} W`;
+        // The peak is only meaningful when more than one sample was aggregated
+        dom.currentPeakDisplay.textContent = data.sampleCount > 1 ? `(pk ${data.VIN.currentMax.toFixed(2)} A)` : '';
+        dom.energyDisplay.textContent = `${data.VIN.energyWh.toFixed(3)} Wh`;
     }
 
     // Pass the entire multi-channel data object to the charts
@@ -355,6 +358,72 @@ export async function applyPeriodSettings() {
     }
 }
 
+/**
+ * Enables or disables the high-rate capture mode on the server.
+ */
+export async function applyCaptureSetting() {
+    const enabled = dom.captureToggle.checked;
+    dom.captureToggle.disabled = true;
+
+    try {
+        await api.postCaptureSetting(enabled);
+    } catch (error) {
+        console.error('Error applying capture mode:', error);
+        dom.captureToggle.checked = !enabled;
+    } finally {
+        dom.captureToggle.disabled = false;
+    }
+}
+
+/**
+ * Applies the adaptive sensor rate settings by sending them to the server.
+ */
+export async function applyAdaptiveSettings() {
+    const enabled = dom.adaptiveToggle.checked;
+    const threshold = parseInt(dom.adaptiveThresholdInput.value, 10);
+    dom.adaptiveApplyButton.disabled = true;
+    dom.adaptiveApplyButton.innerHTML = `<span class="spinner-border spinner-border-sm" aria-hidden="true"></span> Applying...`;
+
+    try {
+        await api.postAdaptiveSetting(enabled, threshold);
+    } catch (error) {
+        console.error('Error applying adaptive rate:', error);
+    } finally {
+        dom.adaptiveApplyButton.disabled = false;
+        dom.adaptiveApplyButton.innerHTML = 'Apply';
+    }
+}
+
+/**
+ * Shows the sample rate the selected averaging and conversion times allow, three channels per conversion.
+ */
+export function updateSampleRate() {
+    const averaging = parseInt(dom.averagingSelect.value, 10);
+    const periodUs = (parseInt(dom.busCtSelect.value, 10) + parseInt(dom.shuntCtSelect.value, 10)) * 3 * averaging;
+    const rate = 1000000 / periodUs;
+    dom.sampleRateValue.textContent = rate >= 10 ? rate.toFixed(0) : rate.toFixed(2);
+}
+
+/**
+ * Applies the sensor averaging and conversion times by sending them to the server.
+ */
+export async function applyConversionSettings() {
+    const averaging = parseInt(dom.averagingSelect.value, 10);
+    const busCt = parseInt(dom.busCtSelect.value, 10);
+    const shuntCt = parseInt(dom.shuntCtSelect.value, 10);
+    dom.conversionApplyButton.disabled = true;
+    dom.conversionApplyButton.innerHTML = `<span class="spinner-border spinner-border-sm" aria-hidden="true"></span> Applying...`;
+
+    try {
+        await api.postConversionSetting(averaging, busCt, shuntCt);
+    } catch (error) {
+        console.error('Error applying conversion setting:', error);
+    } finally {
+        dom.conversionApplyButton.disabled = false;
+        dom.conversionApplyButton.innerHTML = 'Apply';
+    }
+}
+
 /**
  * Fetches and displays the current network and device settings in the settings modal.
  */
@@ -396,6 +465,19 @@ export async function initializeSettings() {
             dom.periodSlider.value = data.period;
             dom.periodValue.textContent = data.period;
         }
+        if (data.capture !== undefined) {
+            dom.captureToggle.checked = data.capture;
+        }
+        if (data.adaptive !== undefined) {
+            dom.adaptiveToggle.checked = data.adaptive;
+            dom.adaptiveThresholdInput.value = data.adaptive_threshold;
+        }
+        if (data.averaging !== undefined) {
+            dom.averagingSelect.value = data.averaging;
+            dom.busCtSelect.value = data.bus_ct;
+            dom.shuntCtSelect.value = data.shunt_ct;
+            dom.sampleRateValue.textContent = data.sample_rate >= 10 ? data.sample_rate.toFixed(0) : data.sample_rate.toFixed(2);
+        }
 
     } catch (error) {
         console.error('Error initializing settings:', error);
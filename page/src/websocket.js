@@ -18,6 +18,38 @@ let pongTimeoutId = null;
 const HEARTBEAT_INTERVAL = 10000; // 10 seconds: How often to send a 'ping'
 const HEARTBEAT_TIMEOUT = 5000; // 5 seconds: How long to wait for a 'pong' after sending a 'ping'
 
+/**
+ * Splits a binary frame from the device into its StatusMessages. The device packs several messages
+ * into one frame, each prefixed with its length as a protobuf varint.
+ * @param {ArrayBuffer} buffer - The frame payload.
+ * @returns {Uint8Array[]} The encoded messages, as views into the frame.
+ */
+export function splitFrame(buffer) {
+    const bytes = new Uint8Array(buffer);
+    const messages = [];
+    let pos = 0;
+    while (pos < bytes.length) {
+        let length = 0;
+        let shift = 0;
+        let byte;
+        do {
+            if (pos >= bytes.length || shift > 28) {
+                throw new Error('Malformed length prefix in WebSocket frame');
+            }
+            byte = bytes[pos++];
+            length += (byte & 0x7f) * 2 ** shift;
+            shift += 7;
+        } while (byte & 0x80);
+
+        if (pos + length > bytes.length) {
+            throw new Error('Truncated message in WebSocket frame');
+        }
+        messages.push(bytes.subarray(pos, pos + length));
+        pos += length;
+    }
+    return messages;
+}
+
 /**
  * Starts the heartbeat mechanism.
  * Sends a 'ping' message to the server at regular intervals and sets a timeout
@@ -59,7 +91,7 @@ function stopHeartbeat() {
  * @param {Object} callbacks - An object containing callback functions for WebSocket events.
  * @param {function} [callbacks.onOpen] - Called when the connection is successfully opened.
  * @param {function} [callbacks.onClose] - Called when the connection is closed.
- * @param {function} [callbacks.onMessage] - Called when a message is received from the server (excluding 'pong' messages).
+ * @param {function} [callbacks.onMessage] - Called with each encoded StatusMessage (a Uint8Array) received from the server.
  * @param {function} [callbacks.onError] - Called when an error occurs with the WebSocket connection.
  */
 export function initWebSocket({onOpen, onClose, onMessage, onError}) {
@@ -97,12 +129,23 @@ export function initWebSocket({onOpen, onClose, onMessage, onError}) {
             // Clear the timeout as pong was received, resetting for the next ping
             clearTimeout(pongTimeoutId);
             pongTimeoutId = null;
+        } else if (!(event.data instanceof ArrayBuffer)) {
+            console.warn('Unexpected text message on WebSocket:', event.data);
         } else {
-            // If it's not a pong message, pass it to the user's onMessage callback
-            if (onMessage) {
-                onMessage(event);
-            } else {
-                console.log('WebSocket message received:', event.data);
+            // Unpack the frame and pass every message to the user's onMessage callback
+            let messages;
+            try {
+                messages = splitFrame(event.data);
+            } catch (e) {
+                console.error('Error splitting WebSocket frame:', e);
+                return;
+            }
+            for (const message of messages) {
+                if (onMessage) {
+                    onMessage(message);
+                } else {
+                    console.log('WebSocket message received:', message);
+                }
             }
         }
     };